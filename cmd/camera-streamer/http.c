@@ -1,5 +1,7 @@
 #include "util/http/http.h"
 #include "output/webrtc/webrtc.h"
+#include "output/rtp/rtp.h"
+#include "output/dvr/dvr.h"
 #include "device/camera/camera.h"
 #include "output/output.h"
 
@@ -9,7 +11,11 @@ extern unsigned char html_webrtc_html[];
 extern unsigned int html_webrtc_html_len;
 extern unsigned char html_control_html[];
 extern unsigned int html_control_html_len;
-extern camera_t *camera;
+extern pthread_mutex_t cameras_lock;
+extern camera_t *cameras[MAX_OUTPUT_CAMERAS];
+extern camera_options_t *all_camera_options[MAX_OUTPUT_CAMERAS];
+
+extern void inherit(camera_options_t *options);
 
 extern void camera_status_json(http_worker_t *worker, FILE *stream);
 
@@ -36,8 +42,10 @@ static void camera_post_option(http_worker_t *worker, FILE *stream)
   }
 
   bool found = false;
+  pthread_mutex_lock(&cameras_lock);
+  camera_t *camera = worker->camera_index < MAX_OUTPUT_CAMERAS ? cameras[worker->camera_index] : NULL;
 
-  for (int i = 0; i < MAX_DEVICES; i++) {
+  for (int i = 0; camera && i < MAX_DEVICES; i++) {
     device_t *dev = camera->devices[i];
     if (!dev) {
       continue;
@@ -57,6 +65,8 @@ static void camera_post_option(http_worker_t *worker, FILE *stream)
     }
   }
 
+  pthread_mutex_unlock(&cameras_lock);
+
   if (!found) {
     http_once(stream, http_404, &found);
     fprintf(stream, "The option was not found for device='%s', key='%s', value='%s'.\r\n",
@@ -69,6 +79,85 @@ cleanup:
   free(value);
 }
 
+static void camera_get_uint_param(http_worker_t *worker, const char *key, unsigned *value)
+{
+  char *param = http_get_param(worker, key);
+  if (param) {
+    *value = strtoul(param, NULL, 10);
+    free(param);
+  }
+}
+
+static void camera_post_config(http_worker_t *worker, FILE *stream)
+{
+  pthread_mutex_lock(&cameras_lock);
+
+  // the camera thread owns the slot and the options until it is running again
+  camera_t *camera = worker->camera_index < MAX_OUTPUT_CAMERAS ? cameras[worker->camera_index] : NULL;
+  if (!camera) {
+    http_404(stream, "");
+    fprintf(stream, "No camera is running.\r\n");
+    goto unlock;
+  } else if (camera->restart) {
+    http_write_response(stream, "409 Conflict", NULL, "", 0);
+    fprintf(stream, "%s: The camera is restarting.\r\n", camera->name);
+    goto unlock;
+  }
+
+  camera_options_t *options = all_camera_options[worker->camera_index];
+  camera_options_t changed = *options;
+
+  camera_get_uint_param(worker, "width", &changed.width);
+  camera_get_uint_param(worker, "height", &changed.height);
+  camera_get_uint_param(worker, "fps", &changed.fps);
+  camera_get_uint_param(worker, "snapshot.height", &changed.snapshot.height);
+  camera_get_uint_param(worker, "stream.height", &changed.stream.height);
+  camera_get_uint_param(worker, "video.height", &changed.video.height);
+
+  if (!changed.width || !changed.height || !changed.fps) {
+    http_400(stream, "");
+    fprintf(stream, "The width, height and fps cannot be zero.\r\n");
+    goto unlock;
+  }
+
+  inherit(&changed);
+
+  bool restart =
+    changed.width != options->width ||
+    changed.height != options->height ||
+    changed.snapshot.height != options->snapshot.height ||
+    changed.stream.height != options->stream.height ||
+    changed.video.height != options->video.height;
+
+  // the frame rate is applied to the running camera
+  if (!restart && changed.fps != options->fps) {
+    device_set_fps(camera->camera, changed.fps);
+    camera->options.fps = changed.fps;
+  }
+
+  *options = changed;
+
+  if (restart) {
+    camera_restart(camera);
+  }
+
+  http_200(stream, "");
+  fprintf(stream, "%s: %ux%u at %u fps, snapshot=%up, stream=%up, video=%up%s.\r\n",
+    camera->name, changed.width, changed.height, changed.fps,
+    changed.snapshot.height, changed.stream.height, changed.video.height,
+    restart ? ", restarting" : "");
+
+unlock:
+  pthread_mutex_unlock(&cameras_lock);
+}
+
+static void http_webrtc_content(http_worker_t *worker, FILE *stream)
+{
+  if (http_output_first_camera(worker, stream)) {
+    http_content(worker, stream);
+  }
+}
+
 static void http_cors_options(http_worker_t *worker, FILE *stream)
 {
   fprintf(stream, "HTTP/1.1 204 No Data\r\n");
@@ -86,14 +175,24 @@ http_method_t http_methods[] = {
   { "GET",  "/?action=stream", http_stream },
   { "GET",  "/video", http_detect_video },
   { "GET",  "/video.m3u8", http_m3u8_video },
+  { "GET",  "/hls/init.mp4", http_hls_init },
+  { "GET",  "/hls/segment.mp4", http_hls_segment },
+  { "GET",  "/hls/part.mp4", http_hls_part },
   { "GET",  "/video.h264", http_h264_video },
   { "GET",  "/video.mkv", http_mkv_video },
   { "GET",  "/video.mp4", http_mp4_video },
-  { "GET",  "/webrtc", http_content, "text/html", html_webrtc_html, 0, &html_webrtc_html_len },
+  { "GET",  "/video.ts", http_mpegts_video },
+  { "GET",  "/video.sdp", http_rtp_sdp },
+  { "GET",  "/video.ws", http_websocket_video },
+  { "GET",  "/stream.ws", http_websocket_stream },
+  { "POST", "/record/trigger", http_dvr_trigger },
+  { "GET",  "/tap", http_tap },
+  { "GET",  "/webrtc", http_webrtc_content, "text/html", html_webrtc_html, 0, &html_webrtc_html_len },
   { "POST", "/webrtc", http_webrtc_offer },
   { "GET",  "/control", http_content, "text/html", html_control_html, 0, &html_control_html_len },
   { "GET",  "/option", camera_post_option },
   { "POST", "/option", camera_post_option },
+  { "POST", "/config", camera_post_config },
   { "GET",  "/status", camera_status_json },
   { "GET",  "/", http_content, "text/html", html_index_html, 0, &html_index_html_len },
   { "OPTIONS", "*/", http_cors_options },
@@ -4,19 +4,40 @@
 #include "device/camera/camera.h"
 #include "output/rtsp/rtsp.h"
 #include "output/webrtc/webrtc.h"
+#include "output/rtp/rtp.h"
+#include "output/recorder/recorder.h"
+#include "output/dvr/dvr.h"
+#include "output/output.h"
+#include "util/uevent/uevent.h"
 #include "version.h"
 
 #include <signal.h>
 #include <unistd.h>
+#include <pthread.h>
 
 extern option_t all_options[];
 extern camera_options_t camera_options;
+extern camera_options_t camera1_options;
+extern camera_options_t camera2_options;
+extern camera_options_t camera3_options;
 extern http_server_options_t http_options;
 extern http_method_t http_methods[];
 extern rtsp_options_t rtsp_options;
 extern webrtc_options_t webrtc_options;
+extern rtp_options_t rtp_options;
+extern recorder_options_t recorder_options;
+extern dvr_options_t dvr_options;
 
-camera_t *camera;
+camera_options_t *all_camera_options[MAX_OUTPUT_CAMERAS] = {
+  &camera_options,
+  &camera1_options,
+  &camera2_options,
+  &camera3_options
+};
+
+// guards `cameras` and the options of the running cameras, changed by `/config`
+pthread_mutex_t cameras_lock = PTHREAD_MUTEX_INITIALIZER;
+camera_t *cameras[MAX_OUTPUT_CAMERAS];
 
 void deprecations()
 {
@@ -36,16 +57,153 @@ void deprecations()
   }
 }
 
-void inherit()
+void inherit(camera_options_t *options)
 {
-  if (!camera_options.snapshot.height || camera_options.snapshot.height > camera_options.height)
-    camera_options.snapshot.height = camera_options.height;
+  if (!options->snapshot.height || options->snapshot.height > options->height)
+    options->snapshot.height = options->height;
+
+  if (!options->video.height || options->video.height > options->snapshot.height)
+    options->video.height = options->snapshot.height;
+
+  if (!options->stream.height || options->stream.height > options->video.height)
+    options->stream.height = options->video.height;
 
-  if (!camera_options.video.height || camera_options.video.height > camera_options.snapshot.height)
-    camera_options.video.height = camera_options.snapshot.height;
+  if (!options->sub_video.height || options->sub_video.height > options->video.height)
+    options->sub_video.height = options->video.height;
+}
 
-  if (!camera_options.stream.height || camera_options.stream.height > camera_options.video.height)
-    camera_options.stream.height = camera_options.video.height;
+void extra_cameras_defaults()
+{
+  for (int i = 1; i < MAX_OUTPUT_CAMERAS; i++) {
+    *all_camera_options[i] = camera_options;
+    all_camera_options[i]->index = i;
+    all_camera_options[i]->path[0] = 0;
+  }
+}
+
+void extra_cameras_inherit()
+{
+  for (int i = 1; i < MAX_OUTPUT_CAMERAS; i++) {
+    all_camera_options[i]->auto_reconnect = camera_options.auto_reconnect;
+    all_camera_options[i]->force_active = camera_options.force_active;
+    all_camera_options[i]->release_idle = camera_options.release_idle;
+    all_camera_options[i]->idle_fps = camera_options.idle_fps;
+    strcpy(all_camera_options[i]->probe_cache, camera_options.probe_cache);
+    inherit(all_camera_options[i]);
+  }
+}
+
+static void camera_wait_reconnect(camera_options_t *options, int uevent_fd)
+{
+  uint64_t deadline_us = get_monotonic_time_us(NULL, NULL) + options->auto_reconnect * 1000LL * 1000LL;
+
+  if (uevent_fd < 0) {
+    sleep(options->auto_reconnect);
+    return;
+  }
+
+  for (uint64_t now_us; (now_us = get_monotonic_time_us(NULL, NULL)) < deadline_us; ) {
+    if (!uevent_wait_video_added(uevent_fd, (deadline_us - now_us) / 1000)) {
+      break;
+    }
+
+    // the node and its links might appear after the first event, as udev processes it
+    if (strncmp(options->path, "/dev/", 5) || access(options->path, R_OK | W_OK) == 0) {
+      LOG_INFO(NULL, "The camera was connected.");
+      return;
+    }
+  }
+}
+
+static int camera_run_published(camera_t *camera, camera_options_t *options)
+{
+  pthread_mutex_lock(&cameras_lock);
+  cameras[options->index] = camera;
+  pthread_mutex_unlock(&cameras_lock);
+
+  int ret = camera_run(camera);
+
+  pthread_mutex_lock(&cameras_lock);
+  cameras[options->index] = NULL;
+  pthread_mutex_unlock(&cameras_lock);
+  return ret;
+}
+
+int camera_loop(camera_options_t *options)
+{
+  camera_options_t previous;
+  bool restart = false;
+  int ret = -1;
+
+  // connected cameras are noticed right away, instead of after the full delay
+  int uevent_fd = options->auto_reconnect > 0 ? uevent_open() : -1;
+
+  while (true) {
+    pthread_mutex_lock(&cameras_lock);
+    camera_options_t current = *options;
+    pthread_mutex_unlock(&cameras_lock);
+
+    camera_t *camera = camera_open(&current);
+
+    if (!camera && restart) {
+      LOG_INFO(NULL, "Cannot apply the new configuration. Reverting...");
+      pthread_mutex_lock(&cameras_lock);
+      *options = previous;
+      pthread_mutex_unlock(&cameras_lock);
+      restart = false;
+      continue;
+    }
+
+    restart = false;
+
+    if (camera) {
+      ret = camera_run_published(camera, options);
+
+      // only the camera device is reopened, as long as it negotiates the same format
+      while (!camera->restart && options->auto_reconnect > 0) {
+        LOG_INFO(NULL, "Automatically reconnecting in %d seconds...", options->auto_reconnect);
+        camera_wait_reconnect(options, uevent_fd);
+
+        int reconnected = camera_reconnect(camera);
+        if (reconnected > 0) {
+          break;
+        } else if (reconnected == 0) {
+          ret = camera_run_published(camera, options);
+        }
+      }
+
+      pthread_mutex_lock(&cameras_lock);
+      restart = camera->restart;
+      previous = camera->options;
+      pthread_mutex_unlock(&cameras_lock);
+
+      bool reopen = !restart && options->auto_reconnect > 0;
+      camera_close(&camera);
+
+      if (reopen) {
+        LOG_INFO(NULL, "Reopening the camera pipeline...");
+        continue;
+      }
+    }
+
+    if (restart) {
+      LOG_INFO(NULL, "Restarting with the new configuration...");
+    } else if (options->auto_reconnect > 0) {
+      LOG_INFO(NULL, "Automatically reconnecting in %d seconds...", options->auto_reconnect);
+      camera_wait_reconnect(options, uevent_fd);
+    } else {
+      break;
+    }
+  }
+
+  uevent_close(uevent_fd);
+  return ret;
+}
+
+static void *camera_thread(void *opaque)
+{
+  camera_loop(opaque);
+  return NULL;
 }
 
 int main(int argc, char *argv[])
@@ -53,17 +211,22 @@ int main(int argc, char *argv[])
   int http_fd = -1;
   int ret = -1;
 
+  extra_cameras_defaults();
+
   if (parse_opts(all_options, argc, argv) < 0) {
     return -1;
   }
 
   printf("%s Version: %s (%s)\n", argv[0], GIT_VERSION, GIT_REVISION);
 
+  log_start();
+
   deprecations();
-  inherit();
+  inherit(&camera_options);
+  extra_cameras_inherit();
 
   if (camera_options.list_options) {
-    camera = camera_open(&camera_options);
+    camera_t *camera = camera_open(&camera_options);
     if (camera) {
       printf("\n");
       for (int i = 0; i < MAX_DEVICES; i++) {
@@ -74,11 +237,23 @@ int main(int argc, char *argv[])
     return -1;
   }
 
+  if (camera_options.explain_pipeline) {
+    camera_t *camera = camera_open(&camera_options);
+    if (!camera) {
+      return -1;
+    }
+    camera_close(&camera);
+    return 0;
+  }
+
   http_fd = http_server(&http_options, http_methods);
   if (http_fd < 0) {
     goto error;
   }
 
+  http_hls_register();
+  http_mpegts_register();
+
   if (rtsp_options.port > 0 && rtsp_server(&rtsp_options) < 0) {
     goto error;
   }
@@ -87,21 +262,33 @@ int main(int argc, char *argv[])
     goto error;
   }
 
-  while (true) {
-    camera = camera_open(&camera_options);
-    if (camera) {
-      ret = camera_run(camera);
-      camera_close(&camera);
+  if (rtp_options.group[0] && rtp_server(&rtp_options) < 0) {
+    goto error;
+  }
+
+  if (recorder_options.path[0] && recorder_server(&recorder_options) < 0) {
+    goto error;
+  }
+
+  if (dvr_options.size > 0 && dvr_server(&dvr_options) < 0) {
+    goto error;
+  }
+
+  for (int i = 1; i < MAX_OUTPUT_CAMERAS; i++) {
+    pthread_t thread;
+
+    if (!all_camera_options[i]->path[0]) {
+      continue;
     }
 
-    if (camera_options.auto_reconnect > 0) {
-      LOG_INFO(NULL, "Automatically reconnecting in %d seconds...", camera_options.auto_reconnect);
-      sleep(camera_options.auto_reconnect);
-    } else {
-      break;
+    if (pthread_create(&thread, NULL, camera_thread, all_camera_options[i]) != 0) {
+      goto error;
     }
+    pthread_detach(thread);
   }
 
+  ret = camera_loop(&camera_options);
+
 error:
   close(http_fd);
   return ret;
@@ -5,6 +5,9 @@
 #include "device/camera/camera.h"
 #include "output/rtsp/rtsp.h"
 #include "output/webrtc/webrtc.h"
+#include "output/rtp/rtp.h"
+#include "output/recorder/recorder.h"
+#include "output/dvr/dvr.h"
 #include "output/output.h"
 
 camera_options_t camera_options = {
@@ -41,10 +44,32 @@ camera_options_t camera_options = {
       "h264_level=4" OPTION_VALUE_LIST_SEP
       "h264_profile=high" OPTION_VALUE_LIST_SEP
       "h264_minimum_qp_value=16" OPTION_VALUE_LIST_SEP
-      "h264_maximum_qp_value=32"
+      "h264_maximum_qp_value=32",
+    .gop_cache = 4096,
+    .force_key_interval = 1000
+  },
+  .sub_video = {
+    .disabled = 1,
+    .height = 360,
+    .options =
+      "video_bitrate_mode=0" OPTION_VALUE_LIST_SEP
+      "video_bitrate=500000" OPTION_VALUE_LIST_SEP
+      "repeat_sequence_header=5000000" OPTION_VALUE_LIST_SEP
+      "h264_i_frame_period=30" OPTION_VALUE_LIST_SEP
+      "h264_level=4" OPTION_VALUE_LIST_SEP
+      "h264_profile=high" OPTION_VALUE_LIST_SEP
+      "h264_minimum_qp_value=16" OPTION_VALUE_LIST_SEP
+      "h264_maximum_qp_value=32",
+    .gop_cache = 1024,
+    .force_key_interval = 1000
   }
 };
 
+// additional cameras are initialized from `camera_options` defaults in `main()`
+camera_options_t camera1_options;
+camera_options_t camera2_options;
+camera_options_t camera3_options;
+
 http_server_options_t http_options = {
   .listen = "127.0.0.1",
   .port = 8080,
@@ -58,12 +83,31 @@ log_options_t log_options = {
 
 rtsp_options_t rtsp_options = {
   .port = 0,
-  .allow_truncated = false
 };
 
 webrtc_options_t webrtc_options = {
 };
 
+rtp_options_t rtp_options = {
+  .group = "",
+  .port = 5004,
+  .ttl = 1,
+  .mtu = 1500
+};
+
+recorder_options_t recorder_options = {
+  .path = "",
+  .segment_duration = 60,
+  .segment_size = 64,
+  .max_segments = 100
+};
+
+dvr_options_t dvr_options = {
+  .size = 0,
+  .duration = 30,
+  .path = ""
+};
+
 option_value_t camera_formats[] = {
   { "DEFAULT", 0 },
   { "YUYV", V4L2_PIX_FMT_YUYV },
@@ -94,6 +138,23 @@ option_value_t camera_type[] = {
   {}
 };
 
+#define DEFINE_EXTRA_CAMERA_OPTIONS(_section) \
+  DEFINE_OPTION_PTR(_section, path, string, "Chooses an additional camera served under `/camN/`. If empty the camera is disabled."), \
+  DEFINE_OPTION_VALUES(_section, type, camera_type, "Select camera type."), \
+  DEFINE_OPTION(_section, width, uint, "Set the camera capture width."), \
+  DEFINE_OPTION(_section, height, uint, "Set the camera capture height."), \
+  DEFINE_OPTION_VALUES(_section, format, camera_formats, "Set the camera capture format."), \
+  DEFINE_OPTION(_section, nbufs, uint, "Set number of capture buffers."), \
+  DEFINE_OPTION(_section, fps, uint, "Set the desired capture framerate."), \
+  DEFINE_OPTION_PTR(_section, options, list, "Set the camera options."), \
+  DEFINE_OPTION_PTR(_section, pipeline, string, "Build the outputs from the pipeline description file."), \
+  DEFINE_OPTION(_section, snapshot.height, uint, "Override the snapshot height."), \
+  DEFINE_OPTION_DEFAULT(_section, stream.disabled, bool, "1", "Disable stream."), \
+  DEFINE_OPTION(_section, stream.height, uint, "Override the stream height."), \
+  DEFINE_OPTION_DEFAULT(_section, video.disabled, bool, "1", "Disable video."), \
+  DEFINE_OPTION_PTR(_section, video.options, list, "Set the H264 encoding options."), \
+  DEFINE_OPTION(_section, video.height, uint, "Override the video height.")
+
 option_t all_options[] = {
   DEFINE_OPTION_PTR(camera, path, string, "Chooses the camera to use. If empty connect to default."),
   DEFINE_OPTION_VALUES(camera, type, camera_type, "Select camera type."),
@@ -109,6 +170,8 @@ option_t all_options[] = {
   DEFINE_OPTION(camera, auto_reconnect, uint, "Set the camera auto-reconnect delay in seconds."),
   DEFINE_OPTION_DEFAULT(camera, auto_focus, bool, "1", "Do auto-focus on start-up (does not work with all camera)."),
   DEFINE_OPTION_DEFAULT(camera, force_active, bool, "1", "Force camera to be always active."),
+  DEFINE_OPTION(camera, release_idle, uint, "Free the buffers of encoders and rescalers without consumers for this many seconds, 0 keeps them allocated."),
+  DEFINE_OPTION(camera, idle_fps, uint, "Capture at this rate without consumers to keep a recent frame, 0 pauses the camera."),
   DEFINE_OPTION_DEFAULT(camera, vflip, bool, "1", "Do vertical image flip (does not work with all camera)."),
   DEFINE_OPTION_DEFAULT(camera, hflip, bool, "1", "Do horizontal image flip (does not work with all camera)."),
 
@@ -116,16 +179,35 @@ option_t all_options[] = {
 
   DEFINE_OPTION_PTR(camera, snapshot.options, list, "Set the JPEG compression options. List all available options with `-camera-list_options`."),
   DEFINE_OPTION(camera, snapshot.height, uint, "Override the snapshot height and maintain aspect ratio."),
+  DEFINE_OPTION_DEFAULT(camera, snapshot.lazy, bool, "1", "Encode the snapshot only when requested from the latest retained frame."),
+  DEFINE_OPTION_PTR(camera, snapshot.ladder, string, "Additional snapshot heights selected with `?res=`. Ex.: `-camera-snapshot.ladder=720,360`"),
 
   DEFINE_OPTION_DEFAULT(camera, stream.disabled, bool, "1", "Disable stream."),
   DEFINE_OPTION_PTR(camera, stream.options, list, "Set the JPEG compression options. List all available options with `-camera-list_options`."),
   DEFINE_OPTION(camera, stream.height, uint, "Override the stream height and maintain aspect ratio."),
+  DEFINE_OPTION_PTR(camera, stream.ladder, string, "Additional stream heights selected with `?res=`. Ex.: `-camera-stream.ladder=720,360`"),
 
   DEFINE_OPTION_DEFAULT(camera, video.disabled, bool, "1", "Disable video."),
   DEFINE_OPTION_PTR(camera, video.options, list, "Set the H264 encoding options. List all available options with `-camera-list_options`."),
   DEFINE_OPTION(camera, video.height, uint, "Override the video height and maintain aspect ratio."),
+  DEFINE_OPTION_PTR(camera, video.ladder, string, "Additional video heights selected with `?res=`. Ex.: `-camera-video.ladder=480`"),
+  DEFINE_OPTION(camera, video.gop_cache, uint, "Set the size in KiB of the cache of frames since the last key frame, replayed to new clients. Set to 0 to disable."),
+  DEFINE_OPTION(camera, video.force_key_interval, uint, "Set the minimum interval in ms between key frames forced by new clients."),
+
+  DEFINE_OPTION_DEFAULT(camera, sub_video.disabled, bool, "1", "Disable the low resolution H264 sub-stream (enabled with `-camera-sub_video.disabled=0`)."),
+  DEFINE_OPTION_PTR(camera, sub_video.options, list, "Set the H264 encoding options of the sub-stream. List all available options with `-camera-list_options`."),
+  DEFINE_OPTION(camera, sub_video.height, uint, "Set the sub-stream height and maintain aspect ratio."),
+  DEFINE_OPTION(camera, sub_video.gop_cache, uint, "Set the size in KiB of the sub-stream cache of frames since the last key frame."),
+  DEFINE_OPTION(camera, sub_video.force_key_interval, uint, "Set the minimum interval in ms between sub-stream key frames forced by new clients."),
 
   DEFINE_OPTION_DEFAULT(camera, list_options, bool, "1", "List all available options and exit."),
+  DEFINE_OPTION_DEFAULT(camera, explain_pipeline, bool, "1", "Print the chosen and rejected routes of all outputs and exit."),
+  DEFINE_OPTION_PTR(camera, probe_cache, string, "Cache the capabilities of the video devices in this file to speed up the start."),
+  DEFINE_OPTION_PTR(camera, pipeline, string, "Build the outputs from the pipeline description file instead of the snapshot/stream/video options."),
+
+  DEFINE_EXTRA_CAMERA_OPTIONS(camera1),
+  DEFINE_EXTRA_CAMERA_OPTIONS(camera2),
+  DEFINE_EXTRA_CAMERA_OPTIONS(camera3),
 
   DEFINE_OPTION_PTR(http, listen, string, "Set the IP address the HTTP web-server will bind to. Set to 0.0.0.0 to listen on all interfaces."),
   DEFINE_OPTION(http, port, uint, "Set the HTTP web-server port."),
@@ -136,10 +218,25 @@ option_t all_options[] = {
   DEFINE_OPTION_PTR(webrtc, ice_servers, list, "Specify ICE servers: [(stun|turn|turns)(:|://)][username:password@]hostname[:port][?transport=udp|tcp|tls)]."),
   DEFINE_OPTION_DEFAULT(webrtc, disable_client_ice, bool, "1", "Ignore ICE servers provided in '/webrtc' request."),
 
+  DEFINE_OPTION_PTR(rtp, group, string, "Send H264 as RTP to the given multicast group (or unicast address). Ex.: `-rtp-group=239.0.0.1`"),
+  DEFINE_OPTION(rtp, port, uint, "Set the RTP destination port."),
+  DEFINE_OPTION(rtp, ttl, uint, "Set the RTP multicast TTL."),
+  DEFINE_OPTION(rtp, mtu, uint, "Set the RTP network MTU used to fragment frames."),
+
+  DEFINE_OPTION_PTR(recorder, path, string, "Record H264 as fragmented MP4 segments to the given directory. Ex.: `-recorder-path=/var/lib/camera-streamer`"),
+  DEFINE_OPTION(recorder, segment_duration, uint, "Set the segment duration in seconds."),
+  DEFINE_OPTION(recorder, segment_size, uint, "Set the maximum segment size in MiB, also preallocated on disk."),
+  DEFINE_OPTION(recorder, max_segments, uint, "Set the number of segments kept, older ones are removed."),
+
+  DEFINE_OPTION(dvr, size, uint, "Keep up to the given MiB of recent H264 frames in memory for `POST /record/trigger`. Set to 0 to disable."),
+  DEFINE_OPTION(dvr, duration, uint, "Set how many seconds of recent H264 frames are kept in memory."),
+  DEFINE_OPTION_PTR(dvr, path, string, "Write triggered events to the given directory instead of the HTTP response."),
+
   DEFINE_OPTION_DEFAULT(log, debug, bool, "1", "Enable debug logging."),
   DEFINE_OPTION_DEFAULT(log, verbose, bool, "1", "Enable verbose logging."),
   DEFINE_OPTION_DEFAULT(log, stats, uint, "1", "Print statistics every duration."),
   DEFINE_OPTION_PTR(log, filter, list, "Enable debug logging from the given files. Ex.: `-log-filter=buffer.cc`"),
+  DEFINE_OPTION_DEFAULT(log, sync, bool, "1", "Write the logs from the calling thread instead of the background logging thread."),
 
   {}
 };
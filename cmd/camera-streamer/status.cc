@@ -8,13 +8,19 @@ extern "C" {
 #include "device/camera/camera.h"
 #include "output/rtsp/rtsp.h"
 #include "output/webrtc/webrtc.h"
+#include "output/rtp/rtp.h"
+#include "output/recorder/recorder.h"
+#include "output/dvr/dvr.h"
 #include "output/output.h"
 #include "version.h"
 
-extern camera_t *camera;
+extern camera_t *cameras[MAX_OUTPUT_CAMERAS];
 extern http_server_options_t http_options;
 extern rtsp_options_t rtsp_options;
 extern webrtc_options_t webrtc_options;
+extern rtp_options_t rtp_options;
+extern recorder_options_t recorder_options;
+extern dvr_options_t dvr_options;
 
 };
 
@@ -43,6 +49,8 @@ static nlohmann::json serialize_buf_lock(buffer_lock_t *buf_lock)
 
   nlohmann::json output;
   output["name"] = buf_lock->name;
+
+  pthread_mutex_lock(&buf_lock->lock);
   output["enabled"] = (buf_lock->buf_list != NULL);
 
   if (buf_lock->buf_list) {
@@ -53,9 +61,32 @@ static nlohmann::json serialize_buf_lock(buffer_lock_t *buf_lock)
     output["refs"] = buf_lock->refs;
     output["dropped"] = buf_lock->dropped;
   }
+  pthread_mutex_unlock(&buf_lock->lock);
+
+  for (int i = 0; i < BUFFER_LOCK_MAX_CALLBACKS && buf_lock->notify_buffer[i]; i++) {
+    buffer_lock_notify_t *notify = buf_lock->notify_buffer[i];
+    nlohmann::json json;
+    json["delivered"] = notify->delivered;
+    json["dropped"] = notify->dropped;
+    json["queued"] = notify->count;
+    json["lag_ms"] = notify->lag_us / 1000.0;
+    json["max_lag_ms"] = notify->max_lag_us / 1000.0;
+    output["notify"][notify->name] = json;
+  }
   return output;
 }
 
+static void add_ladder_rung(nlohmann::json &outputs, const char *name, buffer_lock_t *buf_lock)
+{
+  pthread_mutex_lock(&buf_lock->lock);
+  unsigned height = buf_lock->buf_list ? buf_lock->buf_list->fmt.height : 0;
+  pthread_mutex_unlock(&buf_lock->lock);
+
+  if (height) {
+    outputs[std::string(name) + "@" + std::to_string(height)] = serialize_buf_lock(buf_lock);
+  }
+}
+
 static const char *strip_prefix(const char *str, const char *prefix)
 {
   if (strstr(str, prefix) == str) {
@@ -98,11 +129,11 @@ static int device_options_callback(device_option_t *option, void *opaque)
   return 0;
 }
 
-static nlohmann::json devices_status_json()
+static nlohmann::json devices_status_json(camera_t *camera)
 {
   nlohmann::json devices;
 
-  for (int i = 0; i < MAX_DEVICES; i++) {
+  for (int i = 0; camera && i < MAX_DEVICES; i++) {
     if (!camera->devices[i])
       continue;
 
@@ -111,6 +142,8 @@ static nlohmann::json devices_status_json()
     device_json["name"] = device->name;
     device_json["path"] = device->path;
     device_json["allow_dma"] = device->opts.allow_dma;
+    device_json["paused"] = device->paused;
+    device_json["released"] = device->released;
     device_json["output"] = serialize_buf_list(device->output_list);
     for (int j = 0; j < device->n_capture_list; j++) {
       device_json["captures"][j] = serialize_buf_list(device->capture_lists[j]);
@@ -123,11 +156,11 @@ static nlohmann::json devices_status_json()
   return devices;
 }
 
-static nlohmann::json links_status_json()
+static nlohmann::json links_status_json(camera_t *camera)
 {
   nlohmann::json links;
 
-  for (int i = 0; i < camera->nlinks; i++) {
+  for (int i = 0; camera && i < camera->nlinks; i++) {
     link_t *link = &camera->links[i];
 
     nlohmann::json link_json;
@@ -165,6 +198,30 @@ static nlohmann::json get_url(bool running, const char *output, const char *prot
   return endpoint;
 }
 
+// additional cameras only have the HTTP and RTSP outputs
+static void camera_outputs_status_json(http_worker_t *worker, nlohmann::json &message, output_camera_t *outputs, camera_t *camera)
+{
+  std::string prefix = "/cam" + std::to_string(worker->camera_index);
+
+  message["outputs"]["snapshot"] = serialize_buf_lock(outputs->snapshot.buf_lock);
+  message["outputs"]["stream"] = serialize_buf_lock(outputs->stream.buf_lock);
+  message["outputs"]["video"] = serialize_buf_lock(outputs->video.buf_lock);
+
+  for (int i = 0; i < OUTPUT_LADDER_MAX; i++) {
+    add_ladder_rung(message["outputs"], "snapshot", outputs->snapshot.rungs[i]);
+    add_ladder_rung(message["outputs"], "stream", outputs->stream.rungs[i]);
+    add_ladder_rung(message["outputs"], "video", outputs->video.rungs[i]);
+  }
+
+  message["devices"] = devices_status_json(camera);
+  message["links"] = links_status_json(camera);
+
+  message["endpoints"]["rtsp"] = get_url(outputs->video.buf_lock->buf_list != NULL && rtsp_options.running, "video", "rtsp", worker->host, rtsp_options.port, (prefix + ".h264").c_str());
+  message["endpoints"]["video"] = get_url(outputs->video.buf_lock->buf_list != NULL, "video", "http", worker->host, http_options.port, (prefix + "/video").c_str());
+  message["endpoints"]["stream"] = get_url(outputs->stream.buf_lock->buf_list != NULL, "stream", "http", worker->host, http_options.port, (prefix + "/stream").c_str());
+  message["endpoints"]["snapshot"] = get_url(outputs->snapshot.buf_lock->buf_list != NULL, "snapshot", "http", worker->host, http_options.port, (prefix + "/snapshot").c_str());
+}
+
 extern "C" void camera_status_json(http_worker_t *worker, FILE *stream)
 {
   nlohmann::json message;
@@ -172,14 +229,39 @@ extern "C" void camera_status_json(http_worker_t *worker, FILE *stream)
   message["version"] = GIT_VERSION;
   message["revision"] = GIT_REVISION;
 
+  output_camera_t *outputs = http_output_camera(worker);
+  camera_t *camera = worker->camera_index < MAX_OUTPUT_CAMERAS ? cameras[worker->camera_index] : NULL;
+
+  for (int i = 0; i < MAX_OUTPUT_CAMERAS; i++) {
+    message["cameras"][i]["running"] = cameras[i] != NULL;
+    message["cameras"][i]["prefix"] = i ? "/cam" + std::to_string(i) : "";
+  }
+
+  if (worker->camera_index > 0) {
+    camera_outputs_status_json(worker, message, outputs, camera);
+    http_write_response(stream, "200 OK", "application/json", message.dump().c_str(), 0);
+    return;
+  }
+
   message["outputs"]["snapshot"] = serialize_buf_lock(&snapshot_lock);
   message["outputs"]["stream"] = serialize_buf_lock(&stream_lock);
   message["outputs"]["video"] = serialize_buf_lock(&video_lock);
+  message["outputs"]["video_sub"] = serialize_buf_lock(&video_sub_lock);
+  message["outputs"]["video_ts"] = serialize_buf_lock(&video_ts_lock);
+
+  for (int i = 0; i < OUTPUT_LADDER_MAX; i++) {
+    add_ladder_rung(message["outputs"], "snapshot", outputs->snapshot.rungs[i]);
+    add_ladder_rung(message["outputs"], "stream", outputs->stream.rungs[i]);
+    add_ladder_rung(message["outputs"], "video", outputs->video.rungs[i]);
+  }
 
-  message["devices"] = devices_status_json();
-  message["links"] = links_status_json();
+  message["devices"] = devices_status_json(camera);
+  message["links"] = links_status_json(camera);
 
   message["endpoints"]["rtsp"] = get_url(video_lock.buf_list != NULL && rtsp_options.running, "video", "rtsp", worker->host, rtsp_options.port, "/stream.h264");
+  message["endpoints"]["rtsp_sub"] = get_url(video_sub_lock.buf_list != NULL && rtsp_options.running, "video_sub", "rtsp", worker->host, rtsp_options.port, "/sub.h264");
+  message["endpoints"]["rtsp_mjpeg"] = get_url(stream_lock.buf_list != NULL && rtsp_options.running, "stream", "rtsp", worker->host, rtsp_options.port, "/stream.mjpeg");
+  message["endpoints"]["rtp"] = get_url(video_lock.buf_list != NULL && rtp_options.running, "video", "http", worker->host, http_options.port, "/video.sdp");
   message["endpoints"]["webrtc"] = get_url(video_lock.buf_list != NULL && webrtc_options.running, "video", "http", worker->host, http_options.port, "/webrtc");
   message["endpoints"]["video"] = get_url(video_lock.buf_list != NULL, "video", "http", worker->host, http_options.port, "/video");
   message["endpoints"]["stream"] = get_url(stream_lock.buf_list != NULL, "stream", "http", worker->host, http_options.port, "/stream");
@@ -192,5 +274,31 @@ extern "C" void camera_status_json(http_worker_t *worker, FILE *stream)
     message["endpoints"]["rtsp"]["dropped"] = rtsp_options.dropped;
   }
 
+  if (rtp_options.running) {
+    message["endpoints"]["rtp"]["group"] = rtp_options.group;
+    message["endpoints"]["rtp"]["port"] = rtp_options.port;
+    message["endpoints"]["rtp"]["frames"] = rtp_options.frames;
+    message["endpoints"]["rtp"]["packets"] = rtp_options.packets;
+    message["endpoints"]["rtp"]["dropped"] = rtp_options.dropped;
+  }
+
+  if (recorder_options.running) {
+    message["recorder"]["path"] = recorder_options.path;
+    message["recorder"]["segments"] = recorder_options.segments;
+    message["recorder"]["frames"] = recorder_options.frames;
+    message["recorder"]["dropped"] = recorder_options.dropped;
+    message["recorder"]["errors"] = recorder_options.errors;
+    message["recorder"]["bytes"] = recorder_options.bytes;
+  }
+
+  if (dvr_options.running) {
+    message["dvr"]["size"] = dvr_options.size * 1024ULL * 1024ULL;
+    message["dvr"]["used"] = dvr_options.used;
+    message["dvr"]["frames"] = dvr_options.frames;
+    message["dvr"]["duration_ms"] = dvr_options.duration_us / 1000;
+    message["dvr"]["events"] = dvr_options.events;
+    message["dvr"]["dropped"] = dvr_options.dropped;
+  }
+
   http_write_response(stream, "200 OK", "application/json", message.dump().c_str(), 0);
 }
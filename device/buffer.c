@@ -32,6 +32,7 @@ void buffer_close(buffer_t *buf)
   }
 
   buf->buf_list->dev->hw->buffer_close(buf);
+  h264_index_free(&buf->h264);
   free(buf->name);
   free(buf);
 }
@@ -4,6 +4,8 @@
 #include <stdint.h>
 #include <stddef.h>
 
+#include "util/h264/h264.h"
+
 typedef struct buffer_s buffer_t;
 typedef struct buffer_list_s buffer_list_t;
 
@@ -24,9 +26,13 @@ typedef struct buffer_s {
     bool is_last : 1;
   } flags;
 
+  // set for H264 buffers on dequeue
+  h264_index_t h264;
+
   union {
     struct buffer_v4l2_s *v4l2;
     struct buffer_dummy_s *dummy;
+    struct buffer_memory_s *memory;
     struct buffer_libcamera_s *libcamera;
   };
 
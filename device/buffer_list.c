@@ -64,6 +64,7 @@ buffer_list_t *buffer_list_open(const char *name, int index, struct device_s *de
   buf_list->do_mmap = do_mmap;
   buf_list->fmt = fmt;
   buf_list->index = index;
+  pthread_mutex_init(&buf_list->h264_params_lock, NULL);
 
   int err = dev->hw->buffer_list_open(buf_list);
   if (err > 0) {
@@ -125,10 +126,25 @@ void buffer_list_close(buffer_list_t *buf_list)
   buffer_list_free_buffers(buf_list);
 
   buf_list->dev->hw->buffer_list_close(buf_list);
+  pthread_mutex_destroy(&buf_list->h264_params_lock);
   free(buf_list->name);
   free(buf_list);
 }
 
+void buffer_list_get_h264_params(buffer_list_t *buf_list, h264_params_t *params)
+{
+  pthread_mutex_lock(&buf_list->h264_params_lock);
+  *params = buf_list->h264_params;
+  pthread_mutex_unlock(&buf_list->h264_params_lock);
+}
+
+void buffer_list_set_h264_params(buffer_list_t *buf_list, const h264_params_t *params)
+{
+  pthread_mutex_lock(&buf_list->h264_params_lock);
+  buf_list->h264_params = *params;
+  pthread_mutex_unlock(&buf_list->h264_params_lock);
+}
+
 int buffer_list_set_stream(buffer_list_t *buf_list, bool do_on)
 {
   if (!buf_list || !buf_list->dev->hw->buffer_list_set_stream) {
@@ -2,6 +2,9 @@
 
 #include <stdbool.h>
 #include <stdint.h>
+#include <pthread.h>
+
+#include "util/h264/h264.h"
 
 typedef struct buffer_s buffer_t;
 typedef struct device_s device_t;
@@ -47,6 +50,7 @@ typedef struct buffer_list_s {
   union {
     struct buffer_list_v4l2_s *v4l2;
     struct buffer_list_dummy_s *dummy;
+    struct buffer_list_memory_s *memory;
     struct buffer_list_libcamera_s *libcamera;
   };
 
@@ -57,6 +61,10 @@ typedef struct buffer_list_s {
   int last_capture_time_us, last_in_queue_time_us;
   bool streaming;
   buffer_stats_t stats, stats_last;
+
+  // updated on dequeue of H264 buffers carrying SPS/PPS, while the outputs copy them
+  pthread_mutex_t h264_params_lock;
+  h264_params_t h264_params;
 } buffer_list_t;
 
 buffer_list_t *buffer_list_open(const char *name, int index, struct device_s *dev, const char *path, buffer_format_t fmt, bool do_capture, bool do_mmap);
@@ -74,3 +82,6 @@ int buffer_list_enqueue(buffer_list_t *buf_list, buffer_t *dma_buf);
 void buffer_list_clear_queue(buffer_list_t *buf_list);
 bool buffer_list_push_to_queue(buffer_list_t *buf_list, buffer_t *dma_buf, int max_bufs);
 buffer_t *buffer_list_pop_from_queue(buffer_list_t *buf_list);
+
+void buffer_list_get_h264_params(buffer_list_t *buf_list, h264_params_t *params);
+void buffer_list_set_h264_params(buffer_list_t *buf_list, const h264_params_t *params);
@@ -1,7 +1,10 @@
 #include "device/buffer_lock.h"
 #include "device/buffer_list.h"
 #include "device/buffer.h"
+#include "device/device.h"
+#include "device/memory/memory.h"
 #include "util/opts/log.h"
+#include "util/opts/fourcc.h"
 
 bool buffer_lock_is_used(buffer_lock_t *buf_lock)
 {
@@ -42,20 +45,246 @@ bool buffer_lock_needs_buffer(buffer_lock_t *buf_lock)
   return needs_buffer;
 }
 
+static void buffer_lock_gop_clear(buffer_lock_t *buf_lock, bool valid)
+{
+  for (unsigned i = 0; i < buf_lock->gop_frames; i++) {
+    buffer_consumed(buf_lock->gop[i], "gop");
+  }
+  buf_lock->gop_frames = 0;
+  buf_lock->gop_bytes = 0;
+  buf_lock->gop_valid = valid;
+}
+
+static buffer_list_t *buffer_lock_open_pool(const char *name, buffer_t *buf, int nbufs, bool release_idle)
+{
+  buffer_format_t fmt = {
+    .format = buf->buf_list->fmt.format,
+    .sizeimage = release_idle ? 0 : BUFFER_LOCK_GOP_BUFFER_SIZE, // grown on demand
+    .nbufs = nbufs,
+    .type = BUFFER_TYPE_VIDEO,
+  };
+
+  device_t *dev = device_memory_open(name, "memory");
+  if (!dev) {
+    LOG_ERROR(buf, "Cannot open %s device.", name);
+  }
+
+  buffer_list_t *list = device_open_buffer_list(dev, true, fmt, true);
+  if (list) {
+    list->memory->release_idle = release_idle;
+  }
+  if (!list || buffer_list_set_stream(list, true) < 0) {
+    LOG_ERROR(dev, "Cannot open %s buffers.", name);
+  }
+
+  return list;
+
+error:
+  device_close(dev);
+  return NULL;
+}
+
+// copies the frame into a memory buffer, that requests key frames from the source device
+static buffer_t *buffer_lock_copy_buffer(buffer_list_t *list, buffer_t *buf)
+{
+  buffer_t *copy = buffer_list_dequeue(list);
+  if (!copy || memory_buffer_reserve(copy, buf->used) < 0 ||
+    h264_index_copy(&copy->h264, &buf->h264, buf->start, copy->start) < 0) {
+    buffer_consumed(copy, list->name);
+    return NULL;
+  }
+
+  list->fmt.width = buf->buf_list->fmt.width;
+  list->fmt.height = buf->buf_list->fmt.height;
+  h264_params_t params;
+  buffer_list_get_h264_params(buf->buf_list, &params);
+  buffer_list_set_h264_params(list, &params);
+  list->dev->memory->source = buf->buf_list->dev;
+
+  memcpy(copy->start, buf->start, buf->used);
+  copy->used = buf->used;
+  copy->flags = buf->flags;
+  copy->captured_time_us = buf->captured_time_us;
+  return copy;
+}
+
+// runs without the buffer lock held: the GOP is only modified by the capture thread,
+// the idle pool buffers are freed, so the cache allocates at most `gop_size` bytes
+static buffer_t *buffer_lock_gop_copy(buffer_lock_t *buf_lock, buffer_t *buf)
+{
+  if (!buf_lock->gop_size) {
+    return NULL;
+  }
+
+  unsigned frames = buf->flags.is_keyframe ? 0 : buf_lock->gop_frames;
+  size_t bytes = buf->flags.is_keyframe ? 0 : buf_lock->gop_bytes;
+
+  if (!buf->flags.is_keyframe && !buf_lock->gop_valid) {
+    return NULL;
+  }
+
+  if (frames >= BUFFER_LOCK_MAX_GOP_FRAMES || bytes + buf->used > buf_lock->gop_size) {
+    LOG_DEBUG(buf_lock, "GOP does not fit in cache (frames=%u, bytes=%zu).",
+      frames, bytes + buf->used);
+    return NULL;
+  }
+
+  if (!buf_lock->gop_list) {
+    buf_lock->gop_list = buffer_lock_open_pool("GOP", buf, BUFFER_LOCK_MAX_GOP_FRAMES, true);
+    if (!buf_lock->gop_list) {
+      buf_lock->gop_size = 0;
+      return NULL;
+    }
+  }
+
+  return buffer_lock_copy_buffer(buf_lock->gop_list, buf);
+}
+
+static void buffer_lock_gop_append(buffer_lock_t *buf_lock, buffer_t *buf, buffer_t *gop_buf)
+{
+  if (!buf_lock->gop_size) {
+    return;
+  }
+
+  if (buf->flags.is_keyframe) {
+    buffer_lock_gop_clear(buf_lock, true);
+  }
+
+  if (!gop_buf) {
+    buffer_lock_gop_clear(buf_lock, false);
+    return;
+  }
+
+  buf_lock->gop[buf_lock->gop_frames++] = gop_buf;
+  buf_lock->gop_bytes += buf->used;
+}
+
 static void buffer_lock_clear_buffers(buffer_lock_t *buf_lock, uint64_t now)
 {
   buffer_consumed(buf_lock->buf, buf_lock->name);
   buf_lock->buf = NULL;
   buf_lock->buf_time_us = now;
+  buffer_lock_gop_clear(buf_lock, false);
+
+  // the source device is about to be closed
+  if (buf_lock->gop_list) {
+    buf_lock->gop_list->dev->memory->source = NULL;
+  }
+  for (int i = 0; buf_lock->notify_buffer[i] && i < BUFFER_LOCK_MAX_CALLBACKS; i++) {
+    buffer_lock_notify_t *notify = buf_lock->notify_buffer[i];
+
+    pthread_mutex_lock(&notify->lock);
+    if (notify->pool) {
+      notify->pool->dev->memory->source = NULL;
+    }
+    pthread_mutex_unlock(&notify->lock);
+  }
 }
 
-static void buffer_lock_set_buffer(buffer_lock_t *buf_lock, buffer_t *buf, uint64_t now)
+static void buffer_lock_notify_release(buffer_lock_notify_t *notify, buffer_t *buf)
+{
+  if (buf->buf_list != notify->pool) {
+    notify->device_bufs--;
+  }
+  buffer_consumed(buf, notify->name);
+}
+
+// runs without the buffer lock held, as the frame might be copied
+static void buffer_lock_notify_enqueue(buffer_lock_notify_t *notify, buffer_t *buf)
+{
+  pthread_mutex_lock(&notify->lock);
+
+  if (notify->count >= BUFFER_LOCK_NOTIFY_QUEUE) {
+    // the output cannot keep up: drop everything queued and resync on the next key frame
+    while (notify->count > 0) {
+      buffer_lock_notify_release(notify, notify->queue[notify->head]);
+      notify->head = (notify->head + 1) % BUFFER_LOCK_NOTIFY_QUEUE;
+      notify->count--;
+      notify->dropped++;
+    }
+
+    // every JPEG frame can be decoded on its own
+    if (buf->buf_list->fmt.format == V4L2_PIX_FMT_H264) {
+      LOG_DEBUG(notify, "Queue overflow, waiting for key frame, dropped=%d", notify->dropped);
+      notify->wait_for_keyframe = true;
+      device_video_force_key(buf->buf_list->dev);
+    }
+  }
+
+  if (notify->wait_for_keyframe && !buf->flags.is_keyframe) {
+    notify->dropped++;
+    goto unlock;
+  }
+
+  buffer_t *queued = buf;
+
+  // the device buffer is given only to an idle worker, so that one
+  // blocked output never holds more than one of the encoder buffers
+  if (notify->device_bufs > 0) {
+    if (!notify->pool) {
+      notify->pool = buffer_lock_open_pool(notify->name, buf, BUFFER_LOCK_NOTIFY_QUEUE + 1, false);
+    }
+
+    queued = notify->pool ? buffer_lock_copy_buffer(notify->pool, buf) : NULL;
+    if (!queued) {
+      LOG_DEBUG(notify, "Cannot copy the frame, dropped=%d", notify->dropped);
+      notify->dropped++;
+      if (buf->buf_list->fmt.format == V4L2_PIX_FMT_H264) {
+        notify->wait_for_keyframe = true;
+      }
+      goto unlock;
+    }
+  } else {
+    buffer_use(buf);
+    notify->device_bufs++;
+  }
+
+  notify->wait_for_keyframe = false;
+  notify->queue[(notify->head + notify->count) % BUFFER_LOCK_NOTIFY_QUEUE] = queued;
+  notify->count++;
+  pthread_cond_signal(&notify->cond_wait);
+
+unlock:
+  pthread_mutex_unlock(&notify->lock);
+}
+
+static void *buffer_lock_notify_thread(void *arg)
+{
+  buffer_lock_notify_t *notify = arg;
+
+  while (true) {
+    pthread_mutex_lock(&notify->lock);
+    while (!notify->count) {
+      pthread_cond_wait(&notify->cond_wait, &notify->lock);
+    }
+    buffer_t *buf = notify->queue[notify->head];
+    notify->head = (notify->head + 1) % BUFFER_LOCK_NOTIFY_QUEUE;
+    notify->count--;
+    pthread_mutex_unlock(&notify->lock);
+
+    notify->notify_buffer(notify->buf_lock, buf);
+
+    uint64_t lag_us = get_monotonic_time_us(NULL, NULL) - buf->captured_time_us;
+
+    pthread_mutex_lock(&notify->lock);
+    buffer_lock_notify_release(notify, buf);
+    notify->delivered++;
+    notify->lag_us = lag_us;
+    notify->max_lag_us = MAX(notify->max_lag_us, lag_us);
+    pthread_mutex_unlock(&notify->lock);
+  }
+
+  return NULL;
+}
+
+static void buffer_lock_set_buffer(buffer_lock_t *buf_lock, buffer_t *buf, buffer_t *gop_buf, uint64_t now)
 {
   buffer_consumed(buf_lock->buf, buf_lock->name);
   buffer_use(buf);
   buf_lock->buf = buf;
   buf_lock->buf_time_us = now;
   buf_lock->counter++;
+  buffer_lock_gop_append(buf_lock, buf, gop_buf);
 
   LOG_DEBUG(buf_lock, "Captured buffer %s (refs=%d), frame=%d/%d, processing_ms=%.1f, frame_ms=%.1f",
     dev_name(buf), buf ? buf->mmap_reflinks : 0,
@@ -63,26 +292,26 @@ static void buffer_lock_set_buffer(buffer_lock_t *buf_lock, buffer_t *buf, uint6
     (now - buf->captured_time_us) / 1000.0f,
     (now - buf_lock->buf_time_us) / 1000.0f);
   pthread_cond_broadcast(&buf_lock->cond_wait);
-
-  for (int i = 0; buf_lock->notify_buffer[i] && i < BUFFER_LOCK_MAX_CALLBACKS; i++) {
-    buf_lock->notify_buffer[i](buf_lock, buf);
-  }
 }
 
 void buffer_lock_capture(buffer_lock_t *buf_lock, buffer_t *buf)
 {
   uint64_t now = get_monotonic_time_us(NULL, NULL);
 
+  // `buf_time_us` and the GOP are only modified by the capture thread,
+  // so the frame is copied into the cache before taking the lock
+  bool notify = buf && (buf->flags.is_keyframe || now - buf_lock->buf_time_us >= buf_lock->frame_interval_ms * 1000);
+  buffer_t *gop_buf = notify ? buffer_lock_gop_copy(buf_lock, buf) : NULL;
+
   pthread_mutex_lock(&buf_lock->lock);
 
   if (!buf) {
     buffer_lock_clear_buffers(buf_lock, now);
-  } else if (buf->flags.is_keyframe) {
-    buffer_lock_set_buffer(buf_lock, buf, now);
-  } else if (now - buf_lock->buf_time_us >= buf_lock->frame_interval_ms * 1000) {
-    buffer_lock_set_buffer(buf_lock, buf, now);
+  } else if (notify) {
+    buffer_lock_set_buffer(buf_lock, buf, gop_buf, now);
   } else {
     buf_lock->dropped++;
+    buffer_lock_gop_clear(buf_lock, false);
 
     LOG_DEBUG(buf_lock, "Dropped buffer %s (refs=%d), frame=%d/%d, frame_ms=%.1f",
       dev_name(buf), buf ? buf->mmap_reflinks : 0,
@@ -91,6 +320,11 @@ void buffer_lock_capture(buffer_lock_t *buf_lock, buffer_t *buf)
   }
 
   pthread_mutex_unlock(&buf_lock->lock);
+
+  // workers are registered once and never removed
+  for (int i = 0; notify && i < BUFFER_LOCK_MAX_CALLBACKS && buf_lock->notify_buffer[i]; i++) {
+    buffer_lock_notify_enqueue(buf_lock->notify_buffer[i], buf);
+  }
 }
 
 buffer_t *buffer_lock_get(buffer_lock_t *buf_lock, int timeout_ms, int *counter)
@@ -104,7 +338,8 @@ buffer_t *buffer_lock_get(buffer_lock_t *buf_lock, int timeout_ms, int *counter)
   get_time_us(CLOCK_REALTIME, &timeout, NULL, timeout_ms * 1000LL);
 
   pthread_mutex_lock(&buf_lock->lock);
-  if (*counter == buf_lock->counter || !buf_lock->buf) {
+  // keep waiting while the buffers are cleared, as when the camera is restarted
+  while (*counter == buf_lock->counter || !buf_lock->buf) {
     int ret = pthread_cond_timedwait(&buf_lock->cond_wait, &buf_lock->lock, &timeout);
     if (ret == ETIMEDOUT) {
       goto ret;
@@ -122,7 +357,30 @@ ret:
   return buf;
 }
 
+int buffer_lock_get_gop(buffer_lock_t *buf_lock, buffer_t **bufs, int *counter)
+{
+  int n = 0;
+
+  pthread_mutex_lock(&buf_lock->lock);
+  if (buf_lock->gop_valid && buf_lock->gop_frames > 0) {
+    for (unsigned i = 0; i < buf_lock->gop_frames; i++) {
+      buffer_use(buf_lock->gop[i]);
+      bufs[n++] = buf_lock->gop[i];
+    }
+    // the last cached frame is the current one
+    *counter = buf_lock->counter;
+  }
+  pthread_mutex_unlock(&buf_lock->lock);
+
+  return n;
+}
+
 int buffer_lock_write_loop(buffer_lock_t *buf_lock, int nframes, unsigned timeout_ms, buffer_write_fn fn, void *data)
+{
+  return buffer_lock_write_loop2(buf_lock, nframes, timeout_ms, nframes == 0, fn, data);
+}
+
+int buffer_lock_write_loop2(buffer_lock_t *buf_lock, int nframes, unsigned timeout_ms, bool replay_gop, buffer_write_fn fn, void *data)
 {
   int counter = 0;
   int frames = 0;
@@ -131,6 +389,26 @@ int buffer_lock_write_loop(buffer_lock_t *buf_lock, int nframes, unsigned timeou
 
   buffer_lock_use(buf_lock, 1);
 
+  // start new clients from the cached GOP instead of waiting for a key frame
+  buffer_t *gop[BUFFER_LOCK_MAX_GOP_FRAMES];
+  int ngop = replay_gop ? buffer_lock_get_gop(buf_lock, gop, &counter) : 0;
+  int ret = 0;
+
+  for (int i = 0; i < ngop; i++) {
+    if (ret >= 0) {
+      ret = fn(buf_lock, gop[i], frames, data);
+    }
+    buffer_consumed(gop[i], "write-loop");
+
+    if (ret > 0) {
+      frames++;
+    }
+  }
+
+  if (ret < 0) {
+    goto error;
+  }
+
   while (nframes == 0 || frames < nframes) {
     if (timeout_ms && frame_stop_ms < get_monotonic_time_us(NULL, NULL)) {
       break;
@@ -141,7 +419,7 @@ int buffer_lock_write_loop(buffer_lock_t *buf_lock, int nframes, unsigned timeou
       goto error;
     }
 
-    int ret = fn(buf_lock, buf, frames, data);
+    ret = fn(buf_lock, buf, frames, data);
     buffer_consumed(buf, "write-loop");
 
     if (ret > 0) {
@@ -179,19 +457,52 @@ bool buffer_lock_register_check_streaming(buffer_lock_t *buf_lock, buffer_lock_c
   return ret;
 }
 
-bool buffer_lock_register_notify_buffer(buffer_lock_t *buf_lock, buffer_lock_notify_buffer notify_buffer)
+bool buffer_lock_register_notify_buffer(buffer_lock_t *buf_lock, const char *name, buffer_lock_notify_buffer notify_buffer)
 {
-  bool ret = false;
+  buffer_lock_notify_t *notify = NULL;
 
   pthread_mutex_lock(&buf_lock->lock);
   for (int i = 0; i < BUFFER_LOCK_MAX_CALLBACKS; i++) {
-    if (!buf_lock->notify_buffer[i]) {
-      buf_lock->notify_buffer[i] = notify_buffer;
-      ret = true;
+    if (buf_lock->notify_buffer[i]) {
+      continue;
+    }
+
+    notify = calloc(1, sizeof(buffer_lock_notify_t));
+    notify->name = name;
+    notify->buf_lock = buf_lock;
+    notify->notify_buffer = notify_buffer;
+    pthread_mutex_init(&notify->lock, NULL);
+    pthread_cond_init(&notify->cond_wait, NULL);
+
+    if (pthread_create(&notify->thread, NULL, buffer_lock_notify_thread, notify) != 0) {
+      LOG_INFO(buf_lock, "Cannot start notify thread for %s.", name);
+      free(notify);
+      notify = NULL;
       break;
     }
+
+    pthread_detach(notify->thread);
+    buf_lock->notify_buffer[i] = notify;
+    break;
   }
   pthread_mutex_unlock(&buf_lock->lock);
 
-  return ret;
+  return notify != NULL;
+}
+
+int buffer_lock_notify_workers(buffer_lock_t *buf_lock)
+{
+  int n = 0;
+
+  if (!buf_lock) {
+    return 0;
+  }
+
+  pthread_mutex_lock(&buf_lock->lock);
+  while (n < BUFFER_LOCK_MAX_CALLBACKS && buf_lock->notify_buffer[n]) {
+    n++;
+  }
+  pthread_mutex_unlock(&buf_lock->lock);
+
+  return n;
 }
@@ -12,13 +12,46 @@ typedef bool (*buffer_lock_check_streaming)(buffer_lock_t *buf_lock);
 typedef void (*buffer_lock_notify_buffer)(buffer_lock_t *buf_lock, buffer_t *buf);
 
 #define BUFFER_LOCK_MAX_CALLBACKS 10
+#define BUFFER_LOCK_NOTIFY_QUEUE 2
+#define BUFFER_LOCK_MAX_GOP_FRAMES 64
+#define BUFFER_LOCK_GOP_BUFFER_SIZE (64 * 1024)
+
+// Each notify callback is run by its own worker thread, fed with
+// buffer references through a bounded queue, so a slow output
+// does not stall capturing of the other ones. A worker holds at most
+// one device buffer, the frames arriving while it is busy are copied
+// into its own memory pool.
+typedef struct buffer_lock_notify_s {
+  const char *name;
+  buffer_lock_t *buf_lock;
+  buffer_lock_notify_buffer notify_buffer;
+
+  // private
+  pthread_t thread;
+  pthread_mutex_t lock;
+  pthread_cond_t cond_wait;
+  buffer_t *queue[BUFFER_LOCK_NOTIFY_QUEUE];
+  unsigned head, count;
+  bool wait_for_keyframe;
+  int device_bufs;
+  buffer_list_t *pool;
+
+  int delivered;
+  int dropped;
+  uint64_t lag_us;
+  uint64_t max_lag_us;
+} buffer_lock_notify_t;
 
 typedef struct buffer_lock_s {
   const char *name;
   buffer_list_t *buf_list;
 
   buffer_lock_check_streaming check_streaming[BUFFER_LOCK_MAX_CALLBACKS];
-  buffer_lock_notify_buffer notify_buffer[BUFFER_LOCK_MAX_CALLBACKS];
+  buffer_lock_notify_t *notify_buffer[BUFFER_LOCK_MAX_CALLBACKS];
+
+  // frames since the last key frame are copied into a memory pool
+  // and replayed to new clients, 0 disables it
+  size_t gop_size;
 
   // private
   pthread_mutex_t lock;
@@ -31,6 +64,12 @@ typedef struct buffer_lock_s {
   uint64_t timeout_us;
 
   int frame_interval_ms;
+
+  buffer_list_t *gop_list;
+  buffer_t *gop[BUFFER_LOCK_MAX_GOP_FRAMES];
+  unsigned gop_frames;
+  size_t gop_bytes;
+  bool gop_valid;
 } buffer_lock_t;
 
 #define DEFAULT_BUFFER_LOCK_TIMEOUT 16 // ~60fps
@@ -49,9 +88,12 @@ typedef int (*buffer_write_fn)(buffer_lock_t *buf_lock, buffer_t *buf, int frame
 
 void buffer_lock_capture(buffer_lock_t *buf_lock, buffer_t *buf);
 buffer_t *buffer_lock_get(buffer_lock_t *buf_lock, int timeout_ms, int *counter);
+int buffer_lock_get_gop(buffer_lock_t *buf_lock, buffer_t **bufs, int *counter);
 bool buffer_lock_needs_buffer(buffer_lock_t *buf_lock);
 void buffer_lock_use(buffer_lock_t *buf_lock, int ref);
 bool buffer_lock_is_used(buffer_lock_t *buf_lock);
 int buffer_lock_write_loop(buffer_lock_t *buf_lock, int nframes, unsigned timeout_ms, buffer_write_fn fn, void *data);
+int buffer_lock_write_loop2(buffer_lock_t *buf_lock, int nframes, unsigned timeout_ms, bool replay_gop, buffer_write_fn fn, void *data);
 bool buffer_lock_register_check_streaming(buffer_lock_t *buf_lock, buffer_lock_check_streaming check_streaming);
-bool buffer_lock_register_notify_buffer(buffer_lock_t *buf_lock, buffer_lock_notify_buffer notify_buffer);
+bool buffer_lock_register_notify_buffer(buffer_lock_t *buf_lock, const char *name, buffer_lock_notify_buffer notify_buffer);
+int buffer_lock_notify_workers(buffer_lock_t *buf_lock);
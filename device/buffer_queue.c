@@ -145,10 +145,21 @@ int buffer_list_enqueue(buffer_list_t *buf_list, buffer_t *dma_buf)
   return 1;
 }
 
-static void buffer_update_h264_key_frame(buffer_t *buf)
+static void buffer_update_h264_index(buffer_t *buf)
 {
   unsigned char *data = buf->start;
 
+  // memory buffers are dequeued empty, and filled by the caller
+  if (!buf->used) {
+    buf->h264.nnals = 0;
+    return;
+  }
+
+  if (h264_index_parse(&buf->h264, buf->start, buf->used) < 0) {
+    LOG_INFO(buf, "Cannot index H264 buffer.");
+    buf->h264.nnals = 0;
+  }
+
   static const int N = 8;
   char buffer [3*N+1];
   buffer[sizeof(buffer)-1] = 0;
@@ -157,10 +168,19 @@ static void buffer_update_h264_key_frame(buffer_t *buf)
 
   if (buf->flags.is_keyframe) {
     LOG_DEBUG(buf, "Got key frame (from V4L2)!: %s", buffer);
-  } else if (buf->used >= 5 && (data[4] & 0x1F) == 0x07) {
+  } else if (buf->h264.has_idr || buf->h264.has_sps) {
     LOG_DEBUG(buf, "Got key frame (from buffer)!: %s", buffer);
     buf->flags.is_keyframe = true;
   }
+
+  if (buf->h264.has_sps || buf->h264.has_pps) {
+    pthread_mutex_lock(&buf->buf_list->h264_params_lock);
+    if (h264_params_update(&buf->buf_list->h264_params, &buf->h264)) {
+      LOG_DEBUG(buf, "Updated H264 parameter sets: sps=%u, pps=%u",
+        buf->buf_list->h264_params.sps_size, buf->buf_list->h264_params.pps_size);
+    }
+    pthread_mutex_unlock(&buf->buf_list->h264_params_lock);
+  }
 }
 
 buffer_t *buffer_list_dequeue(buffer_list_t *buf_list)
@@ -200,7 +220,7 @@ buffer_t *buffer_list_dequeue(buffer_list_t *buf_list)
   }
 
   if (buf_list->fmt.format == V4L2_PIX_FMT_H264) {
-    buffer_update_h264_key_frame(buf);
+    buffer_update_h264_index(buf);
     buf->flags.is_keyed = true;
   } else {
     buf->flags.is_keyed = false;
@@ -243,7 +263,7 @@ bool buffer_list_push_to_queue(buffer_list_t *buf_list, buffer_t *dma_buf, int m
 {
   max_bufs = MIN(max_bufs ? max_bufs : MAX_BUFFER_QUEUE, MAX_BUFFER_QUEUE);
 
-  if (buf_list->dev->paused)
+  if (buf_list->dev->paused && !buf_list->dev->opts.lazy)
     return true;
   if (buf_list->n_queued_bufs >= max_bufs)
     return false;
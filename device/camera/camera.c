@@ -8,14 +8,52 @@
 #include "util/opts/log.h"
 #include "util/opts/fourcc.h"
 
+static const char *camera_names[] = { "CAMERA", "CAMERA1", "CAMERA2", "CAMERA3" };
+
+// cameras are opened one at a time and share a single probed device list
+static pthread_mutex_t camera_lock = PTHREAD_MUTEX_INITIALIZER;
+static device_list_t *camera_device_list;
+static int camera_device_list_refs;
+
+static void camera_use_m2m_devices(camera_t *camera, int users)
+{
+  for (int i = 0; i < MAX_DEVICES; i++) {
+    if (!camera->devices[i] || !camera->devices[i]->output_list)
+      continue;
+
+    device_info_t *info = device_list_find_path(camera->device_list, camera->devices[i]->path);
+    if (info) {
+      info->users += users;
+    }
+  }
+}
+
+// outputs read the list from other threads, it is cleared before the devices get closed
+static void camera_set_lock_list(buffer_lock_t *buf_lock, buffer_list_t *buf_list)
+{
+  pthread_mutex_lock(&buf_lock->lock);
+  buf_lock->buf_list = buf_list;
+  pthread_mutex_unlock(&buf_lock->lock);
+}
+
 camera_t *camera_open(camera_options_t *options)
 {
   camera_t *camera = calloc(1, sizeof(camera_t));
-  camera->name = "CAMERA";
+  camera->name = camera_names[options->index % ARRAY_SIZE(camera_names)];
   camera->options = *options;
-  camera->device_list = device_list_v4l2();
 
-  if (camera_configure_input(camera) < 0) {
+  pthread_mutex_lock(&camera_lock);
+  if (!camera_device_list) {
+    camera_device_list = device_list_v4l2(options->probe_cache);
+  }
+  camera_device_list_refs++;
+  camera->device_list = camera_device_list;
+
+  // devices opened here are released by `camera_close()` even on failure
+  int ret = camera_configure_input(camera);
+  camera_use_m2m_devices(camera, 1);
+
+  if (ret < 0) {
     goto error;
   }
 
@@ -23,11 +61,17 @@ camera_t *camera_open(camera_options_t *options)
     goto error;
   }
 
+  camera->input_fmt = camera->camera->capture_lists[0]->fmt;
+  camera->input_opts = camera->camera->opts;
+
+  pthread_mutex_unlock(&camera_lock);
+
   links_dump(camera->links);
 
   return camera;
 
 error:
+  pthread_mutex_unlock(&camera_lock);
   camera_close(&camera);
   return NULL;
 }
@@ -50,11 +94,16 @@ void camera_close(camera_t **camerap)
       }
       if (link->callbacks[j].buf_lock) {
         buffer_lock_capture(link->callbacks[j].buf_lock, NULL);
+        camera_set_lock_list(link->callbacks[j].buf_lock, NULL);
         link->callbacks[j].buf_lock = NULL;
       }
     }
   }
 
+  pthread_mutex_lock(&camera_lock);
+  camera_use_m2m_devices(camera, -1);
+  pthread_mutex_unlock(&camera_lock);
+
   for (int i = MAX_DEVICES; i-- > 0; ) {
     if (camera->devices[i]) {
       device_close(camera->devices[i]);
@@ -62,7 +111,14 @@ void camera_close(camera_t **camerap)
     }
   }
 
-  device_list_free(camera->device_list);
+  pthread_mutex_lock(&camera_lock);
+  // the M2M devices are kept while the camera gets reopened
+  if (camera->device_list && --camera_device_list_refs == 0 && !camera->restart && !camera->options.auto_reconnect) {
+    device_list_free(camera_device_list);
+    camera_device_list = NULL;
+  }
+  pthread_mutex_unlock(&camera_lock);
+
   free(camera);
 }
 
@@ -92,11 +148,11 @@ void camera_capture_add_callbacks(camera_t *camera, buffer_list_t *capture, link
     return;
 
   if (callbacks.buf_lock) {
-    callbacks.buf_lock->buf_list = capture;
+    camera_set_lock_list(callbacks.buf_lock, capture);
   }
 }
 
-int camera_set_params(camera_t *camera)
+static void camera_set_input_params(camera_t *camera)
 {
   device_set_fps(camera->camera, camera->options.fps);
 
@@ -108,22 +164,142 @@ int camera_set_params(camera_t *camera)
   if (device_set_option_list(camera->camera, camera->options.options) < 0)
     device_set_option_list(camera->camera, camera->options.options);
 
-  device_set_option_list(camera->isp, camera->options.isp.options);
-
   if (camera->options.auto_focus) {
     device_set_option_string(camera->camera, "AfTrigger", "1");
   }
+}
+
+int camera_set_params(camera_t *camera)
+{
+  camera_set_input_params(camera);
+
+  device_set_option_list(camera->isp, camera->options.isp.options);
 
   // Set some defaults
   device_set_option_list(camera->codec_snapshot, camera->options.snapshot.options);
   device_set_option_list(camera->codec_stream, camera->options.stream.options);
   device_set_option_string(camera->codec_video, "repeat_sequence_header", "1"); // required for force key support
   device_set_option_list(camera->codec_video, camera->options.video.options);
+  device_set_option_string(camera->codec_sub_video, "repeat_sequence_header", "1");
+  device_set_option_list(camera->codec_sub_video, camera->options.sub_video.options);
+
+  for (int i = 0; i < MAX_LADDER_RUNGS; i++) {
+    device_set_option_list(camera->codec_snapshot_ladder[i], camera->options.snapshot.options);
+    device_set_option_list(camera->codec_stream_ladder[i], camera->options.stream.options);
+    device_set_option_string(camera->codec_video_ladder[i], "repeat_sequence_header", "1");
+    device_set_option_list(camera->codec_video_ladder[i], camera->options.video.options);
+  }
   return 0;
 }
 
 int camera_run(camera_t *camera)
 {
-  bool running = false;
-  return links_loop(camera->links, camera->options.force_active, &running);
+  return links_loop(camera->links, camera->options.force_active, &camera->running);
+}
+
+void camera_restart(camera_t *camera)
+{
+  camera->restart = true;
+  camera->running = false;
+}
+
+// the M2M devices stop reading the frames of the closed camera
+static void camera_detach_input(camera_t *camera)
+{
+  for (int i = 0; i < camera->nlinks; i++) {
+    link_t *link = &camera->links[i];
+
+    if (link->capture_list->dev != camera->camera) {
+      camera->input_lists[i] = -1;
+      continue;
+    }
+
+    camera->input_lists[i] = link->capture_list->index;
+
+    for (int j = 0; j < link->n_callbacks; j++) {
+      if (link->callbacks[j].on_buffer) {
+        link->callbacks[j].on_buffer(NULL);
+      }
+      if (link->callbacks[j].buf_lock) {
+        buffer_lock_capture(link->callbacks[j].buf_lock, NULL);
+        camera_set_lock_list(link->callbacks[j].buf_lock, NULL);
+      }
+    }
+
+    for (int j = 0; j < link->n_output_lists; j++) {
+      buffer_list_set_stream(link->output_lists[j], false);
+    }
+  }
+
+  device_close(camera->camera);
+  camera->camera = NULL;
+}
+
+static bool camera_input_matches(buffer_format_t *a, buffer_format_t *b)
+{
+  return a->width == b->width && a->height == b->height &&
+    a->format == b->format && a->bytesperline == b->bytesperline;
+}
+
+// reopens only the camera device and links it to the kept M2M devices,
+// returns 1 if the whole pipeline has to be reopened
+int camera_reconnect(camera_t *camera)
+{
+  // the kept pipeline failed on its own
+  if (camera->reconnected && camera->camera && !camera->camera->capture_lists[0]->stats.frames) {
+    LOG_INFO(camera, "No frames since reconnecting, reopening the pipeline.");
+    return 1;
+  }
+
+  if (camera->camera) {
+    camera_detach_input(camera);
+  }
+
+  pthread_mutex_lock(&camera_lock);
+  buffer_list_t *camera_capture = camera_open_input(camera);
+  pthread_mutex_unlock(&camera_lock);
+
+  if (!camera_capture || camera_capture->index != 0) {
+    device_close(camera->camera);
+    camera->camera = NULL;
+    return -1;
+  }
+
+  if (!camera_input_matches(&camera_capture->fmt, &camera->input_fmt)) {
+    LOG_INFO(camera, "The camera negotiated %ux%u/%s instead of %ux%u/%s, reopening the pipeline.",
+      camera_capture->fmt.width, camera_capture->fmt.height, fourcc_to_string(camera_capture->fmt.format).buf,
+      camera->input_fmt.width, camera->input_fmt.height, fourcc_to_string(camera->input_fmt.format).buf);
+    return 1;
+  }
+
+  camera->camera->opts = camera->input_opts;
+  camera_capture->do_timestamps = true;
+
+  for (int i = 0; i < camera->nlinks; i++) {
+    link_t *link = &camera->links[i];
+
+    if (camera->input_lists[i] < 0 || camera->input_lists[i] >= camera->camera->n_capture_list) {
+      continue;
+    }
+
+    link->capture_list = camera->camera->capture_lists[camera->input_lists[i]];
+
+    for (int j = 0; j < link->n_callbacks; j++) {
+      if (link->callbacks[j].buf_lock) {
+        camera_set_lock_list(link->callbacks[j].buf_lock, link->capture_list);
+      }
+    }
+  }
+
+  camera_set_input_params(camera);
+
+  // the decoder continues from a key frame
+  if (camera->decoder) {
+    device_video_force_key(camera->camera);
+  }
+
+  camera->reconnected = true;
+  LOG_INFO(camera, "Reconnected the camera, keeping the rest of the pipeline.");
+  links_dump(camera->links);
+  return 0;
 }
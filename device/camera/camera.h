@@ -2,9 +2,12 @@
 
 #include "device/links.h"
 #include "device/device.h"
+#include "device/buffer_list.h"
 
-#define MAX_DEVICES 20
-#define MAX_RESCALLERS 4
+#define MAX_DEVICES 32
+#define MAX_RESCALLERS 8
+#define MAX_LADDER_RUNGS 3
+#define MAX_GRAPH_NODES 8
 #define MAX_HTTP_METHODS 20
 
 #define CAMERA_DEVICE_CAMERA 0
@@ -19,14 +22,23 @@ typedef enum {
   CAMERA_DUMMY
 } camera_type_t;
 
+struct output_camera_s;
+
 typedef struct camera_output_options_s {
   bool disabled;
   unsigned height;
   char options[CAMERA_OPTIONS_LENGTH];
+  unsigned gop_cache; // KiB
+  unsigned force_key_interval; // ms
+  bool lazy;
+  char ladder[64]; // additional heights, ex. "720,360"
 } camera_output_options_t;
 
 typedef struct camera_options_s {
+  unsigned index; // selects outputs, 0 is served without a `/camN/` prefix
   char path[256];
+  char pipeline[256]; // replaces the snapshot/stream/video outputs
+  char probe_cache[256];
   unsigned width, height, format;
   unsigned nbufs, fps;
   camera_type_t type;
@@ -36,6 +48,8 @@ typedef struct camera_options_s {
   bool auto_focus;
   unsigned auto_reconnect;
   bool force_active;
+  unsigned release_idle; // seconds
+  unsigned idle_fps;
   union {
     bool vflip;
     unsigned vflip_align;
@@ -47,6 +61,7 @@ typedef struct camera_options_s {
 
   char options[CAMERA_OPTIONS_LENGTH];
   bool list_options;
+  bool explain_pipeline;
 
   struct {
     char options[CAMERA_OPTIONS_LENGTH];
@@ -55,6 +70,7 @@ typedef struct camera_options_s {
   camera_output_options_t snapshot;
   camera_output_options_t stream;
   camera_output_options_t video;
+  camera_output_options_t sub_video;
 } camera_options_t;
 
 typedef struct camera_s {
@@ -68,10 +84,15 @@ typedef struct camera_s {
       device_t *camera;
       device_t *decoder; // decode JPEG/H264 into YUVU
       device_t *isp;
-      device_t *rescallers[3];
+      device_t *rescallers[MAX_RESCALLERS];
       device_t *codec_snapshot;
       device_t *codec_stream;
       device_t *codec_video;
+      device_t *codec_sub_video;
+      device_t *codec_snapshot_ladder[MAX_LADDER_RUNGS];
+      device_t *codec_stream_ladder[MAX_LADDER_RUNGS];
+      device_t *codec_video_ladder[MAX_LADDER_RUNGS];
+      device_t *graph[MAX_GRAPH_NODES];
     };
   };
 
@@ -79,6 +100,15 @@ typedef struct camera_s {
 
   link_t links[MAX_DEVICES];
   int nlinks;
+
+  // on reconnect only the camera device is reopened, and has to negotiate the same format
+  buffer_format_t input_fmt;
+  device_opts_t input_opts;
+  int input_lists[MAX_DEVICES]; // capture list of the camera feeding each link, -1 if none
+  bool reconnected;
+
+  bool running;
+  bool restart; // reopen right away keeping the probed devices
 } camera_t;
 
 #define CAMERA(DEVICE) camera->devices[DEVICE]
@@ -87,17 +117,22 @@ camera_t *camera_open(camera_options_t *camera);
 int camera_set_params(camera_t *camera);
 void camera_close(camera_t **camera);
 int camera_run(camera_t *camera);
+void camera_restart(camera_t *camera);
+int camera_reconnect(camera_t *camera);
 
 link_t *camera_ensure_capture(camera_t *camera, buffer_list_t *capture);
 void camera_capture_add_output(camera_t *camera, buffer_list_t *capture, buffer_list_t *output);
 void camera_capture_add_callbacks(camera_t *camera, buffer_list_t *capture, link_callbacks_t callbacks);
 
+buffer_list_t *camera_open_input(camera_t *camera);
 int camera_configure_input(camera_t *camera);
 int camera_configure_pipeline(camera_t *camera, buffer_list_t *camera_capture);
+int camera_configure_graph(camera_t *camera, buffer_list_t *camera_capture, struct output_camera_s *outputs);
 void camera_debug_capture(camera_t *camera, buffer_list_t *capture);
 
 buffer_list_t *camera_configure_isp(camera_t *camera, buffer_list_t *src_capture);
 buffer_list_t *camera_configure_decoder(camera_t *camera, buffer_list_t *src_capture);
 buffer_list_t *camera_configure_rescaller(camera_t *camera, buffer_list_t *src_capture, const char *name, unsigned target_height, unsigned formats[]);
 int camera_configure_output(camera_t *camera, buffer_list_t *camera_capture, const char *name, camera_output_options_t *options, unsigned formats[], link_callbacks_t callbacks, device_t **device);
+void camera_get_scaled_resolution2(unsigned in_width, unsigned in_height, unsigned proposed_height, unsigned *target_width, unsigned *target_height, int align_size);
 bool camera_get_scaled_resolution(buffer_format_t capture_format, camera_output_options_t *options, buffer_format_t *format, int align_size);
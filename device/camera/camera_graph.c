@@ -0,0 +1,306 @@
+#include "camera.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "device/buffer.h"
+#include "device/buffer_list.h"
+#include "device/buffer_lock.h"
+#include "device/device.h"
+#include "device/device_list.h"
+#include "device/links.h"
+#include "util/opts/log.h"
+#include "util/opts/fourcc.h"
+#include "output/output.h"
+
+#define GRAPH_SOURCE_NODE "camera"
+
+typedef struct camera_graph_node_s {
+  char name[32];
+  char type[16];
+  char input[32];
+  char output[32];
+  char options[256];
+  unsigned format;
+  unsigned height;
+  unsigned nbufs;
+  int dma; // -1 keeps the device default
+
+  buffer_list_t *capture;
+} camera_graph_node_t;
+
+typedef struct camera_graph_s {
+  const char *name;
+  camera_graph_node_t nodes[MAX_GRAPH_NODES];
+  int nnodes;
+} camera_graph_t;
+
+static unsigned graph_decoded_formats[] =
+{
+  V4L2_PIX_FMT_YUYV,
+  V4L2_PIX_FMT_NV12,
+  V4L2_PIX_FMT_YUV420,
+  V4L2_PIX_FMT_NV21,
+  V4L2_PIX_FMT_YVU420,
+  0
+};
+
+static unsigned camera_graph_parse_format(const char *value)
+{
+  if (strlen(value) != 4) {
+    return 0;
+  }
+
+  return v4l2_fourcc(value[0], value[1], value[2], value[3]);
+}
+
+// parses `key=value` tokens: name, type, input, output, format, height, nbufs, dma, options
+static int camera_graph_parse_line(camera_graph_t *graph, char *line, camera_graph_node_t *node)
+{
+  char *saveptr = NULL;
+
+  node->dma = -1;
+
+  for (char *token = strtok_r(line, " \t\r\n", &saveptr); token; token = strtok_r(NULL, " \t\r\n", &saveptr)) {
+    char *value = strchr(token, '=');
+    if (!value) {
+      LOG_ERROR(graph, "Missing 'key=value' for '%s'.", token);
+    }
+    *value++ = 0;
+
+    if (!strcmp(token, "name")) {
+      snprintf(node->name, sizeof(node->name), "%s", value);
+    } else if (!strcmp(token, "type")) {
+      snprintf(node->type, sizeof(node->type), "%s", value);
+    } else if (!strcmp(token, "input")) {
+      snprintf(node->input, sizeof(node->input), "%s", value);
+    } else if (!strcmp(token, "output")) {
+      snprintf(node->output, sizeof(node->output), "%s", value);
+    } else if (!strcmp(token, "options")) {
+      snprintf(node->options, sizeof(node->options), "%s", value);
+    } else if (!strcmp(token, "format")) {
+      node->format = camera_graph_parse_format(value);
+      if (!node->format) {
+        LOG_ERROR(graph, "Invalid format '%s', expected a fourcc like 'H264'.", value);
+      }
+    } else if (!strcmp(token, "height")) {
+      node->height = strtoul(value, NULL, 10);
+    } else if (!strcmp(token, "nbufs")) {
+      node->nbufs = strtoul(value, NULL, 10);
+    } else if (!strcmp(token, "dma")) {
+      node->dma = strtoul(value, NULL, 10) ? 1 : 0;
+    } else {
+      LOG_ERROR(graph, "Unknown key '%s'.", token);
+    }
+  }
+
+  if (!node->name[0] || !node->type[0] || !node->input[0]) {
+    LOG_ERROR(graph, "Each node requires 'name', 'type' and 'input'.");
+  }
+
+  return 0;
+
+error:
+  return -1;
+}
+
+static int camera_graph_load(camera_graph_t *graph, const char *path)
+{
+  char line[1024];
+  FILE *fp = fopen(path, "r");
+  if (!fp) {
+    LOG_ERROR(graph, "Cannot open '%s'.", path);
+  }
+
+  while (fgets(line, sizeof(line), fp)) {
+    char *start = line + strspn(line, " \t");
+    if (!start[0] || start[0] == '#' || start[0] == '\n' || start[0] == '\r') {
+      continue;
+    }
+
+    if (graph->nnodes >= MAX_GRAPH_NODES) {
+      fclose(fp);
+      LOG_ERROR(graph, "Too many nodes, up to %d are supported.", MAX_GRAPH_NODES);
+    }
+
+    if (camera_graph_parse_line(graph, start, &graph->nodes[graph->nnodes]) < 0) {
+      fclose(fp);
+      return -1;
+    }
+    graph->nnodes++;
+  }
+
+  fclose(fp);
+  return 0;
+
+error:
+  return -1;
+}
+
+static buffer_list_t *camera_graph_find_capture(camera_graph_t *graph, camera_graph_node_t *node, buffer_list_t *camera_capture)
+{
+  if (!strcmp(node->input, GRAPH_SOURCE_NODE)) {
+    return camera_capture;
+  }
+
+  // edges only point to previously declared nodes
+  for (camera_graph_node_t *input = graph->nodes; input < node; input++) {
+    if (!strcmp(input->name, node->input)) {
+      return input->capture;
+    }
+  }
+
+  return NULL;
+}
+
+static buffer_list_t *camera_graph_open_m2m(camera_t *camera, camera_graph_node_t *node, buffer_list_t *src_capture, unsigned formats[], int slot)
+{
+  unsigned chosen_format = 0;
+  device_info_t *device_info = device_list_find_m2m_formats(camera->device_list, src_capture->fmt.format, formats, &chosen_format);
+
+  if (!device_info) {
+    LOG_INFO(camera, "Cannot find M2M device for '%s' to convert from '%s' to '%s'.",
+      node->name, fourcc_to_string(src_capture->fmt.format).buf, many_fourcc_to_string(formats).buf);
+    return NULL;
+  }
+
+  device_t *device = device_v4l2_open(node->name, device_info->path);
+  if (!device) {
+    return NULL;
+  }
+
+  camera->graph[slot] = device;
+
+  bool allow_dma = node->dma < 0 ? src_capture->dev->opts.allow_dma : node->dma;
+
+  buffer_list_t *output = device_open_buffer_list_output2(device, src_capture, allow_dma);
+
+  buffer_format_t fmt = {
+    .format = chosen_format,
+    .nbufs = node->nbufs
+  };
+
+  if (node->height) {
+    camera_get_scaled_resolution2(
+      src_capture->fmt.width, src_capture->fmt.height,
+      node->height,
+      &fmt.width, &fmt.height,
+      RESCALLER_BLOCK_SIZE
+    );
+  }
+
+  buffer_list_t *capture = device_open_buffer_list_capture(device, NULL, output, fmt, true);
+  if (!capture) {
+    return NULL;
+  }
+
+  if (chosen_format == V4L2_PIX_FMT_H264) {
+    device_set_option_string(device, "repeat_sequence_header", "1"); // required for force key support
+  }
+  device_set_option_list(device, node->options);
+
+  camera_capture_add_output(camera, src_capture, output);
+  return capture;
+}
+
+static buffer_lock_t *camera_graph_find_output(camera_graph_node_t *node, output_camera_t *outputs)
+{
+  if (!strcmp(node->output, "snapshot")) {
+    return outputs->snapshot.buf_lock;
+  } else if (!strcmp(node->output, "stream")) {
+    return outputs->stream.buf_lock;
+  } else if (!strcmp(node->output, "video")) {
+    return outputs->video.buf_lock;
+  } else if (!strcmp(node->output, "video_sub")) {
+    return outputs->video_sub;
+  }
+
+  return NULL;
+}
+
+static int camera_graph_build_node(camera_t *camera, camera_graph_t *graph, camera_graph_node_t *node, buffer_list_t *camera_capture, output_camera_t *outputs)
+{
+  buffer_list_t *src_capture = camera_graph_find_capture(graph, node, camera_capture);
+  if (!src_capture) {
+    LOG_ERROR(graph, "The '%s' input of '%s' is not declared before it.", node->input, node->name);
+  }
+
+  int slot = node - graph->nodes;
+  unsigned formats[] = { node->format, 0 };
+
+  if (!strcmp(node->type, "isp")) {
+    node->capture = camera_configure_isp(camera, src_capture);
+  } else if (!strcmp(node->type, "decoder")) {
+    device_video_force_key(src_capture->dev);
+    node->capture = camera_graph_open_m2m(camera, node, src_capture, node->format ? formats : graph_decoded_formats, slot);
+  } else if (!strcmp(node->type, "scaler")) {
+    if (!node->height) {
+      LOG_ERROR(graph, "The scaler '%s' requires 'height'.", node->name);
+    }
+    node->capture = camera_graph_open_m2m(camera, node, src_capture, node->format ? formats : graph_decoded_formats, slot);
+  } else if (!strcmp(node->type, "encoder")) {
+    if (!node->format) {
+      LOG_ERROR(graph, "The encoder '%s' requires 'format'.", node->name);
+    }
+    node->capture = camera_graph_open_m2m(camera, node, src_capture, formats, slot);
+  } else if (!strcmp(node->type, "tap")) {
+    node->capture = src_capture;
+
+    link_callbacks_t callbacks = {
+      .buf_lock = output_tap_lock(node->name, true)
+    };
+    if (!callbacks.buf_lock) {
+      LOG_ERROR(graph, "Cannot create the '%s' tap.", node->name);
+    }
+    callbacks.name = callbacks.buf_lock->name;
+    camera_capture_add_callbacks(camera, node->capture, callbacks);
+  } else {
+    LOG_ERROR(graph, "Unknown type '%s' of '%s'.", node->type, node->name);
+  }
+
+  if (!node->capture) {
+    LOG_ERROR(graph, "Cannot configure '%s'.", node->name);
+  }
+
+  if (node->output[0]) {
+    link_callbacks_t callbacks = {
+      .buf_lock = camera_graph_find_output(node, outputs)
+    };
+    if (!callbacks.buf_lock) {
+      LOG_ERROR(graph, "Unknown output '%s' of '%s'.", node->output, node->name);
+    }
+    callbacks.name = callbacks.buf_lock->name;
+    camera_capture_add_callbacks(camera, node->capture, callbacks);
+  }
+
+  camera_debug_capture(camera, node->capture);
+  return 0;
+
+error:
+  return -1;
+}
+
+int camera_configure_graph(camera_t *camera, buffer_list_t *camera_capture, output_camera_t *outputs)
+{
+  camera_graph_t *graph = calloc(1, sizeof(camera_graph_t));
+  int ret = -1;
+
+  graph->name = "GRAPH";
+
+  if (camera_graph_load(graph, camera->options.pipeline) < 0) {
+    goto error;
+  }
+
+  for (int i = 0; i < graph->nnodes; i++) {
+    if (camera_graph_build_node(camera, graph, &graph->nodes[i], camera_capture, outputs) < 0) {
+      goto error;
+    }
+  }
+
+  ret = 0;
+
+error:
+  free(graph);
+  return ret;
+}
@@ -8,7 +8,7 @@
 #include "util/opts/log.h"
 #include "util/opts/fourcc.h"
 
-static int camera_configure_input_v4l2(camera_t *camera)
+static buffer_list_t *camera_open_input_v4l2(camera_t *camera)
 {
   const char *path = camera->options.path;
 
@@ -20,7 +20,7 @@ static int camera_configure_input_v4l2(camera_t *camera)
   if (!camera->camera) {
     LOG_INFO(camera, "Listing available v4l2 devices:");
     system("v4l2-ctl --list-devices");
-    return -1;
+    return NULL;
   }
 
   device_set_rotation(camera->camera, camera->options.vflip, camera->options.hflip);
@@ -41,17 +41,17 @@ static int camera_configure_input_v4l2(camera_t *camera)
 
   buffer_list_t *camera_capture = device_open_buffer_list(camera->camera, true, fmt, true);
   if (!camera_capture) {
-    return -1;
+    return NULL;
   }
 
-  return camera_configure_pipeline(camera, camera_capture);
+  return camera_capture;
 }
 
-static int camera_configure_input_libcamera(camera_t *camera)
+static buffer_list_t *camera_open_input_libcamera(camera_t *camera)
 {
   camera->camera = device_libcamera_open(camera->name, camera->options.path);
   if (!camera->camera) {
-    return -1;
+    return NULL;
   }
 
   device_set_rotation(camera->camera, camera->options.vflip, camera->options.hflip);
@@ -76,7 +76,7 @@ static int camera_configure_input_libcamera(camera_t *camera)
 
   buffer_list_t *camera_capture = device_open_buffer_list(camera->camera, true, capture_fmt, true);
   if (!camera_capture) {
-    return -1;
+    return NULL;
   }
 
   buffer_format_t raw_fmt = {
@@ -88,24 +88,24 @@ static int camera_configure_input_libcamera(camera_t *camera)
 
   buffer_list_t *raw_capture = device_open_buffer_list(camera->camera, true, raw_fmt, true);
   if (!raw_capture) {
-    return -1;
+    return NULL;
   }
 
   if (buffer_list_alloc_buffers(camera_capture) < 0) {
-    return -1;
+    return NULL;
   }
   if (buffer_list_alloc_buffers(raw_capture) < 0) {
-    return -1;
+    return NULL;
   }
 
-  return camera_configure_pipeline(camera, camera_capture);
+  return camera_capture;
 }
 
-static int camera_configure_input_dummy(camera_t *camera)
+static buffer_list_t *camera_open_input_dummy(camera_t *camera)
 {
   camera->camera = device_dummy_open(camera->name, camera->options.path);
   if (!camera->camera) {
-    return -1;
+    return NULL;
   }
 
   buffer_format_t fmt = {
@@ -117,26 +117,36 @@ static int camera_configure_input_dummy(camera_t *camera)
 
   buffer_list_t *camera_capture = device_open_buffer_list(camera->camera, true, fmt, true);
   if (!camera_capture) {
-    return -1;
+    return NULL;
   }
 
-  return camera_configure_pipeline(camera, camera_capture);
+  return camera_capture;
 }
 
-int camera_configure_input(camera_t *camera)
+buffer_list_t *camera_open_input(camera_t *camera)
 {
   switch (camera->options.type) {
   case CAMERA_V4L2:
-    return camera_configure_input_v4l2(camera);
+    return camera_open_input_v4l2(camera);
 
   case CAMERA_LIBCAMERA:
-    return camera_configure_input_libcamera(camera);
+    return camera_open_input_libcamera(camera);
 
   case CAMERA_DUMMY:
-    return camera_configure_input_dummy(camera);
+    return camera_open_input_dummy(camera);
 
   default:
     LOG_INFO(camera, "Unsupported camera type");
+    return NULL;
+  }
+}
+
+int camera_configure_input(camera_t *camera)
+{
+  buffer_list_t *camera_capture = camera_open_input(camera);
+  if (!camera_capture) {
     return -1;
   }
+
+  return camera_configure_pipeline(camera, camera_capture);
 }
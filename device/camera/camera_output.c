@@ -1,7 +1,11 @@
 #include "camera.h"
 
+#include <stdio.h>
+#include <string.h>
+
 #include "device/buffer.h"
 #include "device/buffer_list.h"
+#include "device/buffer_lock.h"
 #include "device/device.h"
 #include "device/device_list.h"
 #include "device/links.h"
@@ -76,10 +80,332 @@ static unsigned rescalled_formats[] =
 
 #define OUTPUT_RESCALLER_SIZE 32
 
+// rough per-frame cost model used to rank the routes
+#define PLAN_PASS_LATENCY_US 4000
+#define PLAN_MEMCPY_BYTES_PER_US 1000
+#define PLAN_SHARED_DEVICE_US 8000
+#define PLAN_MEMORY_BYTES_PER_US 4096
+
+typedef enum {
+  CAMERA_PLAN_REUSE = 0,
+  CAMERA_PLAN_ENCODE,
+  CAMERA_PLAN_RESCALE,
+  CAMERA_PLAN_DECODE,
+  CAMERA_PLAN_DECODE_RESCALE,
+  CAMERA_PLAN_MAX
+} camera_plan_route_t;
+
+static const char *camera_plan_routes[CAMERA_PLAN_MAX] = {
+  "reuse",
+  "encode",
+  "rescale+encode",
+  "decode+encode",
+  "decode+rescale+encode"
+};
+
+typedef struct camera_plan_s {
+  camera_plan_route_t route;
+  buffer_list_t *src;
+  unsigned target_height; // of the rescaler
+  const char *rejected;
+
+  // of the frames fed to the encoder
+  unsigned format, width, height;
+
+  int passes;
+  unsigned long long copied; // bytes per frame
+  unsigned long long memory; // bytes of the new buffers
+  unsigned long long latency_us;
+  unsigned long long cost;
+} camera_plan_t;
+
+static unsigned long long camera_plan_frame_bytes(unsigned format, unsigned width, unsigned height)
+{
+  unsigned long long pixels = (unsigned long long)width * height;
+
+  switch (format) {
+  case V4L2_PIX_FMT_YUV420:
+  case V4L2_PIX_FMT_YVU420:
+  case V4L2_PIX_FMT_NV12:
+  case V4L2_PIX_FMT_NV21:
+    return pixels * 3 / 2;
+
+  case V4L2_PIX_FMT_SRGGB10P:
+  case V4L2_PIX_FMT_SGRBG10P:
+  case V4L2_PIX_FMT_SBGGR10P:
+    return pixels * 5 / 4;
+
+  case V4L2_PIX_FMT_JPEG:
+  case V4L2_PIX_FMT_MJPEG:
+  case V4L2_PIX_FMT_H264:
+    return pixels / 8;
+
+  default:
+    return pixels * 2;
+  }
+}
+
+static int camera_plan_device_users(camera_t *camera, device_info_t *info)
+{
+  int users = info->users;
+
+  for (int i = 0; i < MAX_DEVICES; i++) {
+    if (camera->devices[i] && camera->devices[i]->path && !strcmp(camera->devices[i]->path, info->path)) {
+      users++;
+    }
+  }
+
+  return users;
+}
+
+// accounts one M2M pass, `src` is NULL for buffers created by the plan itself
+static void camera_plan_add_pass(camera_t *camera, camera_plan_t *plan, buffer_list_t *src, device_info_t *info,
+  unsigned in_format, unsigned in_width, unsigned in_height,
+  unsigned out_format, unsigned out_width, unsigned out_height)
+{
+  unsigned long long in_bytes = camera_plan_frame_bytes(in_format, in_width, in_height);
+  bool allow_dma = src ? src->dev->opts.allow_dma && src->do_mmap : camera->options.allow_dma;
+
+  plan->passes++;
+  plan->latency_us += PLAN_PASS_LATENCY_US;
+  plan->memory += camera->options.nbufs * camera_plan_frame_bytes(out_format, out_width, out_height);
+
+  if (!allow_dma) {
+    plan->copied += in_bytes;
+    plan->memory += camera->options.nbufs * in_bytes;
+    plan->latency_us += in_bytes / PLAN_MEMCPY_BYTES_PER_US;
+  }
+
+  if (info && camera_plan_device_users(camera, info) > 0) {
+    plan->latency_us += PLAN_SHARED_DEVICE_US;
+  }
+}
+
+static device_info_t *camera_plan_find_rescaller(camera_t *camera, unsigned format, unsigned *chosen_format)
+{
+  device_info_t *info = device_list_find_m2m_format(camera->device_list, format, format);
+  if (info) {
+    *chosen_format = format;
+    return info;
+  }
+
+  return device_list_find_m2m_formats(camera->device_list, format, rescalled_formats, chosen_format);
+}
+
+static bool camera_plan_has_rescaller_slot(camera_t *camera)
+{
+  for (int i = 0; i < MAX_RESCALLERS; i++) {
+    if (!camera->rescallers[i]) {
+      return true;
+    }
+  }
+  return false;
+}
+
+static void camera_plan_rescale(camera_t *camera, camera_plan_t *plan, buffer_list_t *src,
+  unsigned format, unsigned width, unsigned height, unsigned target_height)
+{
+  unsigned chosen_format = 0;
+
+  if (!camera_plan_has_rescaller_slot(camera)) {
+    plan->rejected = "all rescallers are in use";
+    return;
+  }
+
+  device_info_t *info = camera_plan_find_rescaller(camera, format, &chosen_format);
+  if (!info) {
+    plan->rejected = "no rescaller";
+    return;
+  }
+
+  plan->target_height = target_height;
+  plan->format = chosen_format;
+  camera_get_scaled_resolution2(width, height, target_height,
+    &plan->width, &plan->height, RESCALLER_BLOCK_SIZE);
+  camera_plan_add_pass(camera, plan, src, info, format, width, height,
+    plan->format, plan->width, plan->height);
+}
+
+static bool camera_plan_decode(camera_t *camera, camera_plan_t *plan, buffer_list_t *camera_capture)
+{
+  device_info_t *info = NULL;
+  unsigned chosen_format = 0;
+
+  if (camera->decoder || camera->isp) {
+    plan->rejected = "already decoded";
+    return false;
+  }
+
+  switch (camera_capture->fmt.format) {
+  case V4L2_PIX_FMT_SRGGB10P:
+  case V4L2_PIX_FMT_SGRBG10P:
+  case V4L2_PIX_FMT_SBGGR10P:
+  case V4L2_PIX_FMT_SRGGB10:
+  case V4L2_PIX_FMT_SGRBG10:
+    chosen_format = V4L2_PIX_FMT_YUYV;
+    break;
+
+  case V4L2_PIX_FMT_MJPEG:
+  case V4L2_PIX_FMT_H264:
+    info = device_list_find_m2m_formats(camera->device_list, camera_capture->fmt.format, rescalled_formats, &chosen_format);
+    if (!info) {
+      plan->rejected = "no decoder";
+      return false;
+    }
+    break;
+
+  default:
+    plan->rejected = "camera format is not decoded";
+    return false;
+  }
+
+  plan->format = chosen_format;
+  plan->width = camera_capture->fmt.width;
+  plan->height = camera_capture->fmt.height;
+  camera_plan_add_pass(camera, plan, camera_capture, info,
+    camera_capture->fmt.format, camera_capture->fmt.width, camera_capture->fmt.height,
+    plan->format, plan->width, plan->height);
+  return true;
+}
+
+static void camera_plan_build(camera_t *camera, camera_plan_t *plan, buffer_list_t *camera_capture,
+  buffer_format_t *selected_format, buffer_format_t *rescalled_format, unsigned formats[])
+{
+  switch (plan->route) {
+  case CAMERA_PLAN_REUSE:
+    plan->src = camera_find_capture2(camera, selected_format->height, formats);
+    if (!plan->src) {
+      plan->rejected = "no matching capture";
+    }
+    return;
+
+  case CAMERA_PLAN_ENCODE:
+    plan->src = camera_find_capture2(camera, rescalled_format->height, rescalled_formats);
+    if (!plan->src) {
+      plan->src = camera_find_capture2(camera, selected_format->height, rescalled_formats);
+    }
+    if (!plan->src) {
+      plan->rejected = "no capture of matching size";
+      return;
+    }
+    plan->format = plan->src->fmt.format;
+    plan->width = plan->src->fmt.width;
+    plan->height = plan->src->fmt.height;
+    break;
+
+  case CAMERA_PLAN_RESCALE:
+    plan->src = camera_find_capture2(camera, 0, rescalled_formats);
+    if (!plan->src) {
+      plan->rejected = "no capture to rescale";
+      return;
+    }
+    camera_plan_rescale(camera, plan, plan->src, plan->src->fmt.format,
+      plan->src->fmt.width, plan->src->fmt.height, rescalled_format->height);
+    break;
+
+  case CAMERA_PLAN_DECODE:
+    if (!camera_plan_decode(camera, plan, camera_capture)) {
+      return;
+    }
+    if (abs((int)plan->height - (int)selected_format->height) > MATCH_ALIGN_SIZE) {
+      plan->rejected = "decoded size does not match";
+      return;
+    }
+    break;
+
+  case CAMERA_PLAN_DECODE_RESCALE:
+    if (!camera_plan_decode(camera, plan, camera_capture)) {
+      return;
+    }
+    camera_plan_rescale(camera, plan, NULL, plan->format,
+      plan->width, plan->height, selected_format->height);
+    break;
+
+  default:
+    return;
+  }
+
+  if (plan->rejected) {
+    return;
+  }
+
+  unsigned chosen_format = 0;
+  device_info_t *info = device_list_find_m2m_formats(camera->device_list, plan->format, formats, &chosen_format);
+  if (!info) {
+    plan->rejected = "no encoder";
+    return;
+  }
+
+  camera_plan_add_pass(camera, plan, plan->route == CAMERA_PLAN_ENCODE ? plan->src : NULL, info,
+    plan->format, plan->width, plan->height,
+    chosen_format, selected_format->width, selected_format->height);
+}
+
+static void camera_plan_explain(camera_t *camera, const char *name, camera_plan_t *plan, camera_plan_t *chosen)
+{
+  char line[256];
+  int n = snprintf(line, sizeof(line), "%s %-22s", name, camera_plan_routes[plan->route]);
+
+  if (plan->src) {
+    n += snprintf(line + n, sizeof(line) - n, " from %s", plan->src->name);
+  }
+
+  if (!plan->rejected) {
+    n += snprintf(line + n, sizeof(line) - n,
+      " passes=%d copied=%lluKiB memory=%lluKiB latency=%lluus cost=%llu",
+      plan->passes, plan->copied / 1024, plan->memory / 1024, plan->latency_us, plan->cost);
+  }
+
+  if (plan == chosen) {
+    snprintf(line + n, sizeof(line) - n, ": chosen");
+  } else {
+    snprintf(line + n, sizeof(line) - n, ": rejected, %s", plan->rejected ? plan->rejected : "higher cost");
+  }
+
+  if (camera->options.explain_pipeline) {
+    printf("%s: %s\n", camera->name, line);
+  } else {
+    LOG_VERBOSE(camera, "%s", line);
+  }
+}
+
+static buffer_list_t *camera_plan_execute(camera_t *camera, buffer_list_t *camera_capture, const char *name, camera_plan_t *plan)
+{
+  buffer_list_t *decoded_capture = NULL;
+
+  switch (plan->route) {
+  case CAMERA_PLAN_REUSE:
+  case CAMERA_PLAN_ENCODE:
+    return plan->src;
+
+  case CAMERA_PLAN_RESCALE:
+    return camera_configure_rescaller(camera, plan->src, name, plan->target_height, rescalled_formats);
+
+  case CAMERA_PLAN_DECODE:
+  case CAMERA_PLAN_DECODE_RESCALE:
+    if (camera_capture->fmt.format == V4L2_PIX_FMT_MJPEG || camera_capture->fmt.format == V4L2_PIX_FMT_H264) {
+      decoded_capture = camera_configure_decoder(camera, camera_capture);
+    } else {
+      decoded_capture = camera_configure_isp(camera, camera_capture);
+    }
+
+    if (!decoded_capture || plan->route == CAMERA_PLAN_DECODE) {
+      return decoded_capture;
+    }
+    return camera_configure_rescaller(camera, decoded_capture, name, plan->target_height, rescalled_formats);
+
+  default:
+    return NULL;
+  }
+}
+
 int camera_configure_output(camera_t *camera, buffer_list_t *camera_capture, const char *name, camera_output_options_t *options, unsigned formats[], link_callbacks_t callbacks, device_t **device)
 {
   buffer_format_t selected_format = {0};
   buffer_format_t rescalled_format = {0};
+  camera_plan_t plans[CAMERA_PLAN_MAX] = {0};
+  camera_plan_t *chosen = NULL;
+  buffer_list_t *src_capture = NULL;
 
   if (!camera_get_scaled_resolution(camera_capture->fmt, options, &selected_format, 1)) {
     return 0;
@@ -89,55 +415,33 @@ int camera_configure_output(camera_t *camera, buffer_list_t *camera_capture, con
     return 0;
   }
 
-  // find an existing format
-  buffer_list_t *src_capture = camera_find_capture2(camera, selected_format.height, formats);
-  if (src_capture) {
-    camera_capture_add_callbacks(camera, src_capture, callbacks);
-    return 0;
+  for (int i = 0; i < CAMERA_PLAN_MAX; i++) {
+    plans[i].route = i;
+    camera_plan_build(camera, &plans[i], camera_capture, &selected_format, &rescalled_format, formats);
+    plans[i].cost = plans[i].latency_us + plans[i].memory / PLAN_MEMORY_BYTES_PER_US;
   }
 
-  // Try to find exact capture
-  src_capture = camera_find_capture2(camera, rescalled_format.height, rescalled_formats);
-
-  // Try to re-scale capture
-  if (!src_capture) {
-    buffer_list_t *other_capture = camera_find_capture2(camera, 0, rescalled_formats);
-
-    if (other_capture) {
-      src_capture = camera_configure_rescaller(camera, other_capture, name, rescalled_format.height, rescalled_formats);
+  // try the cheapest plans first, a failing one is rejected and the next is tried
+  while (!src_capture) {
+    chosen = NULL;
+    for (int i = 0; i < CAMERA_PLAN_MAX; i++) {
+      if (!plans[i].rejected && (!chosen || plans[i].cost < chosen->cost)) {
+        chosen = &plans[i];
+      }
     }
-  }
-
-  // Try to decode output
-  if (!src_capture) {
-    buffer_list_t *decoded_capture = NULL;
-
-    switch (camera_capture->fmt.format) {
-    case V4L2_PIX_FMT_SRGGB10P:
-    case V4L2_PIX_FMT_SGRBG10P:
-    case V4L2_PIX_FMT_SBGGR10P:
-    case V4L2_PIX_FMT_SRGGB10:
-    case V4L2_PIX_FMT_SGRBG10:
-      decoded_capture = camera_configure_isp(camera, camera_capture);
-      break;
 
-    case V4L2_PIX_FMT_MJPEG:
-    case V4L2_PIX_FMT_H264:
-      decoded_capture = camera_configure_decoder(camera, camera_capture);
+    if (!chosen) {
       break;
     }
 
-    // Now, do we have exact match
-    src_capture = camera_find_capture2(camera, selected_format.height, rescalled_formats);
-
+    src_capture = camera_plan_execute(camera, camera_capture, name, chosen);
     if (!src_capture) {
-      src_capture = camera_find_capture2(camera, rescalled_format.height, rescalled_formats);
+      chosen->rejected = "cannot be configured";
     }
+  }
 
-    // Otherwise rescalle decoded output
-    if (!src_capture && decoded_capture) {
-      src_capture = camera_configure_rescaller(camera, decoded_capture, name, selected_format.height, rescalled_formats);
-    }
+  for (int i = 0; i < CAMERA_PLAN_MAX; i++) {
+    camera_plan_explain(camera, name, &plans[i], chosen);
   }
 
   if (!src_capture) {
@@ -145,6 +449,11 @@ int camera_configure_output(camera_t *camera, buffer_list_t *camera_capture, con
     return -1;
   }
 
+  if (chosen->route == CAMERA_PLAN_REUSE) {
+    camera_capture_add_callbacks(camera, src_capture, callbacks);
+    return 0;
+  }
+
   unsigned chosen_format = 0;
   device_info_t *device_info = device_list_find_m2m_formats(camera->device_list, src_capture->fmt.format, formats, &chosen_format);
 
@@ -156,7 +465,13 @@ int camera_configure_output(camera_t *camera, buffer_list_t *camera_capture, con
   *device = device_v4l2_open(name, device_info->path);
 
   buffer_list_t *output = device_open_buffer_list_output(*device, src_capture);
-  buffer_list_t *capture = device_open_buffer_list_capture2(*device, NULL, output, chosen_format, true);
+
+  // each notify worker of the output can hold one of the buffers while sending it
+  buffer_format_t fmt = {
+    .format = chosen_format,
+    .nbufs = output ? output->fmt.nbufs + buffer_lock_notify_workers(callbacks.buf_lock) : 0
+  };
+  buffer_list_t *capture = device_open_buffer_list_capture(*device, NULL, output, fmt, true);
 
   if (!capture) {
     return -1;
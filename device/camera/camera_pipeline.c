@@ -1,7 +1,11 @@
 #include "camera.h"
 
+#include <stdlib.h>
+#include <string.h>
+
 #include "device/buffer.h"
 #include "device/buffer_list.h"
+#include "device/buffer_lock.h"
 #include "device/device.h"
 #include "device/device_list.h"
 #include "device/links.h"
@@ -11,6 +15,9 @@
 #include "util/http/http.h"
 #include "output/output.h"
 
+// how long a lazily encoded snapshot is kept to serve further requests
+#define SNAPSHOT_LAZY_CACHE_MS 1000
+
 static unsigned snapshot_formats[] =
 {
   V4L2_PIX_FMT_JPEG,
@@ -18,36 +25,116 @@ static unsigned snapshot_formats[] =
   0
 };
 
-static link_callbacks_t snapshot_callbacks =
+static unsigned video_formats[] =
 {
-  .name = "SNAPSHOT-CAPTURE",
-  .buf_lock = &snapshot_lock
+  V4L2_PIX_FMT_H264,
+  0
 };
 
-static link_callbacks_t stream_callbacks =
+static void camera_configure_video_lock(buffer_lock_t *buf_lock, camera_output_options_t *options)
 {
-  .name = "STREAM-CAPTURE",
-  .buf_lock = &stream_lock
-};
+  pthread_mutex_lock(&buf_lock->lock);
+  if (buf_lock->buf_list) {
+    buf_lock->gop_size = options->gop_cache * 1024;
+    buf_lock->buf_list->dev->opts.force_key_interval_us = options->force_key_interval * 1000LL;
+  }
+  pthread_mutex_unlock(&buf_lock->lock);
+}
 
-static unsigned video_formats[] =
+static void camera_configure_snapshot_lock(buffer_lock_t *buf_lock, device_t *codec, camera_output_options_t *options)
 {
-  V4L2_PIX_FMT_H264,
-  0
-};
+  // lazy snapshot requires a dedicated encoder fed with the latest decoded frame
+  if (options->lazy && codec && codec->output_list) {
+    codec->opts.lazy = true;
+    buf_lock->timeout_us = SNAPSHOT_LAZY_CACHE_MS * 1000LL;
+  }
+}
 
-static link_callbacks_t video_callbacks =
+static void camera_configure_release_idle(camera_t *camera)
 {
-  .name = "VIDEO-CAPTURE",
-  .buf_lock = &video_lock
-};
+  if (!camera->options.release_idle) {
+    return;
+  }
+
+  // only the M2M devices with a single capture, the camera and ISP keep running
+  for (int i = 0; i < MAX_DEVICES; i++) {
+    device_t *dev = camera->devices[i];
+
+    if (dev && dev != camera->camera && dev->output_list && dev->n_capture_list == 1 && !dev->opts.lazy) {
+      dev->opts.release_idle_us = camera->options.release_idle * 1000LL * 1000LL;
+    }
+  }
+}
+
+static void camera_configure_idle_fps(camera_t *camera)
+{
+  if (!camera->options.idle_fps) {
+    return;
+  }
+
+  // the capture branch keeps a recent frame, the encoders stay paused
+  device_t *devices[] = { camera->camera, camera->isp, camera->decoder };
+
+  for (int i = 0; i < ARRAY_SIZE(devices); i++) {
+    if (devices[i]) {
+      devices[i]->opts.idle_interval_us = 1000LL * 1000LL / camera->options.idle_fps;
+    }
+  }
+}
+
+static void camera_configure_ladder(camera_t *camera, buffer_list_t *camera_capture, const char *name,
+  camera_output_options_t *options, unsigned formats[], output_ladder_t *ladder, device_t **codecs)
+{
+  const char *heights = options->ladder;
+
+  for (int i = 0; i < MAX_LADDER_RUNGS && i < OUTPUT_LADDER_MAX; i++) {
+    char *end = NULL;
+    unsigned height = strtoul(heights, &end, 10);
+    if (end == heights) {
+      break;
+    }
+    heights = end + strspn(end, ",");
+
+    camera_output_options_t rung_options = *options;
+    rung_options.height = height;
+    rung_options.lazy = false;
+
+    char rung_name[64];
+    snprintf(rung_name, sizeof(rung_name), "%s%u", name, height);
+
+    link_callbacks_t callbacks = {
+      .name = ladder->rungs[i]->name,
+      .buf_lock = ladder->rungs[i]
+    };
+
+    // a missing rung is not fatal, clients get the closest available one
+    if (camera_configure_output(camera, camera_capture, rung_name, &rung_options,
+      formats, callbacks, &codecs[i]) < 0) {
+      LOG_INFO(camera, "Cannot configure '%s' for the '%s' ladder.", rung_name, name);
+    }
+  }
+}
 
 int camera_configure_pipeline(camera_t *camera, buffer_list_t *camera_capture)
 {
+  output_camera_t *outputs = &output_cameras[camera->options.index % MAX_OUTPUT_CAMERAS];
+
+  link_callbacks_t snapshot_callbacks = { .name = "SNAPSHOT-CAPTURE", .buf_lock = outputs->snapshot.buf_lock };
+  link_callbacks_t stream_callbacks = { .name = "STREAM-CAPTURE", .buf_lock = outputs->stream.buf_lock };
+  link_callbacks_t video_callbacks = { .name = "VIDEO-CAPTURE", .buf_lock = outputs->video.buf_lock };
+  link_callbacks_t sub_video_callbacks = { .name = "SUBVIDEO-CAPTURE", .buf_lock = outputs->video_sub };
+
   camera_capture->do_timestamps = true;
 
   camera_debug_capture(camera, camera_capture);
 
+  if (camera->options.pipeline[0]) {
+    if (camera_configure_graph(camera, camera_capture, outputs) < 0) {
+      return -1;
+    }
+    goto configure_locks;
+  }
+
   if (camera_configure_output(camera, camera_capture, "SNAPSHOT", &camera->options.snapshot,
     snapshot_formats, snapshot_callbacks, &camera->codec_snapshot) < 0) {
     return -1;
@@ -63,5 +150,32 @@ int camera_configure_pipeline(camera_t *camera, buffer_list_t *camera_capture)
     return -1;
   }
 
+  // only the first camera has the sub-stream
+  if (outputs->video_sub && camera_configure_output(camera, camera_capture, "SUBVIDEO", &camera->options.sub_video,
+    video_formats, sub_video_callbacks, &camera->codec_sub_video) < 0) {
+    return -1;
+  }
+
+  camera_configure_ladder(camera, camera_capture, "SNAPSHOT", &camera->options.snapshot,
+    snapshot_formats, &outputs->snapshot, camera->codec_snapshot_ladder);
+  camera_configure_ladder(camera, camera_capture, "STREAM", &camera->options.stream,
+    snapshot_formats, &outputs->stream, camera->codec_stream_ladder);
+  camera_configure_ladder(camera, camera_capture, "VIDEO", &camera->options.video,
+    video_formats, &outputs->video, camera->codec_video_ladder);
+
+configure_locks:
+  camera_configure_snapshot_lock(outputs->snapshot.buf_lock, camera->codec_snapshot, &camera->options.snapshot);
+  camera_configure_video_lock(outputs->video.buf_lock, &camera->options.video);
+
+  if (outputs->video_sub) {
+    camera_configure_video_lock(outputs->video_sub, &camera->options.sub_video);
+  }
+
+  for (int i = 0; i < OUTPUT_LADDER_MAX; i++) {
+    camera_configure_video_lock(outputs->video.rungs[i], &camera->options.video);
+  }
+
+  camera_configure_release_idle(camera);
+  camera_configure_idle_fps(camera);
   return 0;
 }
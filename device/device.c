@@ -4,6 +4,8 @@
 #include "util/opts/log.h"
 #include "util/opts/opts.h"
 
+#define DEVICE_ACQUIRE_RETRY_US (1000LL * 1000LL)
+
 device_t *device_open(const char *name, const char *path, device_hw_t *hw) {
   device_t *dev = calloc(1, sizeof(device_t));
   dev->name = strdup(name);
@@ -106,11 +108,20 @@ buffer_list_t *device_open_buffer_list_output(device_t *dev, buffer_list_t *capt
     return NULL;
   }
 
+  return device_open_buffer_list_output2(dev, capture_list, capture_list->dev->opts.allow_dma);
+}
+
+buffer_list_t *device_open_buffer_list_output2(device_t *dev, buffer_list_t *capture_list, bool allow_dma)
+{
+  if (!dev || !capture_list) {
+    return NULL;
+  }
+
   buffer_format_t fmt = capture_list->fmt;
 
   fmt.interval_us = 0;
 
-  bool do_mmap = capture_list->dev->opts.allow_dma ? !capture_list->do_mmap : true;
+  bool do_mmap = allow_dma ? !capture_list->do_mmap : true;
 
   // If manually allocating buffers, ensure that `sizeimage` is at least `buf->length`
   if (do_mmap) {
@@ -179,14 +190,105 @@ int device_set_stream(device_t *dev, bool do_on)
   return 0;
 }
 
-int device_video_force_key(device_t *dev)
+static bool device_buffers_in_use(buffer_list_t *buf_list)
 {
-  if (dev && dev->hw->device_video_force_key)
-    return dev->hw->device_video_force_key(dev);
+  for (int i = 0; buf_list && i < buf_list->nbufs; i++) {
+    if (!buf_list->bufs[i]->enqueued && buf_list->bufs[i]->mmap_reflinks > 1) {
+      return true;
+    }
+  }
+
+  return false;
+}
+
+int device_release_buffers(device_t *dev)
+{
+  if (!dev || dev->released) {
+    return 0;
+  }
 
+  if (!dev->output_list || !dev->hw->buffer_list_alloc_buffers || !dev->hw->buffer_list_free_buffers) {
+    return -1;
+  }
+
+  // buffers are still held by the outputs or the clients
+  for (int i = 0; i < dev->n_capture_list; i++) {
+    if (device_buffers_in_use(dev->capture_lists[i])) {
+      return -1;
+    }
+  }
+
+  if (device_set_stream(dev, false) < 0) {
+    return -1;
+  }
+
+  for (int i = 0; i < dev->n_capture_list; i++) {
+    buffer_list_free_buffers(dev->capture_lists[i]);
+  }
+  buffer_list_free_buffers(dev->output_list);
+
+  dev->released = true;
+  LOG_INFO(dev, "Released buffers of the idle device.");
+  return 0;
+}
+
+int device_acquire_buffers(device_t *dev)
+{
+  if (!dev || !dev->released) {
+    return 0;
+  }
+
+  // the device stays released after a failure, and is retried a bit later
+  uint64_t now_us = get_monotonic_time_us(NULL, NULL);
+  if (now_us < dev->acquire_retry_us) {
+    return -1;
+  }
+
+  if (buffer_list_alloc_buffers(dev->output_list) < 0) {
+    LOG_ERROR(dev, "Cannot allocate output buffers.");
+  }
+
+  for (int i = 0; i < dev->n_capture_list; i++) {
+    if (buffer_list_alloc_buffers(dev->capture_lists[i]) < 0) {
+      LOG_ERROR(dev, "Cannot allocate capture buffers.");
+    }
+  }
+
+  if (device_set_stream(dev, true) < 0) {
+    LOG_ERROR(dev, "Cannot resume streaming.");
+  }
+
+  dev->released = false;
+  LOG_INFO(dev, "Acquired buffers for the new consumer.");
+  return 0;
+
+error:
+  device_set_stream(dev, false);
+
+  for (int i = 0; i < dev->n_capture_list; i++) {
+    buffer_list_free_buffers(dev->capture_lists[i]);
+  }
+  buffer_list_free_buffers(dev->output_list);
+
+  dev->acquire_retry_us = now_us + DEVICE_ACQUIRE_RETRY_US;
   return -1;
 }
 
+int device_video_force_key(device_t *dev)
+{
+  if (!dev || !dev->hw->device_video_force_key)
+    return -1;
+
+  uint64_t now = get_monotonic_time_us(NULL, NULL);
+  if (dev->last_force_key_us && now - dev->last_force_key_us < dev->opts.force_key_interval_us) {
+    LOG_DEBUG(dev, "Forced key frame was requested recently, ignoring.");
+    return 0;
+  }
+
+  dev->last_force_key_us = now;
+  return dev->hw->device_video_force_key(dev);
+}
+
 void device_dump_options(device_t *dev, FILE *stream)
 {
   if (dev && dev->hw->device_dump_options) {
@@ -36,6 +36,14 @@ typedef struct device_hw_s {
   int (*buffer_list_set_stream)(buffer_list_t *buf_list, bool do_on);
 } device_hw_t;
 
+typedef struct device_opts_s {
+  bool allow_dma;
+  uint64_t force_key_interval_us;
+  bool lazy; // while paused keep only the latest output frame queued
+  uint64_t release_idle_us; // free the buffers of the M2M device after being paused this long
+  uint64_t idle_interval_us; // frame interval without consumers, 0 pauses the device
+} device_opts_t;
+
 typedef struct device_s {
   char *name;
   char *path;
@@ -46,17 +54,21 @@ typedef struct device_s {
   buffer_list_t **capture_lists;
   buffer_list_t *output_list;
 
-  struct {
-    bool allow_dma;
-  } opts;
+  device_opts_t opts;
 
   union {
     struct device_v4l2_s *v4l2;
     struct device_dummy_s *dummy;
+    struct device_memory_s *memory;
     struct device_libcamera_s *libcamera;
   };
 
   bool paused;
+  bool trickle; // runs at the idle rate without consumers
+  bool released; // buffers are freed while idle
+  uint64_t idle_since_us;
+  uint64_t acquire_retry_us;
+  uint64_t last_force_key_us;
 } device_t;
 
 typedef enum device_option_type_s {
@@ -101,10 +113,13 @@ void device_close(device_t *dev);
 buffer_list_t *device_open_buffer_list(device_t *dev, bool do_capture, buffer_format_t fmt, bool do_mmap);
 buffer_list_t *device_open_buffer_list2(device_t *dev, const char *path, bool do_capture, buffer_format_t fmt, bool do_mmap);
 buffer_list_t *device_open_buffer_list_output(device_t *dev, buffer_list_t *capture_list);
+buffer_list_t *device_open_buffer_list_output2(device_t *dev, buffer_list_t *capture_list, bool allow_dma);
 buffer_list_t *device_open_buffer_list_capture(device_t *dev, const char *path, buffer_list_t *output_list, buffer_format_t fmt, bool do_mmap);
 buffer_list_t *device_open_buffer_list_capture2(device_t *dev, const char *path, buffer_list_t *output_list, unsigned choosen_format, bool do_mmap);
 
 int device_set_stream(device_t *dev, bool do_on);
+int device_release_buffers(device_t *dev);
+int device_acquire_buffers(device_t *dev);
 int device_video_force_key(device_t *dev);
 
 void device_dump_options(device_t *dev, FILE *stream);
@@ -120,3 +135,4 @@ int device_capture_enqueued(device_t *dev, int *max);
 device_t *device_v4l2_open(const char *name, const char *path);
 device_t *device_libcamera_open(const char *name, const char *path);
 device_t *device_dummy_open(const char *name, const char *path);
+device_t *device_memory_open(const char *name, const char *path);
@@ -2,6 +2,7 @@
 
 #include <stddef.h>
 #include <stdlib.h>
+#include <string.h>
 
 bool device_info_has_format(device_info_t *info, bool capture, unsigned format)
 {
@@ -25,11 +26,27 @@ device_info_t *device_list_find_m2m_format(device_list_t *list, unsigned output,
   if (!list)
     return NULL;
 
+  device_info_t *found = NULL;
+
+  // spread the load across identical M2M devices shared by cameras
   for (int i = 0; i < list->ndevices; i++) {
     device_info_t *info = &list->devices[i];
 
     if (info->m2m && device_info_has_format(info, false, output) && device_info_has_format(info, true, capture)) {
-      return info;
+      if (!found || info->users < found->users) {
+        found = info;
+      }
+    }
+  }
+
+  return found;
+}
+
+device_info_t *device_list_find_path(device_list_t *list, const char *path)
+{
+  for (int i = 0; list && path && i < list->ndevices; i++) {
+    if (!strcmp(list->devices[i].path, path)) {
+      return &list->devices[i];
     }
   }
 
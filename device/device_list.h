@@ -13,6 +13,12 @@ typedef struct device_info_s {
 
   bool camera;
   bool m2m;
+  int users; // opened by running cameras
+
+  // identifies the node in the probe cache
+  char bus_info[32];
+  unsigned version;
+  unsigned capabilities;
 
   device_info_formats_t output_formats;
   device_info_formats_t capture_formats;
@@ -23,8 +29,9 @@ typedef struct device_list_s {
   int ndevices;
 } device_list_t;
 
-device_list_t *device_list_v4l2();
+device_list_t *device_list_v4l2(const char *cache_path);
 bool device_info_has_format(device_info_t *info, bool capture, unsigned format);
 device_info_t *device_list_find_m2m_format(device_list_t *list, unsigned output, unsigned capture);
 device_info_t *device_list_find_m2m_formats(device_list_t *list, unsigned output, unsigned capture_formats[], unsigned *found_format);
+device_info_t *device_list_find_path(device_list_t *list, const char *path);
 void device_list_free(device_list_t *list);
@@ -42,14 +42,18 @@ static bool link_needs_buffer_by_callbacks(link_t *link)
   return needs;
 }
 
-static bool link_needs_buffer_by_sinks(link_t *link)
+static bool link_needs_buffer_by_sinks(link_t *link, bool *trickle)
 {
   bool needs = false;
 
   for (int j = 0; j < link->n_output_lists; j++) {
     buffer_list_t *output_list = link->output_lists[j];
 
-    if (!output_list->dev->paused) {
+    if (output_list->dev->paused) {
+      continue;
+    } else if (output_list->dev->trickle) {
+      *trickle = true;
+    } else {
       needs = true;
     }
   }
@@ -64,6 +68,32 @@ static int links_count(link_t *all_links)
   return n;
 }
 
+static void links_release_idle(link_t *link, bool paused)
+{
+  device_t *dev = link->capture_list->dev;
+  uint64_t now_us = get_monotonic_time_us(NULL, NULL);
+
+  if (!paused) {
+    dev->idle_since_us = 0;
+    return;
+  } else if (!dev->idle_since_us) {
+    dev->idle_since_us = now_us;
+  }
+
+  if (!dev->opts.release_idle_us || dev->released || now_us - dev->idle_since_us < dev->opts.release_idle_us) {
+    return;
+  }
+
+  // the outputs keep the last frame, which would hold the buffers
+  for (int j = 0; j < link->n_callbacks; j++) {
+    if (link->callbacks[j].buf_lock) {
+      buffer_lock_capture(link->callbacks[j].buf_lock, NULL);
+    }
+  }
+
+  device_release_buffers(dev);
+}
+
 static void links_process_paused(link_t *all_links, bool force_active)
 {
   // This traverses in reverse order as it requires to first fix outputs
@@ -74,6 +104,7 @@ static void links_process_paused(link_t *all_links, bool force_active)
     buffer_list_t *capture_list = link->capture_list;
 
     bool paused = true;
+    bool trickle = false;
 
     if (force_active) {
       paused = false;
@@ -83,11 +114,23 @@ static void links_process_paused(link_t *all_links, bool force_active)
       paused = false;
     }
 
-    if (link_needs_buffer_by_sinks(link)) {
+    if (link_needs_buffer_by_sinks(link, &trickle)) {
       paused = false;
     }
 
+    // without consumers the capture branch runs slowly to keep a recent frame
+    trickle = paused && (trickle || capture_list->dev->opts.idle_interval_us > 0);
+    if (trickle) {
+      paused = false;
+    }
+    capture_list->dev->trickle = trickle;
+
+    if (!paused && device_acquire_buffers(capture_list->dev) < 0) {
+      paused = true;
+    }
+
     capture_list->dev->paused = paused;
+    links_release_idle(link, paused);
   }
 }
 
@@ -95,6 +138,11 @@ static bool links_enqueue_capture_buffers(buffer_list_t *capture_list, int *time
 {
   buffer_t *capture_buf = NULL;
   uint64_t now_us = get_monotonic_time_us(NULL, NULL);
+  uint64_t interval_us = capture_list->fmt.interval_us;
+
+  if (capture_list->dev->trickle) {
+    interval_us = MAX(interval_us, capture_list->dev->opts.idle_interval_us);
+  }
 
   if (now_us - capture_list->last_enqueued_us > STALE_TIMEOUT_US && capture_list->dev->output_list == NULL) {
     LOG_INFO(capture_list, "Stale detected. Restarting streaming...");
@@ -108,20 +156,20 @@ static bool links_enqueue_capture_buffers(buffer_list_t *capture_list, int *time
     return false;
 
   // skip if trying to enqueue to fast
-  if (capture_list->fmt.interval_us > 0 && now_us - capture_list->last_enqueued_us < capture_list->fmt.interval_us) {
-    *timeout_next_ms = MIN(*timeout_next_ms, (capture_list->last_enqueued_us + capture_list->fmt.interval_us - now_us) / 1000);
+  if (interval_us > 0 && now_us - capture_list->last_enqueued_us < interval_us) {
+    *timeout_next_ms = MIN(*timeout_next_ms, (capture_list->last_enqueued_us + interval_us - now_us) / 1000);
 
     LOG_DEBUG(capture_list, "skipping dequeue: %.1f / %.1f. enqueued=%d",
       (now_us - capture_list->last_enqueued_us) / 1000.0f,
-      capture_list->fmt.interval_us / 1000.0f,
+      interval_us / 1000.0f,
       buffer_list_count_enqueued(capture_list));
     return false;
   }
 
-  if (capture_list->fmt.interval_us > 0) {
+  if (interval_us > 0) {
     LOG_DEBUG(capture_list, "since last: %.1f / %.1f. enqueued=%d",
       (now_us - capture_list->last_enqueued_us) / 1000.0f,
-      capture_list->fmt.interval_us / 1000.0f,
+      interval_us / 1000.0f,
       buffer_list_count_enqueued(capture_list));
   }
 
@@ -136,7 +184,7 @@ static bool links_enqueue_capture_buffers(buffer_list_t *capture_list, int *time
     }
     
     buffer_consumed(capture_buf, "enqueued");
-    if (capture_list->fmt.interval_us > 0)
+    if (interval_us > 0)
       return false;
     return true;
   }
@@ -159,7 +207,7 @@ static bool links_enqueue_capture_buffers(buffer_list_t *capture_list, int *time
     // then push a capture from source into output for this capture
     if (buffer_list_enqueue(output_list, queued_capture_for_output_buf)) {
       buffer_consumed(capture_buf, "enqueued");
-      if (capture_list->fmt.interval_us <= 0)
+      if (interval_us <= 0)
         can_enqueue = true;
     } else {
       queued_capture_for_output_buf->buf_list->stats.dropped++;
@@ -264,7 +312,11 @@ static int links_enqueue_from_capture_list(buffer_list_t *capture_list, link_t *
 
   for (int j = 0; j < link->n_output_lists; j++) {
     if (link->output_lists[j]->dev->paused) {
-      continue;
+      if (!link->output_lists[j]->dev->opts.lazy) {
+        continue;
+      }
+      // retain only the latest frame, it is encoded once the device gets resumed
+      buffer_list_clear_queue(link->output_lists[j]);
     }
     if (buf->flags.is_keyframe) {
       buffer_list_clear_queue(link->output_lists[j]);
@@ -434,7 +486,7 @@ static void links_refresh_stats(link_t *all_links, uint64_t *last_refresh_us)
         // (float)(now->max_dequeued_us / 1000),
         // (float)(now->avg_dequeued_us / 1000),
         (float)(now->stddev_dequeued_us / 1000),
-        capture_list->streaming ? (capture_list->dev->paused ? 'P' : 'S') : 'X',
+        capture_list->dev->released ? 'R' : capture_list->dev->trickle ? 'T' : capture_list->streaming ? (capture_list->dev->paused ? 'P' : 'S') : 'X',
         capture_list->dev->output_list ? capture_list->dev->output_list->n_queued_bufs : 0,
         capture_list->dev->output_list ? buffer_list_count_enqueued(capture_list->dev->output_list) : 0,
         buffer_list_count_enqueued(capture_list)
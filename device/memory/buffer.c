@@ -0,0 +1,94 @@
+#include "memory.h"
+#include "device/buffer.h"
+#include "device/buffer_list.h"
+#include "util/opts/log.h"
+
+#include <stdlib.h>
+
+int memory_buffer_open(buffer_t *buf)
+{
+  buf->memory = calloc(1, sizeof(buffer_memory_t));
+  buf->length = buf->buf_list->fmt.sizeimage;
+  buf->start = buf->length ? malloc(buf->length) : NULL;
+  if (buf->length && !buf->start) {
+    LOG_ERROR(buf, "Can't allocate %zu bytes.", buf->length);
+  }
+  return 0;
+
+error:
+  return -1;
+}
+
+void memory_buffer_close(buffer_t *buf)
+{
+  free(buf->start);
+  free(buf->memory);
+}
+
+int memory_buffer_reserve(buffer_t *buf, size_t length)
+{
+  if (length <= buf->length) {
+    return 0;
+  }
+
+  void *start = realloc(buf->start, length);
+  if (!start) {
+    LOG_ERROR(buf, "Can't reallocate to %zu bytes.", length);
+  }
+
+  buf->start = start;
+  buf->length = length;
+  return 0;
+
+error:
+  return -1;
+}
+
+int memory_buffer_enqueue(buffer_t *buf, const char *who)
+{
+  unsigned index = buf->index;
+
+  if (buf->buf_list->memory->release_idle) {
+    free(buf->start);
+    buf->start = NULL;
+    buf->length = 0;
+  }
+
+  if (write(buf->buf_list->memory->fds[1], &index, sizeof(index)) != sizeof(index)) {
+    return -1;
+  }
+  return 0;
+}
+
+int memory_buffer_list_dequeue(buffer_list_t *buf_list, buffer_t **bufp)
+{
+  unsigned index = 0;
+  int n = read(buf_list->memory->fds[0], &index, sizeof(index));
+  if (n < 0 && errno == EAGAIN) {
+    return -1;
+  } else if (n != sizeof(index)) {
+    LOG_INFO(buf_list, "Received invalid result from `read`: %d", n);
+    return -1;
+  }
+
+  if (index >= (unsigned)buf_list->nbufs) {
+    LOG_INFO(buf_list, "Received invalid index from `read`: %d >= %d", index, buf_list->nbufs);
+    return -1;
+  }
+
+  *bufp = buf_list->bufs[index];
+  (*bufp)->used = 0;
+  return 0;
+}
+
+int memory_buffer_list_pollfd(buffer_list_t *buf_list, struct pollfd *pollfd, bool can_dequeue)
+{
+  int count_enqueued = buffer_list_count_enqueued(buf_list);
+  pollfd->fd = buf_list->memory->fds[0];
+  pollfd->events = POLLHUP;
+  if (can_dequeue && count_enqueued > 0) {
+    pollfd->events |= POLLIN;
+  }
+  pollfd->revents = 0;
+  return 0;
+}
@@ -0,0 +1,62 @@
+#include "memory.h"
+#include "device/buffer.h"
+#include "device/buffer_list.h"
+#include "device/device.h"
+#include "util/opts/log.h"
+
+#include <stdlib.h>
+#include <fcntl.h>
+
+int memory_buffer_list_open(buffer_list_t *buf_list)
+{
+  buf_list->memory = calloc(1, sizeof(buffer_list_memory_t));
+  buf_list->memory->fds[0] = -1;
+  buf_list->memory->fds[1] = -1;
+
+  if (!buf_list->do_capture) {
+    LOG_ERROR(buf_list, "Only capture mode supported");
+  }
+
+  if (pipe2(buf_list->memory->fds, O_DIRECT|O_CLOEXEC|O_NONBLOCK) < 0) {
+    LOG_ERROR(buf_list, "Cannot open `pipe2`.");
+  }
+
+  // every index is written as a separate packet, taking a page of the pipe
+  if (fcntl(buf_list->memory->fds[1], F_GETPIPE_SZ) < buf_list->fmt.nbufs * getpagesize() &&
+    fcntl(buf_list->memory->fds[1], F_SETPIPE_SZ, buf_list->fmt.nbufs * getpagesize()) < 0) {
+    LOG_ERROR(buf_list, "Cannot resize `pipe2` for %d buffers.", buf_list->fmt.nbufs);
+  }
+
+  return buf_list->fmt.nbufs;
+
+error:
+  return -1;
+}
+
+void memory_buffer_list_close(buffer_list_t *buf_list)
+{
+  if (buf_list->memory) {
+    close(buf_list->memory->fds[0]);
+    close(buf_list->memory->fds[1]);
+  }
+
+  free(buf_list->memory);
+}
+
+int memory_buffer_list_set_stream(buffer_list_t *buf_list, bool do_on)
+{
+  if (!do_on) {
+    return 0;
+  }
+
+  // hand all idle buffers to the queue, so they can be dequeued
+  for (int i = 0; i < buf_list->nbufs; i++) {
+    buffer_t *buf = buf_list->bufs[i];
+
+    if (!buf->enqueued && buf->mmap_reflinks == 1) {
+      buffer_consumed(buf, "stream-on");
+    }
+  }
+
+  return 0;
+}
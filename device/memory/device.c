@@ -0,0 +1,21 @@
+#include "memory.h"
+#include "device/device.h"
+
+#include <stdlib.h>
+
+int memory_device_open(device_t *dev)
+{
+  dev->opts.allow_dma = false;
+  dev->memory = calloc(1, sizeof(device_memory_t));
+  return 0;
+}
+
+void memory_device_close(device_t *dev)
+{
+  free(dev->memory);
+}
+
+int memory_device_video_force_key(device_t *dev)
+{
+  return device_video_force_key(dev->memory->source);
+}
@@ -0,0 +1,24 @@
+#include "memory.h"
+
+#include "device/device.h"
+
+device_hw_t memory_device_hw = {
+  .device_open = memory_device_open,
+  .device_close = memory_device_close,
+  .device_video_force_key = memory_device_video_force_key,
+
+  .buffer_open = memory_buffer_open,
+  .buffer_close = memory_buffer_close,
+  .buffer_enqueue = memory_buffer_enqueue,
+
+  .buffer_list_dequeue = memory_buffer_list_dequeue,
+  .buffer_list_pollfd = memory_buffer_list_pollfd,
+  .buffer_list_open = memory_buffer_list_open,
+  .buffer_list_close = memory_buffer_list_close,
+  .buffer_list_set_stream = memory_buffer_list_set_stream
+};
+
+device_t *device_memory_open(const char *name, const char *path)
+{
+  return device_open(name, path, &memory_device_hw);
+}
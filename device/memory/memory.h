@@ -0,0 +1,38 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <unistd.h>
+
+typedef struct buffer_s buffer_t;
+typedef struct buffer_list_s buffer_list_t;
+typedef struct device_s device_t;
+struct pollfd;
+
+typedef struct device_memory_s {
+  device_t *source; // the buffers are copies of its frames
+} device_memory_t;
+
+typedef struct buffer_list_memory_s {
+  int fds[2];
+  bool release_idle; // free the memory of buffers returned to the list
+} buffer_list_memory_t;
+
+typedef struct buffer_memory_s {
+} buffer_memory_t;
+
+int memory_device_open(device_t *dev);
+void memory_device_close(device_t *dev);
+int memory_device_video_force_key(device_t *dev);
+
+int memory_buffer_open(buffer_t *buf);
+void memory_buffer_close(buffer_t *buf);
+int memory_buffer_enqueue(buffer_t *buf, const char *who);
+int memory_buffer_list_dequeue(buffer_list_t *buf_list, buffer_t **bufp);
+int memory_buffer_list_pollfd(buffer_list_t *buf_list, struct pollfd *pollfd, bool can_dequeue);
+
+int memory_buffer_list_open(buffer_list_t *buf_list);
+void memory_buffer_list_close(buffer_list_t *buf_list);
+int memory_buffer_list_set_stream(buffer_list_t *buf_list, bool do_on);
+
+int memory_buffer_reserve(buffer_t *buf, size_t length);
@@ -60,10 +60,17 @@ int v4l2_buffer_list_open(buffer_list_t *buf_list)
 
   buffer_format_t fmt = buf_list->fmt;
   unsigned block_width = 1, block_height = 1;
+  unsigned requested_width = fmt.width, requested_height = fmt.height;
 
   LOG_DEBUG(buf_list, "Get current format ...");
   ERR_IOCTL(buf_list, buf_list->v4l2->dev_fd, VIDIOC_G_FMT, &v4l2_fmt, "Can't get format");
 
+  // skip the attempt known to fail from the previous start
+  if (fmt.bytesperline && v4l2_probe_cache_shrink(dev->bus_info, buf_list->v4l2->type, fmt.format, fmt.width, fmt.height)) {
+    block_width = 32;
+    block_height = 32;
+  }
+
 retry_resolution_set:
 
   if (block_width > 1 || block_height > 1) {
@@ -140,6 +147,11 @@ retry_resolution_set:
     }
   }
 
+  if (block_height > 1) {
+    v4l2_probe_cache_add_shrink(dev->bus_info, buf_list->v4l2->type, fmt.format,
+      requested_width, requested_height);
+  }
+
 	if (fmt.format && buf_list->fmt.format != fmt.format) {
 		LOG_ERROR(buf_list, "Could not obtain the requested format=%s; driver gave us %s",
 			fourcc_to_string(fmt.format).buf,
@@ -204,6 +216,37 @@ error:
   return -1;
 }
 
+int v4l2_buffer_list_alloc_buffers(buffer_list_t *buf_list)
+{
+	struct v4l2_requestbuffers v4l2_req = {0};
+	v4l2_req.count = buf_list->fmt.nbufs;
+	v4l2_req.type = buf_list->v4l2->type;
+	v4l2_req.memory = buf_list->do_mmap ? V4L2_MEMORY_MMAP : V4L2_MEMORY_DMABUF;
+
+	ERR_IOCTL(buf_list, buf_list->v4l2->dev_fd, VIDIOC_REQBUFS, &v4l2_req, "Can't request buffers");
+	if (v4l2_req.count < 1) {
+		LOG_ERROR(buf_list, "Insufficient buffer memory: %u", v4l2_req.count);
+	}
+
+  return v4l2_req.count;
+
+error:
+  return -1;
+}
+
+void v4l2_buffer_list_free_buffers(buffer_list_t *buf_list)
+{
+	struct v4l2_requestbuffers v4l2_req = {0};
+	v4l2_req.count = 0;
+	v4l2_req.type = buf_list->v4l2->type;
+	v4l2_req.memory = buf_list->do_mmap ? V4L2_MEMORY_MMAP : V4L2_MEMORY_DMABUF;
+
+  // the driver keeps the memory of the buffers until these are released
+  if (ioctl_retried(dev_name(buf_list), buf_list->v4l2->dev_fd, VIDIOC_REQBUFS, &v4l2_req) < 0) {
+    LOG_DEBUG(buf_list, "Can't release buffers: errno=%d", errno);
+  }
+}
+
 void v4l2_buffer_list_close(buffer_list_t *buf_list) {
   if (!buf_list->v4l2)
     return;
@@ -6,6 +6,7 @@
 #include <stdlib.h>
 #include <unistd.h>
 #include <dirent.h>
+#include <pthread.h>
 
 static void device_list_read_formats(int fd, device_info_formats_t *formats, enum v4l2_buf_type buf_type)
 {
@@ -25,7 +26,20 @@ static void device_list_read_formats(int fd, device_info_formats_t *formats, enu
   }
 }
 
-static bool device_list_read_dev(device_info_t *info, const char *name)
+#define DEVICE_LIST_MAX_NODES 64
+#define DEVICE_LIST_PROBE_THREADS 8
+
+typedef struct device_list_probe_s {
+  pthread_mutex_t lock;
+  char *names[DEVICE_LIST_MAX_NODES];
+  device_info_t infos[DEVICE_LIST_MAX_NODES];
+  bool found[DEVICE_LIST_MAX_NODES];
+  int nnames;
+  int next;
+  bool changed;
+} device_list_probe_t;
+
+static bool device_list_read_dev(device_info_t *info, const char *name, bool *cached)
 {
   asprintf(&info->path, "/dev/%s", name);
 
@@ -37,6 +51,9 @@ static bool device_list_read_dev(device_info_t *info, const char *name)
   struct v4l2_capability v4l2_cap;
   ERR_IOCTL(info, fd, VIDIOC_QUERYCAP, &v4l2_cap, "Can't query device capabilities");
   info->name = strdup((const char *)v4l2_cap.card);
+  snprintf(info->bus_info, sizeof(info->bus_info), "%s", (const char *)v4l2_cap.bus_info);
+  info->version = v4l2_cap.version;
+  info->capabilities = v4l2_cap.capabilities;
 
   if (!(v4l2_cap.capabilities & V4L2_CAP_STREAMING)) {
     LOG_VERBOSE(info, "Device (%s) does not support streaming (skipping)", info->path);
@@ -53,10 +70,15 @@ static bool device_list_read_dev(device_info_t *info, const char *name)
     info->m2m = true;
   }
 
-  device_list_read_formats(fd, &info->capture_formats, V4L2_BUF_TYPE_VIDEO_CAPTURE);
-  device_list_read_formats(fd, &info->capture_formats, V4L2_BUF_TYPE_VIDEO_CAPTURE_MPLANE);
-  device_list_read_formats(fd, &info->output_formats, V4L2_BUF_TYPE_VIDEO_OUTPUT);
-  device_list_read_formats(fd, &info->output_formats, V4L2_BUF_TYPE_VIDEO_OUTPUT_MPLANE);
+  // the formats of the same node and driver are read from the probe cache
+  *cached = v4l2_probe_cache_find(info);
+
+  if (!*cached) {
+    device_list_read_formats(fd, &info->capture_formats, V4L2_BUF_TYPE_VIDEO_CAPTURE);
+    device_list_read_formats(fd, &info->capture_formats, V4L2_BUF_TYPE_VIDEO_CAPTURE_MPLANE);
+    device_list_read_formats(fd, &info->output_formats, V4L2_BUF_TYPE_VIDEO_OUTPUT);
+    device_list_read_formats(fd, &info->output_formats, V4L2_BUF_TYPE_VIDEO_OUTPUT_MPLANE);
+  }
   close(fd);
 
   return true;
@@ -64,34 +86,101 @@ static bool device_list_read_dev(device_info_t *info, const char *name)
 error:
   free(info->name);
   free(info->path);
-  close(fd);
+  if (fd >= 0) {
+    close(fd);
+  }
   return false;
 }
 
-device_list_t *device_list_v4l2()
+static void *device_list_probe_thread(void *opaque)
+{
+  device_list_probe_t *probe = opaque;
+
+  while (true) {
+    pthread_mutex_lock(&probe->lock);
+    int i = probe->next++;
+    pthread_mutex_unlock(&probe->lock);
+
+    if (i >= probe->nnames) {
+      break;
+    }
+
+    bool cached = false;
+    probe->found[i] = device_list_read_dev(&probe->infos[i], probe->names[i], &cached);
+
+    if (probe->found[i] && !cached) {
+      pthread_mutex_lock(&probe->lock);
+      probe->changed = true;
+      pthread_mutex_unlock(&probe->lock);
+    }
+  }
+
+  return NULL;
+}
+
+static int device_list_compare_names(const void *a, const void *b)
+{
+  return strverscmp(*(char * const *)a, *(char * const *)b);
+}
+
+device_list_t *device_list_v4l2(const char *cache_path)
 {
   DIR *dev = opendir("/dev");
   if (!dev) {
     return NULL;
   }
 
-  device_list_t *list = calloc(1, sizeof(device_list_t));
+  device_list_probe_t *probe = calloc(1, sizeof(device_list_probe_t));
+  pthread_t threads[DEVICE_LIST_PROBE_THREADS];
+  int nthreads = 0;
   struct dirent *ent;
 
-  while ((ent = readdir(dev)) != NULL) {
+  pthread_mutex_init(&probe->lock, NULL);
+
+  while ((ent = readdir(dev)) != NULL && probe->nnames < DEVICE_LIST_MAX_NODES) {
     if (strstr(ent->d_name, "video") != ent->d_name) {
       continue;
     }
 
-    device_info_t info = {NULL};
-    if (device_list_read_dev(&info, ent->d_name)) {
+    probe->names[probe->nnames++] = strdup(ent->d_name);
+  }
+
+  closedir(dev);
+
+  qsort(probe->names, probe->nnames, sizeof(probe->names[0]), device_list_compare_names);
+
+  v4l2_probe_cache_load(cache_path);
+
+  // opening the nodes takes most of the time, as the drivers are loaded on demand
+  for ( ; nthreads < DEVICE_LIST_PROBE_THREADS && nthreads < probe->nnames; nthreads++) {
+    if (pthread_create(&threads[nthreads], NULL, device_list_probe_thread, probe) != 0) {
+      break;
+    }
+  }
+
+  // probe in this thread too, in case no thread could be created
+  device_list_probe_thread(probe);
+
+  for (int i = 0; i < nthreads; i++) {
+    pthread_join(threads[i], NULL);
+  }
+
+  device_list_t *list = calloc(1, sizeof(device_list_t));
+
+  for (int i = 0; i < probe->nnames; i++) {
+    if (probe->found[i]) {
       list->ndevices++;
-      list->devices = realloc(list->devices, sizeof(info) * list->ndevices);
-      list->devices[list->ndevices-1] = info;
+      list->devices = realloc(list->devices, sizeof(device_info_t) * list->ndevices);
+      list->devices[list->ndevices-1] = probe->infos[i];
     }
+    free(probe->names[i]);
   }
 
-  closedir(dev);
+  if (probe->changed) {
+    v4l2_probe_cache_save(list);
+  }
 
+  pthread_mutex_destroy(&probe->lock);
+  free(probe);
   return list;
 }
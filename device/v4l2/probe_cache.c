@@ -0,0 +1,297 @@
+#include "v4l2.h"
+#include "device/device_list.h"
+#include "device/buffer_list.h"
+#include "util/opts/log.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+#define PROBE_CACHE_HEADER "# camera-streamer probe cache v1"
+#define PROBE_CACHE_MAX_SHRINKS 32
+
+typedef struct probe_cache_shrink_s {
+  char bus_info[32];
+  unsigned type, format, width, height;
+} probe_cache_shrink_t;
+
+static struct {
+  char path[256];
+  device_list_t devices;
+  probe_cache_shrink_t shrinks[PROBE_CACHE_MAX_SHRINKS];
+  int nshrinks;
+} probe_cache;
+
+static pthread_mutex_t probe_cache_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static void probe_cache_parse_formats(char *value, device_info_formats_t *formats)
+{
+  char *saveptr = NULL;
+
+  for (char *token = strtok_r(value, ",", &saveptr); token; token = strtok_r(NULL, ",", &saveptr)) {
+    if (!strcmp(token, "-")) {
+      continue;
+    }
+
+    formats->n++;
+    formats->formats = realloc(formats->formats, sizeof(formats->formats[0]) * formats->n);
+    formats->formats[formats->n - 1] = strtoul(token, NULL, 16);
+  }
+}
+
+static void probe_cache_write_formats(FILE *fp, device_info_formats_t *formats)
+{
+  if (!formats->n) {
+    fprintf(fp, "-");
+  }
+
+  for (int i = 0; i < formats->n; i++) {
+    fprintf(fp, "%s%08x", i ? "," : "", formats->formats[i]);
+  }
+}
+
+// device <path> <bus_info> <version> <capabilities> <capture formats> <output formats>
+static void probe_cache_parse_device(char *line)
+{
+  char *fields[7] = {0};
+  char *saveptr = NULL;
+  int n = 0;
+
+  for (char *token = strtok_r(line, "\t\n", &saveptr); token && n < 7; token = strtok_r(NULL, "\t\n", &saveptr)) {
+    fields[n++] = token;
+  }
+
+  if (n != 7) {
+    return;
+  }
+
+  device_list_t *list = &probe_cache.devices;
+  list->ndevices++;
+  list->devices = realloc(list->devices, sizeof(device_info_t) * list->ndevices);
+
+  device_info_t *info = &list->devices[list->ndevices - 1];
+  memset(info, 0, sizeof(*info));
+  info->path = strdup(fields[1]);
+  snprintf(info->bus_info, sizeof(info->bus_info), "%s", fields[2]);
+  info->version = strtoul(fields[3], NULL, 16);
+  info->capabilities = strtoul(fields[4], NULL, 16);
+  probe_cache_parse_formats(fields[5], &info->capture_formats);
+  probe_cache_parse_formats(fields[6], &info->output_formats);
+}
+
+// shrink <bus_info> <type> <format> <width> <height>
+static void probe_cache_parse_shrink(char *line)
+{
+  probe_cache_shrink_t shrink = {0};
+
+  if (probe_cache.nshrinks >= PROBE_CACHE_MAX_SHRINKS) {
+    return;
+  }
+
+  if (sscanf(line, "shrink\t%31s\t%u\t%x\t%u\t%u", shrink.bus_info,
+    &shrink.type, &shrink.format, &shrink.width, &shrink.height) == 5) {
+    probe_cache.shrinks[probe_cache.nshrinks++] = shrink;
+  }
+}
+
+static void probe_cache_clear()
+{
+  for (int i = 0; i < probe_cache.devices.ndevices; i++) {
+    device_info_t *info = &probe_cache.devices.devices[i];
+    free(info->path);
+    free(info->output_formats.formats);
+    free(info->capture_formats.formats);
+  }
+  free(probe_cache.devices.devices);
+  probe_cache.devices.devices = NULL;
+  probe_cache.devices.ndevices = 0;
+  probe_cache.nshrinks = 0;
+}
+
+void v4l2_probe_cache_load(const char *path)
+{
+  char line[1024];
+
+  pthread_mutex_lock(&probe_cache_lock);
+  probe_cache_clear();
+  snprintf(probe_cache.path, sizeof(probe_cache.path), "%s", path ? path : "");
+
+  FILE *fp = probe_cache.path[0] ? fopen(probe_cache.path, "r") : NULL;
+  if (!fp) {
+    goto error;
+  }
+
+  if (!fgets(line, sizeof(line), fp) || strncmp(line, PROBE_CACHE_HEADER, strlen(PROBE_CACHE_HEADER))) {
+    LOG_INFO(NULL, "Ignoring '%s' written by a different version.", probe_cache.path);
+    goto error;
+  }
+
+  while (fgets(line, sizeof(line), fp)) {
+    if (!strncmp(line, "device\t", 7)) {
+      probe_cache_parse_device(line);
+    } else if (!strncmp(line, "shrink\t", 7)) {
+      probe_cache_parse_shrink(line);
+    }
+  }
+
+error:
+  if (fp) {
+    fclose(fp);
+  }
+  pthread_mutex_unlock(&probe_cache_lock);
+}
+
+static void probe_cache_write(device_list_t *list)
+{
+  // every process writes its own file, as several of them can start at once
+  char tmp_path[sizeof(probe_cache.path) + 8];
+  snprintf(tmp_path, sizeof(tmp_path), "%s.XXXXXX", probe_cache.path);
+
+  int fd = mkstemp(tmp_path);
+  FILE *fp = fd >= 0 ? fdopen(fd, "w") : NULL;
+  if (!fp) {
+    LOG_INFO(NULL, "Cannot write '%s'.", tmp_path);
+    if (fd >= 0) {
+      close(fd);
+      unlink(tmp_path);
+    }
+    return;
+  }
+
+  // `mkstemp()` creates the file readable only by the owner
+  fchmod(fd, 0644);
+
+  fprintf(fp, "%s\n", PROBE_CACHE_HEADER);
+
+  for (int i = 0; i < list->ndevices; i++) {
+    device_info_t *info = &list->devices[i];
+
+    fprintf(fp, "device\t%s\t%s\t%08x\t%08x\t", info->path,
+      info->bus_info[0] ? info->bus_info : "-", info->version, info->capabilities);
+    probe_cache_write_formats(fp, &info->capture_formats);
+    fprintf(fp, "\t");
+    probe_cache_write_formats(fp, &info->output_formats);
+    fprintf(fp, "\n");
+  }
+
+  for (int i = 0; i < probe_cache.nshrinks; i++) {
+    probe_cache_shrink_t *shrink = &probe_cache.shrinks[i];
+    fprintf(fp, "shrink\t%s\t%u\t%08x\t%u\t%u\n", shrink->bus_info,
+      shrink->type, shrink->format, shrink->width, shrink->height);
+  }
+
+  if (fclose(fp) != 0) {
+    LOG_INFO(NULL, "Cannot write '%s'.", tmp_path);
+    unlink(tmp_path);
+    return;
+  }
+
+  // replace atomically, readers never see a partially written file
+  if (rename(tmp_path, probe_cache.path) < 0) {
+    LOG_INFO(NULL, "Cannot replace '%s'.", probe_cache.path);
+    unlink(tmp_path);
+  }
+}
+
+void v4l2_probe_cache_save(device_list_t *list)
+{
+  pthread_mutex_lock(&probe_cache_lock);
+  if (probe_cache.path[0]) {
+    probe_cache_write(list);
+
+    // keep the saved devices for the later shrink hints
+    probe_cache_shrink_t shrinks[PROBE_CACHE_MAX_SHRINKS];
+    int nshrinks = probe_cache.nshrinks;
+    memcpy(shrinks, probe_cache.shrinks, sizeof(shrinks));
+    probe_cache_clear();
+    memcpy(probe_cache.shrinks, shrinks, sizeof(shrinks));
+    probe_cache.nshrinks = nshrinks;
+
+    for (int i = 0; i < list->ndevices; i++) {
+      device_info_t info = list->devices[i];
+      info.name = NULL;
+      info.path = strdup(info.path);
+      info.capture_formats.formats = malloc(sizeof(unsigned) * (info.capture_formats.n + 1));
+      memcpy(info.capture_formats.formats, list->devices[i].capture_formats.formats, sizeof(unsigned) * info.capture_formats.n);
+      info.output_formats.formats = malloc(sizeof(unsigned) * (info.output_formats.n + 1));
+      memcpy(info.output_formats.formats, list->devices[i].output_formats.formats, sizeof(unsigned) * info.output_formats.n);
+
+      probe_cache.devices.ndevices++;
+      probe_cache.devices.devices = realloc(probe_cache.devices.devices, sizeof(info) * probe_cache.devices.ndevices);
+      probe_cache.devices.devices[probe_cache.devices.ndevices - 1] = info;
+    }
+  }
+  pthread_mutex_unlock(&probe_cache_lock);
+}
+
+static void probe_cache_copy_formats(device_info_formats_t *dst, device_info_formats_t *src)
+{
+  dst->n = src->n;
+  dst->formats = malloc(sizeof(unsigned) * (src->n + 1));
+  memcpy(dst->formats, src->formats, sizeof(unsigned) * src->n);
+}
+
+bool v4l2_probe_cache_find(device_info_t *info)
+{
+  bool found = false;
+
+  pthread_mutex_lock(&probe_cache_lock);
+  for (int i = 0; i < probe_cache.devices.ndevices; i++) {
+    device_info_t *cached = &probe_cache.devices.devices[i];
+
+    // the node is the same device, with the same driver
+    if (!strcmp(cached->path, info->path) &&
+      !strcmp(cached->bus_info, info->bus_info[0] ? info->bus_info : "-") &&
+      cached->version == info->version &&
+      cached->capabilities == info->capabilities) {
+      probe_cache_copy_formats(&info->capture_formats, &cached->capture_formats);
+      probe_cache_copy_formats(&info->output_formats, &cached->output_formats);
+      found = true;
+      break;
+    }
+  }
+  pthread_mutex_unlock(&probe_cache_lock);
+
+  return found;
+}
+
+bool v4l2_probe_cache_shrink(const char *bus_info, unsigned type, unsigned format, unsigned width, unsigned height)
+{
+  bool found = false;
+
+  pthread_mutex_lock(&probe_cache_lock);
+  for (int i = 0; i < probe_cache.nshrinks; i++) {
+    probe_cache_shrink_t *shrink = &probe_cache.shrinks[i];
+
+    if (!strcmp(shrink->bus_info, bus_info) && shrink->type == type &&
+      shrink->format == format && shrink->width == width && shrink->height == height) {
+      found = true;
+      break;
+    }
+  }
+  pthread_mutex_unlock(&probe_cache_lock);
+
+  return found;
+}
+
+void v4l2_probe_cache_add_shrink(const char *bus_info, unsigned type, unsigned format, unsigned width, unsigned height)
+{
+  if (!bus_info[0] || v4l2_probe_cache_shrink(bus_info, type, format, width, height)) {
+    return;
+  }
+
+  pthread_mutex_lock(&probe_cache_lock);
+  if (probe_cache.path[0] && probe_cache.nshrinks < PROBE_CACHE_MAX_SHRINKS) {
+    probe_cache_shrink_t *shrink = &probe_cache.shrinks[probe_cache.nshrinks++];
+    snprintf(shrink->bus_info, sizeof(shrink->bus_info), "%s", bus_info);
+    shrink->type = type;
+    shrink->format = format;
+    shrink->width = width;
+    shrink->height = height;
+    probe_cache_write(&probe_cache.devices);
+  }
+  pthread_mutex_unlock(&probe_cache_lock);
+}
@@ -18,7 +18,9 @@ device_hw_t v4l2_device_hw = {
   .buffer_list_pollfd = v4l2_buffer_list_pollfd,
   .buffer_list_open = v4l2_buffer_list_open,
   .buffer_list_close = v4l2_buffer_list_close,
-  .buffer_list_set_stream = v4l2_buffer_list_set_stream
+  .buffer_list_set_stream = v4l2_buffer_list_set_stream,
+  .buffer_list_alloc_buffers = v4l2_buffer_list_alloc_buffers,
+  .buffer_list_free_buffers = v4l2_buffer_list_free_buffers
 };
 
 device_t *device_v4l2_open(const char *name, const char *path)
@@ -11,6 +11,8 @@ typedef struct buffer_s buffer_t;
 typedef struct buffer_list_s buffer_list_t;
 typedef struct device_option_s device_option_t;
 typedef struct device_s device_t;
+typedef struct device_info_s device_info_t;
+typedef struct device_list_s device_list_t;
 struct pollfd;
 
 typedef int device_option_fn(device_option_t *option, void *opaque);
@@ -55,6 +57,14 @@ int v4l2_buffer_list_pollfd(buffer_list_t *buf_list, struct pollfd *pollfd, bool
 int v4l2_buffer_list_open(buffer_list_t *buf_list);
 void v4l2_buffer_list_close(buffer_list_t *buf_list);
 int v4l2_buffer_list_set_stream(buffer_list_t *buf_list, bool do_on);
+int v4l2_buffer_list_alloc_buffers(buffer_list_t *buf_list);
+void v4l2_buffer_list_free_buffers(buffer_list_t *buf_list);
+
+void v4l2_probe_cache_load(const char *path);
+void v4l2_probe_cache_save(device_list_t *list);
+bool v4l2_probe_cache_find(device_info_t *info);
+bool v4l2_probe_cache_shrink(const char *bus_info, unsigned type, unsigned format, unsigned width, unsigned height);
+void v4l2_probe_cache_add_shrink(const char *bus_info, unsigned type, unsigned format, unsigned width, unsigned height);
 
 int v4l2_device_open_media_device(device_t *dev);
 int v4l2_device_open_v4l2_subdev(device_t *dev, int subdev);
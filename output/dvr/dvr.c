@@ -0,0 +1,441 @@
+#include "dvr.h"
+
+#include "util/opts/log.h"
+#include "util/http/http.h"
+#include "util/h264/h264.h"
+#include "util/mp4/muxer.h"
+#include "device/buffer.h"
+#include "device/buffer_lock.h"
+#include "device/buffer_list.h"
+#include "device/device.h"
+#include "output/output.h"
+
+#include <inttypes.h>
+#include <time.h>
+
+#define DVR_MAX_FRAMES 8192
+#define DVR_DEFAULT_PRE 10
+#define DVR_DEFAULT_POST 30
+#define DVR_MAX_POST 600
+#define DVR_WAIT_TIMEOUT_US (1000 * 1000)
+
+static const char *const DVR_VIDEO_HEADER =
+  "HTTP/1.0 200 OK\r\n"
+  "Access-Control-Allow-Origin: *\r\n"
+  "Connection: close\r\n"
+  "Content-Type: video/mp4\r\n"
+  "\r\n";
+
+typedef struct dvr_frame_s {
+  uint64_t seq;
+  size_t offset, size;
+  uint64_t time_us;
+  bool keyframe;
+} dvr_frame_t;
+
+// frames are copied back-to-back into a fixed arena, wrapping around
+// at its end, and always evicted a whole GOP at a time
+typedef struct dvr_s {
+  const char *name;
+  dvr_options_t *options;
+
+  pthread_mutex_t lock;
+  pthread_cond_t cond_wait;
+
+  uint8_t *arena;
+  size_t arena_size;
+  size_t write_offset;
+
+  dvr_frame_t frames[DVR_MAX_FRAMES];
+  unsigned head, count;
+  uint64_t next_seq;
+  bool wait_for_keyframe;
+  unsigned width, height;
+} dvr_t;
+
+static dvr_t dvr_ring = {
+  .name = "DVR",
+  .lock = PTHREAD_MUTEX_INITIALIZER,
+  .cond_wait = PTHREAD_COND_INITIALIZER,
+};
+
+typedef struct dvr_event_s {
+  const char *name;
+  dvr_t *dvr;
+  FILE *stream;
+  char path[DVR_PATH_LENGTH + 64];
+  uint64_t pre_us, post_us;
+  uint64_t trigger_us;
+  bool wrote_header;
+} dvr_event_t;
+
+static dvr_frame_t *dvr_frame(dvr_t *dvr, unsigned n)
+{
+  return &dvr->frames[(dvr->head + n) % DVR_MAX_FRAMES];
+}
+
+static void dvr_evict_gop(dvr_t *dvr)
+{
+  do {
+    dvr_frame_t *frame = dvr_frame(dvr, 0);
+    dvr->options->used -= frame->size;
+    dvr->head = (dvr->head + 1) % DVR_MAX_FRAMES;
+    dvr->count--;
+  } while (dvr->count > 0 && !dvr_frame(dvr, 0)->keyframe);
+}
+
+static bool dvr_overlaps(dvr_frame_t *frame, size_t offset, size_t size)
+{
+  return frame->offset < offset + size && offset < frame->offset + frame->size;
+}
+
+// keeps at most one GOP older than the configured duration
+static bool dvr_second_gop_expired(dvr_t *dvr, uint64_t now_us)
+{
+  uint64_t limit_us = dvr->options->duration * 1000LL * 1000LL;
+
+  for (unsigned i = 1; i < dvr->count; i++) {
+    dvr_frame_t *frame = dvr_frame(dvr, i);
+    if (frame->keyframe) {
+      return now_us - frame->time_us >= limit_us;
+    }
+  }
+
+  return false;
+}
+
+static void dvr_append(dvr_t *dvr, buffer_t *buf)
+{
+  size_t offset = dvr->write_offset;
+  bool wrapped = false;
+
+  if (offset + buf->used > dvr->arena_size) {
+    offset = 0;
+    wrapped = true;
+  }
+
+  // the tail that is skipped when wrapping holds the oldest frames
+  while (dvr->count > 0) {
+    dvr_frame_t *oldest = dvr_frame(dvr, 0);
+
+    if (dvr_overlaps(oldest, offset, buf->used) || (wrapped && oldest->offset >= dvr->write_offset)) {
+      dvr_evict_gop(dvr);
+    } else if (dvr->count >= DVR_MAX_FRAMES || dvr_second_gop_expired(dvr, buf->captured_time_us)) {
+      dvr_evict_gop(dvr);
+    } else {
+      break;
+    }
+  }
+
+  if (!dvr->count) {
+    offset = 0;
+  }
+
+  memcpy(dvr->arena + offset, buf->start, buf->used);
+
+  *dvr_frame(dvr, dvr->count) = (dvr_frame_t){
+    .seq = dvr->next_seq++,
+    .offset = offset,
+    .size = buf->used,
+    .time_us = buf->captured_time_us,
+    .keyframe = buf->flags.is_keyframe,
+  };
+  dvr->count++;
+  dvr->write_offset = offset + buf->used;
+
+  dvr->options->used += buf->used;
+  dvr->options->frames = dvr->count;
+  dvr->options->duration_us = buf->captured_time_us - dvr_frame(dvr, 0)->time_us;
+  dvr->width = buf->buf_list->fmt.width;
+  dvr->height = buf->buf_list->fmt.height;
+}
+
+static bool dvr_needs_buffer(buffer_lock_t *buf_lock)
+{
+  return true;
+}
+
+static void dvr_capture(buffer_lock_t *buf_lock, buffer_t *buf)
+{
+  dvr_t *dvr = &dvr_ring;
+
+  pthread_mutex_lock(&dvr->lock);
+
+  // the ring has to start with a key frame, and cannot skip frames in a GOP
+  if (!buf->flags.is_keyframe && (!dvr->count || dvr->wait_for_keyframe)) {
+    goto unlock;
+  }
+
+  if (buf->used > dvr->arena_size) {
+    dvr->options->dropped++;
+    dvr->wait_for_keyframe = true;
+    goto unlock;
+  }
+
+  dvr->wait_for_keyframe = false;
+  dvr_append(dvr, buf);
+  pthread_cond_broadcast(&dvr->cond_wait);
+
+unlock:
+  pthread_mutex_unlock(&dvr->lock);
+}
+
+// returns the newest key frame captured before `time_us`, or the oldest frame
+static uint64_t dvr_find_start(dvr_t *dvr, uint64_t time_us)
+{
+  uint64_t seq = dvr_frame(dvr, 0)->seq;
+
+  for (unsigned i = 0; i < dvr->count; i++) {
+    dvr_frame_t *frame = dvr_frame(dvr, i);
+    if (frame->time_us > time_us) {
+      break;
+    }
+    if (frame->keyframe) {
+      seq = frame->seq;
+    }
+  }
+
+  return seq;
+}
+
+static int dvr_write_to_stream(void *opaque, const uint8_t *data, size_t size)
+{
+  dvr_event_t *event = opaque;
+
+  if (!event->wrote_header && !event->path[0]) {
+    fputs(DVR_VIDEO_HEADER, event->stream);
+  }
+  event->wrote_header = true;
+
+  if (!fwrite(data, size, 1, event->stream)) {
+    return -1;
+  }
+  return 0;
+}
+
+// frames are copied out one at a time, so capturing continues while writing
+static int dvr_write_event(dvr_event_t *event)
+{
+  dvr_t *dvr = event->dvr;
+  uint8_t *data = NULL;
+  size_t data_capacity = 0;
+  h264_index_t index = {0};
+  int frames = 0;
+
+  mp4_muxer_t muxer = {
+    .name = dvr->name,
+    .opaque = event,
+    .write_packet = dvr_write_to_stream,
+  };
+
+  pthread_mutex_lock(&dvr->lock);
+
+  if (!dvr->count) {
+    pthread_mutex_unlock(&dvr->lock);
+    return 0;
+  }
+
+  uint64_t end_us = event->trigger_us + event->post_us;
+  uint64_t seq = dvr_find_start(dvr, event->trigger_us - event->pre_us);
+
+  while (true) {
+    if (seq >= dvr->next_seq) {
+      if (get_monotonic_time_us(NULL, NULL) >= end_us) {
+        break;
+      }
+
+      struct timespec deadline;
+      clock_gettime(CLOCK_REALTIME, &deadline);
+      deadline.tv_sec += DVR_WAIT_TIMEOUT_US / (1000 * 1000);
+      pthread_cond_timedwait(&dvr->cond_wait, &dvr->lock, &deadline);
+      continue;
+    }
+
+    // the writer was too slow and the frame was evicted, continue from the oldest GOP
+    if (seq < dvr_frame(dvr, 0)->seq) {
+      LOG_INFO(event, "Frames were evicted before being written, skipping %" PRIu64 " frames.",
+        dvr_frame(dvr, 0)->seq - seq);
+      seq = dvr_frame(dvr, 0)->seq;
+    }
+
+    dvr_frame_t frame = *dvr_frame(dvr, seq - dvr_frame(dvr, 0)->seq);
+    if (frame.time_us > end_us) {
+      break;
+    }
+
+    if (frame.size > data_capacity) {
+      uint8_t *new_data = realloc(data, frame.size);
+      if (!new_data) {
+        break;
+      }
+      data = new_data;
+      data_capacity = frame.size;
+    }
+    memcpy(data, dvr->arena + frame.offset, frame.size);
+    muxer.width = dvr->width;
+    muxer.height = dvr->height;
+    seq++;
+
+    pthread_mutex_unlock(&dvr->lock);
+
+    bool params_changed = false;
+    int ret = h264_index_parse(&index, data, frame.size);
+    if (ret >= 0 && mp4_muxer_params_changed(&muxer, &index, frame.keyframe)) {
+      // the file cannot change the resolution, the event ends with the old stream
+      LOG_INFO(event, "The H264 parameters changed, ending the event.");
+      params_changed = true;
+      ret = mp4_muxer_flush(&muxer, frame.time_us);
+    } else if (ret >= 0) {
+      ret = mp4_muxer_write_frame(&muxer, &index, frame.time_us, frame.keyframe);
+    }
+
+    pthread_mutex_lock(&dvr->lock);
+
+    if (ret < 0) {
+      break;
+    }
+    frames += ret;
+
+    if (params_changed) {
+      break;
+    }
+  }
+
+  pthread_mutex_unlock(&dvr->lock);
+
+  if (mp4_muxer_flush(&muxer, 0) > 0) {
+    frames++;
+  }
+
+  mp4_muxer_close(&muxer);
+  h264_index_free(&index);
+  free(data);
+  return frames;
+}
+
+static void *dvr_event_thread(void *opaque)
+{
+  dvr_event_t *event = opaque;
+
+  // never shares a file with another event triggered at the same time
+  event->stream = fopen(event->path, "wbx");
+  if (event->stream) {
+    int frames = dvr_write_event(event);
+    fclose(event->stream);
+    LOG_INFO(event, "Written event %s with %d frames.", event->path, frames);
+  } else {
+    LOG_INFO(event, "Cannot open %s: %s", event->path, strerror(errno));
+  }
+
+  free(event);
+  return NULL;
+}
+
+// returns -1 if the value is not a non-negative number
+static int64_t dvr_get_seconds_param(http_worker_t *worker, const char *key, unsigned default_value, unsigned max_value)
+{
+  char *value = http_get_param(worker, key);
+  char *end = NULL;
+  long seconds = value ? strtol(value, &end, 10) : default_value;
+
+  if (value && (end == value || *end || seconds < 0)) {
+    seconds = -1;
+  } else if (seconds > max_value) {
+    seconds = max_value;
+  }
+
+  free(value);
+  return seconds < 0 ? -1 : seconds * 1000LL * 1000LL;
+}
+
+void http_dvr_trigger(http_worker_t *worker, FILE *stream)
+{
+  if (!http_output_first_camera(worker, stream)) {
+    return;
+  }
+
+  dvr_t *dvr = &dvr_ring;
+
+  if (!dvr->options || !dvr->options->running) {
+    http_404(stream, "DVR is not enabled.\n");
+    return;
+  }
+
+  // the ring never holds more than `duration` before the trigger
+  int64_t pre_us = dvr_get_seconds_param(worker, "pre", DVR_DEFAULT_PRE, dvr->options->duration);
+  int64_t post_us = dvr_get_seconds_param(worker, "post", DVR_DEFAULT_POST, DVR_MAX_POST);
+
+  if (pre_us < 0 || post_us < 0) {
+    http_400(stream, "The `pre` and `post` have to be seconds.\n");
+    return;
+  }
+
+  dvr_event_t *event = calloc(1, sizeof(dvr_event_t));
+  event->name = dvr->name;
+  event->dvr = dvr;
+  event->trigger_us = get_monotonic_time_us(NULL, NULL);
+  event->pre_us = MIN((uint64_t)pre_us, event->trigger_us);
+  event->post_us = post_us;
+  dvr->options->events++;
+
+  if (!dvr->options->path[0]) {
+    event->stream = stream;
+    int frames = dvr_write_event(event);
+    LOG_INFO(worker, "Streamed event with %d frames.", frames);
+
+    if (!event->wrote_header) {
+      http_500(stream, NULL);
+      fprintf(stream, "No frames.\n");
+    }
+    free(event);
+    return;
+  }
+
+  struct timeval now;
+  struct tm tm;
+  pthread_t thread;
+
+  gettimeofday(&now, NULL);
+  localtime_r(&now.tv_sec, &tm);
+
+  int n = snprintf(event->path, sizeof(event->path), "%s/event-", dvr->options->path);
+  n += strftime(event->path + n, sizeof(event->path) - n, "%Y%m%d-%H%M%S", &tm);
+  snprintf(event->path + n, sizeof(event->path) - n, ".%03u.mp4", (unsigned)(now.tv_usec / 1000));
+
+  // the event is owned by the thread once started
+  char response[sizeof(event->path) + 64];
+  snprintf(response, sizeof(response), "{\"file\":\"%s\",\"pre\":%" PRIu64 ",\"post\":%" PRIu64 "}\r\n",
+    event->path, event->pre_us / 1000 / 1000, event->post_us / 1000 / 1000);
+
+  if (pthread_create(&thread, NULL, dvr_event_thread, event) != 0) {
+    http_500(stream, "Cannot start event writer.\n");
+    free(event);
+    return;
+  }
+  pthread_detach(thread);
+
+  http_write_response(stream, "200 OK", "application/json", response, 0);
+}
+
+int dvr_server(dvr_options_t *options)
+{
+  dvr_t *dvr = &dvr_ring;
+
+  dvr->options = options;
+  dvr->arena_size = options->size * 1024LL * 1024LL;
+  dvr->arena = malloc(dvr->arena_size);
+  if (!dvr->arena) {
+    LOG_ERROR(dvr, "Cannot allocate %u MiB.", options->size);
+  }
+
+  buffer_lock_register_check_streaming(&video_lock, dvr_needs_buffer);
+  buffer_lock_register_notify_buffer(&video_lock, "dvr", dvr_capture);
+
+  LOG_INFO(dvr, "Keeping up to %us or %u MiB of video for events.", options->duration, options->size);
+
+  options->running = true;
+  return 0;
+
+error:
+  return -1;
+}
@@ -0,0 +1,26 @@
+#pragma once
+
+#include <stdio.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <sys/types.h>
+
+#define DVR_PATH_LENGTH 256
+
+typedef struct http_worker_s http_worker_t;
+
+typedef struct dvr_options_s {
+  bool running;
+  uint size; // MiB
+  uint duration; // seconds
+  char path[DVR_PATH_LENGTH];
+  int events;
+  int dropped;
+  uint64_t used; // bytes
+  int frames;
+  uint64_t duration_us;
+} dvr_options_t;
+
+// pre-event ring of H264 frames
+void http_dvr_trigger(http_worker_t *worker, FILE *stream);
+int dvr_server(dvr_options_t *options);
@@ -133,7 +133,7 @@ static void http_ffmpeg_video(http_worker_t *worker, FILE *stream, const char *c
 #endif
 
   int n = buffer_lock_write_loop(
-    &video_lock,
+    http_ladder_lock(worker, &http_output_camera(worker)->video),
     0,
     0,
     (buffer_write_fn)http_ffmpeg_video_buf_part,
@@ -158,8 +158,3 @@ void http_mkv_video(http_worker_t *worker, FILE *stream)
   http_ffmpeg_video(worker, stream, "video/mp4", "matroska");
 }
 
-void http_mp4_video(http_worker_t *worker, FILE *stream)
-{
-  http_ffmpeg_video(worker, stream, "video/mp4", "mp4");
-}
-
@@ -52,7 +52,7 @@ void http_h264_video(http_worker_t *worker, FILE *stream)
 {
   http_video_status_t status = { stream };
 
-  int n = buffer_lock_write_loop(&video_lock, 0, 0, (buffer_write_fn)http_video_buf_part, &status);
+  int n = buffer_lock_write_loop(http_ladder_lock(worker, &http_output_camera(worker)->video), 0, 0, (buffer_write_fn)http_video_buf_part, &status);
 
   if (status.wrote_header) {
     return;
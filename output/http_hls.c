@@ -4,19 +4,34 @@
 #include "output.h"
 #include "util/opts/log.h"
 #include "util/http/http.h"
+#include "util/mp4/muxer.h"
 #include "device/buffer.h"
 #include "device/buffer_lock.h"
 #include "device/buffer_list.h"
 #include "device/device.h"
 
+#define HLS_SEGMENTS 8
+#define HLS_PLAYLIST_SEGMENTS 4
+#define HLS_PLAYLIST_PARTS_SEGMENTS 2
+#define HLS_MAX_PARTS 64
+#define HLS_INITS 2
+#define HLS_SEGMENT_CAPACITY (2 * 1024 * 1024)
+#define HLS_FRAGMENT_OVERHEAD 1024
+#define HLS_SEGMENT_DURATION_US (1000 * 1000)
+#define HLS_PART_DURATION_US (200 * 1000)
+#define HLS_IDLE_TIMEOUT_US (10 * 1000 * 1000)
+#define HLS_BLOCK_TIMEOUT_MS 3000
+
 static const char *const CONTENT_TYPE = "application/x-mpegURL";
 
-static const char *const STREAM_M3U8 = 
-  "#EXTM3U\r\n" \
-  "#EXT-X-TARGETDURATION:1\r\n" \
-  "#EXT-X-VERSION:4\r\n" \
-  "#EXTINF:1.0,\r\n" \
-  "video.mp4?ts=%zu\r\n";
+static const char *const MP4_HEADER =
+  "HTTP/1.0 200 OK\r\n"
+  "Access-Control-Allow-Origin: *\r\n"
+  "Connection: close\r\n"
+  "Cache-Control: max-age=60\r\n"
+  "Content-Type: video/mp4\r\n"
+  "Content-Length: %zu\r\n"
+  "\r\n";
 
 static const char *const LOCATION_REDIRECT =
   "HTTP/1.0 307 Temporary Redirect\r\n"
@@ -25,22 +40,604 @@ static const char *const LOCATION_REDIRECT =
   "Location: %s?%s\r\n"
   "\r\n";
 
+typedef struct hls_part_s {
+  size_t offset;
+  size_t size;
+  uint64_t duration_us;
+  bool independent;
+} hls_part_t;
+
+typedef struct hls_init_s {
+  unsigned version;
+  uint8_t data[2 * MP4_MAX_PARAMETER_SET + 1024];
+  size_t size;
+} hls_init_t;
+
+typedef struct hls_segment_s {
+  int msn; // -1 if unused
+  int refs;
+  bool complete;
+  unsigned init_version;
+
+  uint8_t *data;
+  size_t size;
+  uint64_t start_us;
+  uint64_t duration_us;
+
+  hls_part_t parts[HLS_MAX_PARTS];
+  int nparts;
+  uint64_t part_start_us;
+} hls_segment_t;
+
+typedef struct hls_s {
+  const char *name;
+  pthread_mutex_t lock;
+  pthread_cond_t cond_wait;
+  uint64_t last_request_us;
+
+  mp4_muxer_t muxer;
+
+  // a new init section follows each change of the H264 parameters,
+  // the previous one is kept for the segments still in the playlist
+  hls_init_t inits[HLS_INITS];
+  unsigned init_version;
+
+  hls_segment_t segments[HLS_SEGMENTS];
+  hls_segment_t *current;
+  int next_msn;
+  bool requested_key_frame;
+  uint64_t last_time_us;
+
+  // the advertised targets only grow, as required by the playlist
+  uint64_t max_segment_us;
+  uint64_t max_part_us;
+} hls_t;
+
+static int hls_write_packet(void *opaque, const uint8_t *data, size_t size);
+
+static hls_t http_hls = {
+  .name = "HLS",
+  .lock = PTHREAD_MUTEX_INITIALIZER,
+  .cond_wait = PTHREAD_COND_INITIALIZER,
+  .muxer = {
+    .name = "HLS",
+    .opaque = &http_hls,
+    .write_packet = hls_write_packet,
+  },
+};
+
+static hls_init_t *hls_find_init(hls_t *hls, unsigned version)
+{
+  hls_init_t *init = &hls->inits[version % HLS_INITS];
+  return init->version == version && init->size > 0 ? init : NULL;
+}
+
+static int hls_write_packet(void *opaque, const uint8_t *data, size_t size)
+{
+  hls_t *hls = opaque;
+
+  // ftyp/moov go to the init section, everything after into the segment
+  if (!hls->muxer.wrote_header) {
+    hls_init_t *init = &hls->inits[hls->init_version % HLS_INITS];
+    if (init->size + size > sizeof(init->data))
+      return -1;
+    memcpy(init->data + init->size, data, size);
+    init->size += size;
+    return 0;
+  }
+
+  hls_segment_t *seg = hls->current;
+  if (!seg || seg->size + size > HLS_SEGMENT_CAPACITY)
+    return -1;
+
+  memcpy(seg->data + seg->size, data, size);
+  seg->size += size;
+  return 0;
+}
+
+static hls_segment_t *hls_find_segment(hls_t *hls, int msn)
+{
+  for (int i = 0; i < HLS_SEGMENTS; i++) {
+    if (hls->segments[i].msn >= 0 && hls->segments[i].msn == msn)
+      return &hls->segments[i];
+  }
+  return NULL;
+}
+
+static void hls_close_part(hls_t *hls, hls_segment_t *seg, uint64_t now_us)
+{
+  size_t offset = seg->nparts > 0 ? seg->parts[seg->nparts-1].offset + seg->parts[seg->nparts-1].size : 0;
+
+  if (seg->size <= offset || seg->nparts >= HLS_MAX_PARTS)
+    return;
+
+  hls_part_t *part = &seg->parts[seg->nparts];
+  part->offset = offset;
+  part->size = seg->size - offset;
+  part->duration_us = now_us - seg->part_start_us;
+  part->independent = seg->nparts == 0;
+  seg->nparts++;
+  seg->part_start_us = now_us;
+  hls->max_part_us = MAX(hls->max_part_us, part->duration_us);
+}
+
+static void hls_close_segment(hls_t *hls, hls_segment_t *seg, uint64_t now_us)
+{
+  hls_close_part(hls, seg, now_us);
+  seg->duration_us = now_us - seg->start_us;
+  seg->complete = true;
+  hls->current = NULL;
+  hls->max_segment_us = MAX(hls->max_segment_us, seg->duration_us);
+
+  LOG_DEBUG(hls, "Closed segment %d: parts=%d, size=%zu, duration_ms=%.1f",
+    seg->msn, seg->nparts, seg->size, seg->duration_us / 1000.0f);
+}
+
+static hls_segment_t *hls_open_segment(hls_t *hls, uint64_t now_us)
+{
+  hls_segment_t *seg = NULL;
+
+  // reuse the oldest segment that is not being sent
+  for (int i = 0; i < HLS_SEGMENTS; i++) {
+    if (hls->segments[i].refs > 0)
+      continue;
+    if (!seg || hls->segments[i].msn < seg->msn)
+      seg = &hls->segments[i];
+  }
+
+  if (!seg) {
+    LOG_INFO(hls, "All segments are in use.");
+    return NULL;
+  }
+
+  if (!seg->data) {
+    seg->data = malloc(HLS_SEGMENT_CAPACITY);
+    if (!seg->data)
+      return NULL;
+  }
+
+  seg->msn = hls->next_msn++;
+  seg->complete = false;
+  seg->init_version = hls->init_version;
+  seg->size = 0;
+  seg->start_us = now_us;
+  seg->duration_us = 0;
+  seg->nparts = 0;
+  seg->part_start_us = now_us;
+  hls->current = seg;
+  hls->requested_key_frame = false;
+  return seg;
+}
+
+static void hls_reset(hls_t *hls)
+{
+  for (int i = 0; i < HLS_SEGMENTS; i++) {
+    hls->segments[i].msn = -1;
+  }
+
+  for (int i = 0; i < HLS_INITS; i++) {
+    hls->inits[i] = (hls_init_t){0};
+  }
+
+  hls->current = NULL;
+  hls->init_version = 0;
+  hls->requested_key_frame = false;
+  hls->last_time_us = 0;
+  hls->max_segment_us = HLS_SEGMENT_DURATION_US;
+  hls->max_part_us = HLS_PART_DURATION_US;
+
+  mp4_muxer_close(&hls->muxer);
+  hls->muxer = (mp4_muxer_t){
+    .name = hls->name,
+    .opaque = hls,
+    .write_packet = hls_write_packet,
+  };
+}
+
+static void hls_new_init(hls_t *hls)
+{
+  hls->init_version++;
+  hls->inits[hls->init_version % HLS_INITS] = (hls_init_t){
+    .version = hls->init_version,
+  };
+  mp4_muxer_reset(&hls->muxer);
+}
+
+static void hls_force_key(hls_t *hls, buffer_t *buf)
+{
+  if (!hls->requested_key_frame) {
+    device_video_force_key(buf->buf_list->dev);
+    hls->requested_key_frame = true;
+  }
+}
+
+static bool hls_needs_buffer(buffer_lock_t *buf_lock)
+{
+  hls_t *hls = &http_hls;
+
+  uint64_t now_us = get_monotonic_time_us(NULL, NULL);
+
+  pthread_mutex_lock(&hls->lock);
+  bool needs_buffer = hls->last_request_us && now_us - hls->last_request_us < HLS_IDLE_TIMEOUT_US;
+  pthread_mutex_unlock(&hls->lock);
+
+  return needs_buffer;
+}
+
+static void hls_capture(buffer_lock_t *buf_lock, buffer_t *buf)
+{
+  hls_t *hls = &http_hls;
+
+  uint64_t now_us = get_monotonic_time_us(NULL, NULL);
+  uint64_t time_us = buf->captured_time_us ? buf->captured_time_us : now_us;
+  bool keyframe = buf->flags.is_keyframe;
+
+  pthread_mutex_lock(&hls->lock);
+
+  if (!hls->last_request_us || now_us - hls->last_request_us >= HLS_IDLE_TIMEOUT_US) {
+    if (hls_find_init(hls, hls->init_version)) {
+      LOG_INFO(hls, "No clients. Resetting segmenter.");
+      hls_reset(hls);
+    }
+    goto unlock;
+  }
+
+  hls_segment_t *seg = hls->current;
+  bool params_changed = mp4_muxer_params_changed(&hls->muxer, &buf->h264, keyframe);
+
+  // the previous frame lasts until this one, and belongs to the open part
+  if (seg) {
+    size_t size = seg->size;
+    if (mp4_muxer_flush(&hls->muxer, time_us) < 0) {
+      seg->size = size;
+    }
+  }
+
+  if (params_changed) {
+    // the next segment starts after a discontinuity, with the new init section
+    LOG_INFO(hls, "The H264 parameters changed, writing a new init section.");
+    if (seg) {
+      hls_close_segment(hls, seg, time_us);
+      seg = NULL;
+    }
+    hls_new_init(hls);
+  } else if (seg && keyframe && time_us - seg->start_us >= HLS_SEGMENT_DURATION_US) {
+    hls_close_segment(hls, seg, time_us);
+    seg = NULL;
+  } else if (seg && (seg->nparts >= HLS_MAX_PARTS - 1 ||
+    seg->size + buf->used + HLS_FRAGMENT_OVERHEAD > HLS_SEGMENT_CAPACITY)) {
+    // only a GOP longer than the segment capacity requests a key frame
+    LOG_INFO(hls, "Segment %d is full. Waiting for keyframe.", seg->msn);
+    hls_close_segment(hls, seg, time_us);
+    hls_force_key(hls, buf);
+    goto unlock;
+  }
+
+  if (!seg) {
+    if (!keyframe) {
+      hls_force_key(hls, buf);
+      goto unlock;
+    }
+
+    seg = hls_open_segment(hls, time_us);
+    if (!seg)
+      goto unlock;
+  }
+
+  // close the part if this frame would make it longer than the target,
+  // assuming it lasts as long as the previous one
+  uint64_t frame_us = hls->last_time_us && time_us > hls->last_time_us ? time_us - hls->last_time_us : 0;
+  if (time_us - seg->part_start_us + frame_us > HLS_PART_DURATION_US) {
+    hls_close_part(hls, seg, time_us);
+  }
+  hls->last_time_us = time_us;
+
+  hls->muxer.width = buf->buf_list->fmt.width;
+  hls->muxer.height = buf->buf_list->fmt.height;
+
+  mp4_muxer_write_frame(&hls->muxer, &buf->h264, time_us, keyframe);
+  if (!hls->muxer.wrote_header) {
+    // no SPS/PPS seen yet
+    seg->msn = -1;
+    hls->current = NULL;
+    hls->next_msn--;
+  }
+
+unlock:
+  pthread_cond_broadcast(&hls->cond_wait);
+  pthread_mutex_unlock(&hls->lock);
+}
+
+static void hls_register()
+{
+  hls_t *hls = &http_hls;
+
+  pthread_mutex_lock(&hls->lock);
+  hls_reset(hls);
+  pthread_mutex_unlock(&hls->lock);
+
+  buffer_lock_register_check_streaming(&video_lock, hls_needs_buffer);
+  buffer_lock_register_notify_buffer(&video_lock, "hls", hls_capture);
+}
+
+static pthread_once_t hls_once = PTHREAD_ONCE_INIT;
+
+void http_hls_register()
+{
+  pthread_once(&hls_once, hls_register);
+}
+
+static void hls_request()
+{
+  hls_t *hls = &http_hls;
+
+  http_hls_register();
+
+  pthread_mutex_lock(&hls->lock);
+  hls->last_request_us = get_monotonic_time_us(NULL, NULL);
+  pthread_mutex_unlock(&hls->lock);
+}
+
+// whether the part (or whole segment if part < 0) can be served,
+// or will never be available
+static bool hls_is_ready(hls_t *hls, int msn, int part)
+{
+  if (msn < 0)
+    return hls_find_init(hls, hls->init_version) && hls->next_msn > 0;
+
+  hls_segment_t *seg = hls_find_segment(hls, msn);
+  if (!seg)
+    return msn < hls->next_msn - 1 || (msn == hls->next_msn - 1 && !hls->current);
+  if (seg->complete)
+    return true;
+  return part >= 0 && part < seg->nparts;
+}
+
+static bool hls_wait(hls_t *hls, int msn, int part)
+{
+  struct timespec timeout;
+  get_time_us(CLOCK_REALTIME, &timeout, NULL, HLS_BLOCK_TIMEOUT_MS * 1000LL);
+
+  while (!hls_is_ready(hls, msn, part)) {
+    if (pthread_cond_timedwait(&hls->cond_wait, &hls->lock, &timeout) == ETIMEDOUT)
+      return false;
+  }
+  return true;
+}
+
+static int hls_get_param(http_worker_t *worker, const char *key, int value)
+{
+  char *param = http_get_param(worker, key);
+  if (param) {
+    value = atoi(param);
+    free(param);
+  }
+  return value;
+}
+
+static void hls_write_segment(hls_t *hls, FILE *stream, hls_segment_t *seg, size_t offset, size_t size)
+{
+  fprintf(stream, MP4_HEADER, size);
+  fflush(stream);
+
+  // segment memory is not recycled while referenced, send it directly
+  const uint8_t *data = seg->data + offset;
+  while (size > 0) {
+    ssize_t n = write(fileno(stream), data, size);
+    if (n <= 0)
+      break;
+    data += n;
+    size -= n;
+  }
+
+  pthread_mutex_lock(&hls->lock);
+  seg->refs--;
+  pthread_mutex_unlock(&hls->lock);
+}
+
+static void hls_write_playlist(hls_t *hls, FILE *stream)
+{
+  hls_segment_t *segments[HLS_SEGMENTS];
+  int nsegments = 0;
+
+  for (int msn = hls->next_msn - HLS_PLAYLIST_SEGMENTS - 1; msn < hls->next_msn; msn++) {
+    hls_segment_t *seg = hls_find_segment(hls, msn);
+    if (seg) {
+      segments[nsegments++] = seg;
+    } else {
+      nsegments = 0; // keep sequence continuous
+    }
+  }
+
+  fprintf(stream, "#EXTM3U\r\n");
+  fprintf(stream, "#EXT-X-VERSION:9\r\n");
+  fprintf(stream, "#EXT-X-TARGETDURATION:%d\r\n", (int)((hls->max_segment_us + 500000) / 1000000));
+  fprintf(stream, "#EXT-X-SERVER-CONTROL:CAN-BLOCK-RELOAD=YES,PART-HOLD-BACK=%.3f\r\n",
+    3 * hls->max_part_us / 1000000.0f);
+  fprintf(stream, "#EXT-X-PART-INF:PART-TARGET=%.3f\r\n", (hls->max_part_us + 999) / 1000 / 1000.0f);
+  fprintf(stream, "#EXT-X-MEDIA-SEQUENCE:%d\r\n", nsegments ? segments[0]->msn : hls->next_msn);
+
+  // every change of the init section is a discontinuity
+  unsigned init_version = nsegments ? segments[0]->init_version : hls->init_version;
+  fprintf(stream, "#EXT-X-DISCONTINUITY-SEQUENCE:%u\r\n", init_version);
+  fprintf(stream, "#EXT-X-MAP:URI=\"hls/init.mp4?v=%u\"\r\n", init_version);
+
+  for (int i = 0; i < nsegments; i++) {
+    hls_segment_t *seg = segments[i];
+
+    if (seg->init_version != init_version) {
+      init_version = seg->init_version;
+      fprintf(stream, "#EXT-X-DISCONTINUITY\r\n");
+      fprintf(stream, "#EXT-X-MAP:URI=\"hls/init.mp4?v=%u\"\r\n", init_version);
+    }
+
+    if (i >= nsegments - HLS_PLAYLIST_PARTS_SEGMENTS - 1) {
+      for (int part = 0; part < seg->nparts; part++) {
+        fprintf(stream, "#EXT-X-PART:DURATION=%.3f,URI=\"hls/part.mp4?msn=%d&part=%d\"%s\r\n",
+          seg->parts[part].duration_us / 1000000.0f, seg->msn, part,
+          seg->parts[part].independent ? ",INDEPENDENT=YES" : "");
+      }
+    }
+
+    if (seg->complete) {
+      fprintf(stream, "#EXTINF:%.3f,\r\n", seg->duration_us / 1000000.0f);
+      fprintf(stream, "hls/segment.mp4?msn=%d\r\n", seg->msn);
+    } else {
+      fprintf(stream, "#EXT-X-PRELOAD-HINT:TYPE=PART,URI=\"hls/part.mp4?msn=%d&part=%d\"\r\n",
+        seg->msn, seg->nparts);
+    }
+  }
+}
+
 void http_m3u8_video(struct http_worker_s *worker, FILE *stream)
 {
-  uint64_t ts = get_monotonic_time_us(NULL, NULL) / 1000 / 1000;
-  http_write_responsef(stream, "200 OK", CONTENT_TYPE, STREAM_M3U8, ts);
+  if (!http_output_first_camera(worker, stream)) {
+    return;
+  }
+
+  hls_t *hls = &http_hls;
+
+  int msn = hls_get_param(worker, "_HLS_msn", -1);
+  int part = hls_get_param(worker, "_HLS_part", -1);
+  char *body = NULL;
+  size_t body_size = 0;
+
+  hls_request();
+
+  pthread_mutex_lock(&hls->lock);
+  if (msn > hls->next_msn + 1) {
+    pthread_mutex_unlock(&hls->lock);
+    http_400(stream, "The _HLS_msn is too far in the future.\n");
+    return;
+  }
+
+  if (!hls_wait(hls, -1, -1) || (msn >= 0 && !hls_wait(hls, msn, part))) {
+    pthread_mutex_unlock(&hls->lock);
+    http_500(stream, "No frames.\n");
+    return;
+  }
+
+  FILE *playlist = open_memstream(&body, &body_size);
+  if (playlist) {
+    hls_write_playlist(hls, playlist);
+    fclose(playlist);
+  }
+  pthread_mutex_unlock(&hls->lock);
+
+  if (body) {
+    http_write_response(stream, "200 OK", CONTENT_TYPE, body, body_size);
+  } else {
+    http_500(stream, NULL);
+  }
+  free(body);
+}
+
+void http_hls_init(struct http_worker_s *worker, FILE *stream)
+{
+  if (!http_output_first_camera(worker, stream)) {
+    return;
+  }
+
+  hls_t *hls = &http_hls;
+
+  uint8_t init[sizeof(hls->inits[0].data)];
+  size_t init_size = 0;
+  int version = hls_get_param(worker, "v", -1);
+
+  hls_request();
+
+  pthread_mutex_lock(&hls->lock);
+  bool ready = hls_wait(hls, -1, -1);
+  hls_init_t *found = ready ? hls_find_init(hls, version >= 0 ? (unsigned)version : hls->init_version) : NULL;
+  if (found) {
+    init_size = found->size;
+    memcpy(init, found->data, init_size);
+  }
+  pthread_mutex_unlock(&hls->lock);
+
+  if (!ready) {
+    http_500(stream, "No frames.\n");
+    return;
+  } else if (!init_size) {
+    http_404(stream, "Init section not found.\n");
+    return;
+  }
+
+  fprintf(stream, MP4_HEADER, init_size);
+  fwrite(init, 1, init_size, stream);
+}
+
+static void http_hls_media(struct http_worker_s *worker, FILE *stream, bool want_part)
+{
+  if (!http_output_first_camera(worker, stream)) {
+    return;
+  }
+
+  hls_t *hls = &http_hls;
+
+  int msn = hls_get_param(worker, "msn", -1);
+  int part = want_part ? hls_get_param(worker, "part", -1) : -1;
+  hls_segment_t *seg = NULL;
+  size_t offset = 0, size = 0;
+
+  if (msn < 0 || (want_part && part < 0)) {
+    http_400(stream, "Missing msn or part.\n");
+    return;
+  }
+
+  hls_request();
+
+  pthread_mutex_lock(&hls->lock);
+  if (msn <= hls->next_msn && hls_wait(hls, msn, part)) {
+    seg = hls_find_segment(hls, msn);
+  }
+  if (seg && !want_part) {
+    size = seg->size;
+  } else if (seg && part < seg->nparts) {
+    offset = seg->parts[part].offset;
+    size = seg->parts[part].size;
+  }
+  if (size > 0) {
+    seg->refs++;
+  }
+  pthread_mutex_unlock(&hls->lock);
+
+  if (!size) {
+    http_404(stream, "Segment not found.\n");
+    return;
+  }
+
+  hls_write_segment(hls, stream, seg, offset, size);
+}
+
+void http_hls_segment(struct http_worker_s *worker, FILE *stream)
+{
+  http_hls_media(worker, stream, false);
+}
+
+void http_hls_part(struct http_worker_s *worker, FILE *stream)
+{
+  http_hls_media(worker, stream, true);
 }
 
 void http_detect_video(struct http_worker_s *worker, FILE *stream)
 {
-  if (strstr(worker->user_agent, "Safari/") && !strstr(worker->user_agent, "Chrome/") && !strstr(worker->user_agent, "Chromium/")) {
+  if (worker->camera_index > 0) {
+    // HLS is served only for the first camera
+    fprintf(stream, LOCATION_REDIRECT, "video.mp4", worker->request_params);
+  } else if (strstr(worker->user_agent, "Safari/") && !strstr(worker->user_agent, "Chrome/") && !strstr(worker->user_agent, "Chromium/")) {
     // Safari only supports m3u8
     fprintf(stream, LOCATION_REDIRECT, "video.m3u8", worker->request_params);
   } else if (strstr(worker->user_agent, "Firefox/")) {
     // Firefox only supports mp4
     fprintf(stream, LOCATION_REDIRECT, "video.mp4", worker->request_params);
   } else {
+#ifdef USE_FFMPEG
     // Chrome offers best latency with mkv
     fprintf(stream, LOCATION_REDIRECT, "video.mkv", worker->request_params);
+#else
+    // mkv requires FFMPEG, use native mp4 instead
+    fprintf(stream, LOCATION_REDIRECT, "video.mp4", worker->request_params);
+#endif
   }
 }
@@ -61,7 +61,7 @@ void http_snapshot(http_worker_t *worker, FILE *stream)
     .start_time_us = get_monotonic_time_us(NULL, NULL) - max_delay_value * 1000
   };
 
-  int n = buffer_lock_write_loop(&snapshot_lock, 1, SNAPSHOT_TIMEOUT_MS,
+  int n = buffer_lock_write_loop(http_ladder_lock(worker, &http_output_camera(worker)->snapshot), 1, SNAPSHOT_TIMEOUT_MS,
     (buffer_write_fn)http_snapshot_buf_part, &snapshot);
 
   if (n <= 0) {
@@ -90,7 +90,7 @@ int http_stream_buf_part(buffer_lock_t *buf_lock, buffer_t *buf, int frame, FILE
 
 void http_stream(http_worker_t *worker, FILE *stream)
 {
-  int n = buffer_lock_write_loop(&stream_lock, 0, 0, (buffer_write_fn)http_stream_buf_part, stream);
+  int n = buffer_lock_write_loop(http_ladder_lock(worker, &http_output_camera(worker)->stream), 0, 0, (buffer_write_fn)http_stream_buf_part, stream);
 
   if (n == 0) {
     http_500(stream, NULL);
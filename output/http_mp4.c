@@ -0,0 +1,111 @@
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "output.h"
+#include "util/opts/log.h"
+#include "util/http/http.h"
+#include "util/mp4/muxer.h"
+#include "device/buffer.h"
+#include "device/buffer_lock.h"
+#include "device/buffer_list.h"
+#include "device/device.h"
+
+static const char *const VIDEO_HEADER =
+  "HTTP/1.0 200 OK\r\n"
+  "Access-Control-Allow-Origin: *\r\n"
+  "Connection: close\r\n"
+  "Content-Type: video/mp4\r\n"
+  "\r\n";
+
+typedef struct {
+  const char *name;
+  FILE *stream;
+
+  bool had_key_frame;
+  bool requested_key_frame;
+  bool wrote_header;
+
+  mp4_muxer_t muxer;
+} http_mp4_status_t;
+
+static int http_mp4_write_to_stream(void *opaque, const uint8_t *data, size_t size)
+{
+  http_mp4_status_t *status = opaque;
+
+  if (!status->wrote_header) {
+    fputs(VIDEO_HEADER, status->stream);
+    status->wrote_header = true;
+  }
+
+  if (!fwrite(data, size, 1, status->stream)) {
+    return -1;
+  }
+  return 0;
+}
+
+static int http_mp4_video_buf_part(buffer_lock_t *buf_lock, buffer_t *buf, int frame, http_mp4_status_t *status)
+{
+  if (!status->had_key_frame) {
+    status->had_key_frame = buf->flags.is_keyframe;
+  }
+
+  if (!status->had_key_frame) {
+    if (!status->requested_key_frame) {
+      device_video_force_key(buf->buf_list->dev);
+      status->requested_key_frame = true;
+    }
+    return 0;
+  }
+
+  // players do not expect a new header, so they reconnect to the new stream
+  if (mp4_muxer_params_changed(&status->muxer, &buf->h264, buf->flags.is_keyframe)) {
+    LOG_INFO(status, "The H264 parameters changed, ending the stream.");
+    mp4_muxer_flush(&status->muxer, buf->captured_time_us);
+    fflush(status->stream);
+    return -1;
+  }
+
+  status->muxer.width = buf->buf_list->fmt.width;
+  status->muxer.height = buf->buf_list->fmt.height;
+
+  int ret = mp4_muxer_write_frame(&status->muxer, &buf->h264,
+    buf->captured_time_us, buf->flags.is_keyframe);
+  if (ret > 0) {
+    fflush(status->stream);
+  }
+  return ret;
+}
+
+void http_mp4_video(http_worker_t *worker, FILE *stream)
+{
+  http_mp4_status_t status = {
+    .name = worker->name,
+    .stream = stream,
+    .muxer = {
+      .name = worker->name,
+      .opaque = &status,
+      .write_packet = http_mp4_write_to_stream,
+      .immediate = true,
+    },
+  };
+
+  int n = buffer_lock_write_loop(
+    http_ladder_lock(worker, &http_output_camera(worker)->video),
+    0,
+    0,
+    (buffer_write_fn)http_mp4_video_buf_part,
+    &status);
+  mp4_muxer_close(&status.muxer);
+
+  if (status.wrote_header) {
+    return;
+  }
+
+  http_500(stream, NULL);
+
+  if (n == 0) {
+    fprintf(stream, "No frames.\n");
+  } else if (n < 0) {
+    fprintf(stream, "Interrupted. Received %d frames", -n);
+  }
+}
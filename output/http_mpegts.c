@@ -0,0 +1,182 @@
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "output.h"
+#include "util/opts/log.h"
+#include "util/opts/fourcc.h"
+#include "util/http/http.h"
+#include "util/mpegts/muxer.h"
+#include "device/buffer.h"
+#include "device/buffer_lock.h"
+#include "device/buffer_list.h"
+#include "device/device.h"
+#include "device/memory/memory.h"
+
+#define MPEGTS_BUFFERS 8
+#define MPEGTS_BUFFER_SIZE (256 * 1024)
+
+static const char *const VIDEO_HEADER =
+  "HTTP/1.0 200 OK\r\n"
+  "Access-Control-Allow-Origin: *\r\n"
+  "Connection: close\r\n"
+  "Content-Type: video/mp2t\r\n"
+  "\r\n";
+
+typedef struct {
+  FILE *stream;
+  bool wrote_header;
+  bool had_key_frame;
+  bool requested_key_frame;
+} http_mpegts_status_t;
+
+static int mpegts_write_to_buf(void *opaque, const uint8_t *data, size_t size)
+{
+  buffer_t *buf = opaque;
+
+  if (buf->used + size > buf->length &&
+    memory_buffer_reserve(buf, MAX(buf->length * 2, buf->used + size)) < 0) {
+    return -1;
+  }
+
+  memcpy((uint8_t*)buf->start + buf->used, data, size);
+  buf->used += size;
+  return 0;
+}
+
+static mpegts_muxer_t mpegts_muxer = {
+  .name = "MPEGTS",
+  .write_packet = mpegts_write_to_buf,
+};
+
+static buffer_list_t *mpegts_list;
+
+static bool mpegts_needs_buffer(buffer_lock_t *buf_lock)
+{
+  return buffer_lock_is_used(&video_ts_lock);
+}
+
+static void mpegts_capture(buffer_lock_t *buf_lock, buffer_t *buf)
+{
+  if (!mpegts_list || !buffer_lock_is_used(&video_ts_lock)) {
+    return;
+  }
+
+  buffer_t *ts_buf = buffer_list_dequeue(mpegts_list);
+  if (!ts_buf) {
+    LOG_DEBUG(mpegts_list, "No free buffer. Dropping frame.");
+    return;
+  }
+
+  mpegts_list->fmt.width = buf->buf_list->fmt.width;
+  mpegts_list->fmt.height = buf->buf_list->fmt.height;
+
+  mpegts_muxer.opaque = ts_buf;
+  int ret = mpegts_muxer_write_frame(&mpegts_muxer, buf->start, buf->used, &buf->h264,
+    buf->captured_time_us, buf->flags.is_keyframe);
+
+  ts_buf->flags = buf->flags;
+  ts_buf->captured_time_us = buf->captured_time_us;
+
+  // muxed once, shared with all clients
+  if (ret > 0) {
+    buffer_lock_capture(&video_ts_lock, ts_buf);
+  }
+  buffer_consumed(ts_buf, "mpegts");
+}
+
+static void mpegts_open()
+{
+  buffer_format_t fmt = {
+    .format = V4L2_PIX_FMT_MPEG,
+    .sizeimage = MPEGTS_BUFFER_SIZE,
+    .nbufs = MPEGTS_BUFFERS,
+    .type = BUFFER_TYPE_VIDEO,
+  };
+
+  device_t *dev = device_memory_open("MPEGTS", "memory");
+  if (!dev) {
+    LOG_ERROR(NULL, "Cannot open MPEGTS device.");
+  }
+
+  mpegts_list = device_open_buffer_list(dev, true, fmt, true);
+  if (!mpegts_list || buffer_list_set_stream(mpegts_list, true) < 0) {
+    LOG_ERROR(dev, "Cannot open MPEGTS buffers.");
+  }
+
+  video_ts_lock.buf_list = mpegts_list;
+  return;
+
+error:
+  device_close(dev);
+  mpegts_list = NULL;
+}
+
+static int http_mpegts_buf_part(buffer_lock_t *buf_lock, buffer_t *buf, int frame, http_mpegts_status_t *status)
+{
+  if (!status->had_key_frame) {
+    status->had_key_frame = buf->flags.is_keyframe;
+  }
+
+  if (!status->had_key_frame) {
+    if (!status->requested_key_frame) {
+      pthread_mutex_lock(&video_lock.lock);
+      device_video_force_key(video_lock.buf_list ? video_lock.buf_list->dev : NULL);
+      pthread_mutex_unlock(&video_lock.lock);
+      status->requested_key_frame = true;
+    }
+    return 0;
+  }
+
+  if (!status->wrote_header) {
+    fputs(VIDEO_HEADER, status->stream);
+    status->wrote_header = true;
+  }
+  if (!fwrite(buf->start, buf->used, 1, status->stream)) {
+    return -1;
+  }
+  fflush(status->stream);
+  return 1;
+}
+
+static void mpegts_register()
+{
+  buffer_lock_register_check_streaming(&video_lock, mpegts_needs_buffer);
+  buffer_lock_register_notify_buffer(&video_lock, "mpegts", mpegts_capture);
+}
+
+void http_mpegts_register()
+{
+  static pthread_once_t mpegts_once = PTHREAD_ONCE_INIT;
+
+  pthread_once(&mpegts_once, mpegts_register);
+}
+
+void http_mpegts_video(http_worker_t *worker, FILE *stream)
+{
+  if (!http_output_first_camera(worker, stream)) {
+    return;
+  }
+
+  static pthread_once_t mpegts_once = PTHREAD_ONCE_INIT;
+  http_mpegts_status_t status = { stream };
+
+  http_mpegts_register();
+  pthread_once(&mpegts_once, mpegts_open);
+
+  int n = -1;
+  if (mpegts_list) {
+    n = buffer_lock_write_loop(&video_ts_lock, 0, 0, (buffer_write_fn)http_mpegts_buf_part, &status);
+  }
+
+  if (status.wrote_header) {
+    return;
+  }
+
+  http_500(stream, NULL);
+
+  if (n == 0) {
+    fprintf(stream, "No frames.\n");
+  } else if (n < 0) {
+    fprintf(stream, "Interrupted. Received %d frames", -n);
+  }
+}
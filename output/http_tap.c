@@ -0,0 +1,54 @@
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "output.h"
+#include "util/http/http.h"
+#include "util/opts/log.h"
+#include "util/opts/fourcc.h"
+#include "device/buffer.h"
+#include "device/buffer_list.h"
+#include "device/buffer_lock.h"
+
+#define TAP_TIMEOUT_MS 3000
+
+static int http_tap_buf_part(buffer_lock_t *buf_lock, buffer_t *buf, int frame, FILE *stream)
+{
+  buffer_format_t *fmt = &buf->buf_list->fmt;
+
+  fprintf(stream, "HTTP/1.1 200 OK\r\n");
+  fprintf(stream, "Content-Type: application/octet-stream\r\n");
+  fprintf(stream, "Content-Length: %zu\r\n", buf->used);
+  fprintf(stream, "X-Format: %s\r\n", fourcc_to_string(fmt->format).buf);
+  fprintf(stream, "X-Width: %u\r\n", fmt->width);
+  fprintf(stream, "X-Height: %u\r\n", fmt->height);
+  fprintf(stream, "X-Bytes-Per-Line: %u\r\n", fmt->bytesperline);
+  fprintf(stream, "X-Timestamp-Us: %llu\r\n", (unsigned long long)buf->captured_time_us);
+  fprintf(stream, "\r\n");
+  fwrite(buf->start, buf->used, 1, stream);
+  return 1;
+}
+
+void http_tap(http_worker_t *worker, FILE *stream)
+{
+  if (!http_output_first_camera(worker, stream)) {
+    return;
+  }
+
+  char *name = http_get_param(worker, "name");
+  buffer_lock_t *buf_lock = name ? output_tap_lock(name, false) : NULL;
+  free(name);
+
+  if (!buf_lock) {
+    http_404(stream, "");
+    fprintf(stream, "No such tap.\r\n");
+    return;
+  }
+
+  int n = buffer_lock_write_loop(buf_lock, 1, TAP_TIMEOUT_MS,
+    (buffer_write_fn)http_tap_buf_part, stream);
+
+  if (n <= 0) {
+    http_500(stream, NULL);
+    fprintf(stream, "No frame captured yet.\r\n");
+  }
+}
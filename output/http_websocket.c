@@ -0,0 +1,161 @@
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "output.h"
+#include "util/opts/log.h"
+#include "util/opts/fourcc.h"
+#include "util/http/http.h"
+#include "util/h264/h264.h"
+#include "device/buffer.h"
+#include "device/buffer_lock.h"
+#include "device/buffer_list.h"
+#include "device/device.h"
+
+#define WEBSOCKET_HEADER_SIZE 16
+#define WEBSOCKET_FLAG_KEYFRAME 0x01
+#define WEBSOCKET_CODEC_JPEG 1
+#define WEBSOCKET_CODEC_H264 2
+
+// frames are skipped while the client has not received this much
+#define WEBSOCKET_MAX_PENDING (512 * 1024)
+
+typedef struct {
+  FILE *stream;
+  unsigned codec;
+  bool wrote_config;
+  bool had_key_frame;
+  bool requested_key_frame;
+  uint32_t seq;
+  int skipped;
+  bool closed;
+} http_websocket_status_t;
+
+static void http_websocket_put_header(uint8_t *p, uint32_t seq, uint64_t time_us, unsigned flags, unsigned codec)
+{
+  p[0] = seq >> 24;
+  p[1] = seq >> 16;
+  p[2] = seq >> 8;
+  p[3] = seq;
+  for (int i = 0; i < 8; i++) {
+    p[4 + i] = time_us >> (56 - i * 8);
+  }
+  p[12] = flags;
+  p[13] = codec;
+  p[14] = 0;
+  p[15] = 0;
+}
+
+static int http_websocket_write_config(http_websocket_status_t *status, buffer_t *buf)
+{
+  char config[256];
+  int n;
+
+  if (status->codec == WEBSOCKET_CODEC_H264) {
+    h264_params_t params;
+    h264_sps_t sps = {
+      .width = buf->buf_list->fmt.width,
+      .height = buf->buf_list->fmt.height
+    };
+
+    buffer_list_get_h264_params(buf->buf_list, &params);
+
+    if (!params.sps_size || !h264_parse_sps(params.sps, params.sps_size, &sps)) {
+      sps.profile_idc = 66;
+      sps.level_idc = 40;
+    }
+
+    // the codec string configures WebCodecs' VideoDecoder
+    n = snprintf(config, sizeof(config),
+      "{\"codec\":\"avc1.%02x%02x%02x\",\"width\":%u,\"height\":%u}",
+      sps.profile_idc, sps.constraint_flags, sps.level_idc, sps.width, sps.height);
+  } else {
+    n = snprintf(config, sizeof(config),
+      "{\"codec\":\"jpeg\",\"width\":%u,\"height\":%u}",
+      buf->buf_list->fmt.width, buf->buf_list->fmt.height);
+  }
+
+  return http_websocket_write(status->stream, HTTP_WEBSOCKET_TEXT, NULL, 0, config, n);
+}
+
+static int http_websocket_buf_part(buffer_lock_t *buf_lock, buffer_t *buf, int frame, http_websocket_status_t *status)
+{
+  uint8_t header[WEBSOCKET_HEADER_SIZE];
+  uint32_t seq = status->seq++;
+
+  // a Close from the client was already answered
+  if (http_websocket_read(status->stream) != 0) {
+    status->closed = true;
+    return -1;
+  }
+
+  if (!status->had_key_frame) {
+    status->had_key_frame = buf->flags.is_keyframe || status->codec == WEBSOCKET_CODEC_JPEG;
+  }
+
+  if (!status->had_key_frame) {
+    if (!status->requested_key_frame) {
+      device_video_force_key(buf->buf_list->dev);
+      status->requested_key_frame = true;
+    }
+    return 0;
+  }
+
+  // the client cannot keep up: skip frames instead of queueing them
+  if (frame > 0 && http_websocket_pending(status->stream) > WEBSOCKET_MAX_PENDING) {
+    status->skipped++;
+
+    if (status->codec == WEBSOCKET_CODEC_H264) {
+      status->had_key_frame = false;
+      status->requested_key_frame = false;
+    }
+    return 0;
+  }
+
+  if (!status->wrote_config) {
+    if (http_websocket_write_config(status, buf) < 0) {
+      return -1;
+    }
+    status->wrote_config = true;
+  }
+
+  http_websocket_put_header(header, seq, buf->captured_time_us,
+    buf->flags.is_keyframe ? WEBSOCKET_FLAG_KEYFRAME : 0, status->codec);
+
+  if (http_websocket_write(status->stream, HTTP_WEBSOCKET_BINARY, header, sizeof(header), buf->start, buf->used) < 0) {
+    return -1;
+  }
+  return 1;
+}
+
+static void http_websocket(http_worker_t *worker, FILE *stream, buffer_lock_t *buf_lock, unsigned codec)
+{
+  http_websocket_status_t status = { stream, codec };
+
+  if (!buf_lock->buf_list) {
+    http_404(stream, "");
+    fprintf(stream, "No stream available.\r\n");
+    return;
+  }
+
+  if (!http_websocket_upgrade(worker, stream)) {
+    return;
+  }
+
+  int n = buffer_lock_write_loop(buf_lock, 0, 0, (buffer_write_fn)http_websocket_buf_part, &status);
+
+  LOG_INFO(worker, "WebSocket closed after %d frames, skipped %d.", abs(n), status.skipped);
+
+  if (!status.closed) {
+    http_websocket_write(stream, HTTP_WEBSOCKET_CLOSE, NULL, 0, NULL, 0);
+  }
+}
+
+void http_websocket_stream(http_worker_t *worker, FILE *stream)
+{
+  http_websocket(worker, stream, http_ladder_lock(worker, &http_output_camera(worker)->stream), WEBSOCKET_CODEC_JPEG);
+}
+
+void http_websocket_video(http_worker_t *worker, FILE *stream)
+{
+  http_websocket(worker, stream, http_ladder_lock(worker, &http_output_camera(worker)->video), WEBSOCKET_CODEC_H264);
+}
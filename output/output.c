@@ -1,5 +1,159 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "output.h"
+#include "util/http/http.h"
+#include "device/buffer_list.h"
 #include "device/buffer_lock.h"
 
 DEFINE_BUFFER_LOCK(snapshot_lock, 0);
 DEFINE_BUFFER_LOCK(stream_lock, 0);
 DEFINE_BUFFER_LOCK(video_lock, 0);
+DEFINE_BUFFER_LOCK(video_sub_lock, 0);
+DEFINE_BUFFER_LOCK(video_ts_lock, 0);
+
+#define DEFINE_OUTPUT_LADDER(_name) \
+  DEFINE_BUFFER_LOCK(_name##_rung1_lock, 0); \
+  DEFINE_BUFFER_LOCK(_name##_rung2_lock, 0); \
+  DEFINE_BUFFER_LOCK(_name##_rung3_lock, 0);
+
+#define DEFINE_OUTPUT_CAMERA(_prefix) \
+  DEFINE_BUFFER_LOCK(_prefix##_snapshot_lock, 0); \
+  DEFINE_BUFFER_LOCK(_prefix##_stream_lock, 0); \
+  DEFINE_BUFFER_LOCK(_prefix##_video_lock, 0); \
+  DEFINE_OUTPUT_LADDER(_prefix##_snapshot); \
+  DEFINE_OUTPUT_LADDER(_prefix##_stream); \
+  DEFINE_OUTPUT_LADDER(_prefix##_video);
+
+#define OUTPUT_LADDER(_name) { \
+    .buf_lock = &_name##_lock, \
+    .rungs = { &_name##_rung1_lock, &_name##_rung2_lock, &_name##_rung3_lock } \
+  }
+
+#define OUTPUT_CAMERA(_prefix, _video_sub) { \
+    .snapshot = OUTPUT_LADDER(_prefix##snapshot), \
+    .stream = OUTPUT_LADDER(_prefix##stream), \
+    .video = OUTPUT_LADDER(_prefix##video), \
+    .video_sub = _video_sub \
+  }
+
+DEFINE_OUTPUT_LADDER(snapshot);
+DEFINE_OUTPUT_LADDER(stream);
+DEFINE_OUTPUT_LADDER(video);
+DEFINE_OUTPUT_CAMERA(cam1);
+DEFINE_OUTPUT_CAMERA(cam2);
+DEFINE_OUTPUT_CAMERA(cam3);
+DEFINE_OUTPUT_CAMERA(unknown);
+
+output_camera_t output_cameras[MAX_OUTPUT_CAMERAS] = {
+  OUTPUT_CAMERA(, &video_sub_lock),
+  OUTPUT_CAMERA(cam1_, NULL),
+  OUTPUT_CAMERA(cam2_, NULL),
+  OUTPUT_CAMERA(cam3_, NULL),
+};
+
+// never captured, requests for not existing cameras time out on it
+static output_camera_t unknown_camera = OUTPUT_CAMERA(unknown_, NULL);
+
+output_camera_t *http_output_camera(http_worker_t *worker)
+{
+  if (worker->camera_index < MAX_OUTPUT_CAMERAS) {
+    return &output_cameras[worker->camera_index];
+  }
+
+  return &unknown_camera;
+}
+
+// HLS, MPEG-TS, RTP, DVR, taps and WebRTC exist once per process and follow the first camera
+bool http_output_first_camera(http_worker_t *worker, FILE *stream)
+{
+  if (worker->camera_index == 0) {
+    return true;
+  }
+
+  http_404(stream, "Only available for the first camera.\n");
+  return false;
+}
+
+static buffer_lock_t output_taps[MAX_OUTPUT_TAPS];
+static pthread_mutex_t output_taps_lock = PTHREAD_MUTEX_INITIALIZER;
+
+buffer_lock_t *output_tap_lock(const char *name, bool create)
+{
+  buffer_lock_t *buf_lock = NULL;
+
+  pthread_mutex_lock(&output_taps_lock);
+  for (int i = 0; i < MAX_OUTPUT_TAPS; i++) {
+    if (output_taps[i].name && !strcmp(output_taps[i].name, name)) {
+      buf_lock = &output_taps[i];
+      break;
+    }
+    if (!output_taps[i].name && create) {
+      buf_lock = &output_taps[i];
+      pthread_mutex_init(&buf_lock->lock, NULL);
+      pthread_cond_init(&buf_lock->cond_wait, NULL);
+      buf_lock->timeout_us = DEFAULT_BUFFER_LOCK_TIMEOUT * 1000LL;
+      buf_lock->name = strdup(name);
+      break;
+    }
+  }
+  pthread_mutex_unlock(&output_taps_lock);
+
+  return buf_lock;
+}
+
+static unsigned http_ladder_param(http_worker_t *worker, const char *key, bool *low)
+{
+  unsigned height = 0;
+  char *value = http_get_param(worker, key);
+
+  if (value) {
+    if (low && !strcmp(value, "low")) {
+      *low = true;
+    }
+    height = strtoul(value, NULL, 10); // accepts "360p"
+    free(value);
+  }
+
+  return height;
+}
+
+buffer_lock_t *http_ladder_lock(http_worker_t *worker, output_ladder_t *ladder)
+{
+  bool low = false;
+  unsigned height = http_ladder_param(worker, "res", &low);
+
+  if (!height) {
+    height = http_ladder_param(worker, "height", NULL);
+  }
+
+  if (!height && !low) {
+    return ladder->buf_lock;
+  }
+
+  buffer_lock_t *selected = ladder->buf_lock;
+  unsigned selected_diff = ~0U;
+
+  for (int i = -1; i < OUTPUT_LADDER_MAX; i++) {
+    buffer_lock_t *buf_lock = i < 0 ? ladder->buf_lock : ladder->rungs[i];
+
+    pthread_mutex_lock(&buf_lock->lock);
+    unsigned rung_height = buf_lock->buf_list ? buf_lock->buf_list->fmt.height : 0;
+    pthread_mutex_unlock(&buf_lock->lock);
+
+    if (!rung_height) {
+      continue;
+    }
+
+    // res=low picks the smallest height, otherwise the closest one
+    unsigned diff = low ? rung_height : (unsigned)abs((int)rung_height - (int)height);
+
+    if (diff < selected_diff) {
+      selected = buf_lock;
+      selected_diff = diff;
+    }
+  }
+
+  return selected;
+}
@@ -1,6 +1,7 @@
 #pragma once
 
 #include <stdbool.h>
+#include <stdio.h>
 
 struct http_worker_s;
 struct buffer_s;
@@ -8,6 +9,38 @@ struct buffer_s;
 extern struct buffer_lock_s snapshot_lock;
 extern struct buffer_lock_s stream_lock;
 extern struct buffer_lock_s video_lock;
+extern struct buffer_lock_s video_sub_lock;
+extern struct buffer_lock_s video_ts_lock;
+
+#define OUTPUT_LADDER_MAX 3
+
+// additional resolutions of an output, selected with `?res=` or `?height=`
+typedef struct output_ladder_s {
+  struct buffer_lock_s *buf_lock;
+  struct buffer_lock_s *rungs[OUTPUT_LADDER_MAX];
+} output_ladder_t;
+
+#define MAX_OUTPUT_CAMERAS 4
+
+// outputs of a single camera, the first one is served without a prefix
+// and the others under `/camN/`
+typedef struct output_camera_s {
+  output_ladder_t snapshot;
+  output_ladder_t stream;
+  output_ladder_t video;
+  struct buffer_lock_s *video_sub;
+} output_camera_t;
+
+extern output_camera_t output_cameras[MAX_OUTPUT_CAMERAS];
+
+output_camera_t *http_output_camera(struct http_worker_s *worker);
+bool http_output_first_camera(struct http_worker_s *worker, FILE *stream);
+
+#define MAX_OUTPUT_TAPS 8
+
+// frames of a pipeline graph node, served by `/tap?name=`
+struct buffer_lock_s *output_tap_lock(const char *name, bool create);
+struct buffer_lock_s *http_ladder_lock(struct http_worker_s *worker, output_ladder_t *ladder);
 
 // M-JPEG
 void http_snapshot(struct http_worker_s *worker, FILE *stream);
@@ -19,9 +52,25 @@ void http_h264_video(struct http_worker_s *worker, FILE *stream);
 void http_mkv_video(struct http_worker_s *worker, FILE *stream);
 void http_mp4_video(struct http_worker_s *worker, FILE *stream);
 void http_mov_video(struct http_worker_s *worker, FILE *stream);
+void http_mpegts_video(struct http_worker_s *worker, FILE *stream);
+
+// the shared HLS and MPEG-TS muxers register their workers at start,
+// before the encoders size their buffers, see `buffer_lock_notify_workers()`
+void http_hls_register();
+void http_mpegts_register();
 
 // HLS
 void http_m3u8_video(struct http_worker_s *worker, FILE *stream);
+void http_hls_init(struct http_worker_s *worker, FILE *stream);
+void http_hls_segment(struct http_worker_s *worker, FILE *stream);
+void http_hls_part(struct http_worker_s *worker, FILE *stream);
 void http_detect_video(struct http_worker_s *worker, FILE *stream);
 
+// Pipeline taps
+void http_tap(struct http_worker_s *worker, FILE *stream);
+
+// WebSocket
+void http_websocket_stream(struct http_worker_s *worker, FILE *stream);
+void http_websocket_video(struct http_worker_s *worker, FILE *stream);
+
 #define HTTP_LOW_RES_PARAM "res=low"
@@ -0,0 +1,463 @@
+#include "recorder.h"
+
+#include "util/opts/log.h"
+#include "util/mp4/muxer.h"
+#include "device/buffer.h"
+#include "device/buffer_lock.h"
+#include "device/buffer_list.h"
+#include "device/device.h"
+#include "output/output.h"
+
+#include <ctype.h>
+#include <fcntl.h>
+#include <dirent.h>
+#include <inttypes.h>
+#include <time.h>
+#include <sys/time.h>
+#include <sys/stat.h>
+
+#define RECORDER_BATCH_SIZE (1024 * 1024)
+#define RECORDER_BATCHES 8
+#define RECORDER_BATCH_ALIGN 4096
+#define RECORDER_FRAME_OVERHEAD 1024 // moof, mdat and NAL lengths
+#define RECORDER_SEGMENT_EXT ".mp4"
+#define RECORDER_INDEX_EXT ".idx"
+
+typedef struct recorder_index_s {
+  uint64_t time_ms;
+  uint64_t offset;
+} recorder_index_t;
+
+// owned by the capture side until closed, then by the writer thread
+typedef struct recorder_segment_s {
+  char path[RECORDER_PATH_LENGTH + 64];
+  int fd;
+  bool failed;
+
+  uint64_t start_time_us;
+  uint64_t size;
+  uint64_t header_size;
+
+  recorder_index_t *index;
+  unsigned nindex, index_capacity;
+} recorder_segment_t;
+
+typedef struct recorder_batch_s {
+  uint8_t *data;
+  size_t size;
+  uint64_t offset;
+  recorder_segment_t *segment;
+  bool close;
+} recorder_batch_t;
+
+typedef struct recorder_s {
+  const char *name;
+  recorder_options_t *options;
+
+  mp4_muxer_t muxer;
+  recorder_segment_t *segment;
+  bool wait_for_keyframe;
+  bool requested_key_frame;
+
+  pthread_t thread;
+  pthread_mutex_t lock;
+  pthread_cond_t cond_wait;
+  recorder_batch_t batches[RECORDER_BATCHES];
+  unsigned head, submitted;
+} recorder_t;
+
+static recorder_t recorder = {
+  .name = "RECORDER",
+  .lock = PTHREAD_MUTEX_INITIALIZER,
+  .cond_wait = PTHREAD_COND_INITIALIZER,
+};
+
+// only the own `YYYYMMDD-HHMMSS.mmm.mp4` segments are removed,
+// not the DVR events or other files sharing the directory
+static int recorder_is_segment(const struct dirent *entry)
+{
+  const char *pattern = "00000000-000000.000" RECORDER_SEGMENT_EXT;
+  const char *name = entry->d_name;
+
+  for (; *pattern; pattern++, name++) {
+    if (*pattern == '0' ? !isdigit(*name) : *pattern != *name) {
+      return 0;
+    }
+  }
+
+  return !*name;
+}
+
+// segment names are timestamps, so sorting by name removes the oldest ones
+static void recorder_apply_retention(recorder_t *rec)
+{
+  struct dirent **entries = NULL;
+  int n = scandir(rec->options->path, &entries, recorder_is_segment, alphasort);
+
+  for (int i = 0; i < n; i++) {
+    if (n - i > (int)rec->options->max_segments) {
+      char path[RECORDER_PATH_LENGTH + 512];
+
+      snprintf(path, sizeof(path), "%s/%s", rec->options->path, entries[i]->d_name);
+      LOG_VERBOSE(rec, "Removing old segment: %s", path);
+      unlink(path);
+
+      strcpy(path + strlen(path) - strlen(RECORDER_SEGMENT_EXT), RECORDER_INDEX_EXT);
+      unlink(path);
+    }
+    free(entries[i]);
+  }
+
+  free(entries);
+}
+
+static void recorder_write_index(recorder_t *rec, recorder_segment_t *segment)
+{
+  char path[sizeof(segment->path)];
+
+  strcpy(path, segment->path);
+  strcpy(path + strlen(path) - strlen(RECORDER_SEGMENT_EXT), RECORDER_INDEX_EXT);
+
+  FILE *fp = fopen(path, "w");
+  if (!fp) {
+    LOG_INFO(rec, "Cannot write index %s: %s", path, strerror(errno));
+    return;
+  }
+
+  fprintf(fp, "# time_ms offset\n");
+  for (unsigned i = 0; i < segment->nindex; i++) {
+    fprintf(fp, "%" PRIu64 " %" PRIu64 "\n", segment->index[i].time_ms, segment->index[i].offset);
+  }
+  fclose(fp);
+}
+
+static void recorder_close_file(recorder_t *rec, recorder_segment_t *segment, uint64_t size)
+{
+  if (segment->fd >= 0) {
+    // releases the preallocated space that was not used
+    if (ftruncate(segment->fd, size) < 0) {
+      LOG_INFO(rec, "Cannot truncate %s: %s", segment->path, strerror(errno));
+    }
+    close(segment->fd);
+    segment->fd = -1;
+  }
+
+  if (!segment->failed) {
+    recorder_write_index(rec, segment);
+    rec->options->segments++;
+    LOG_VERBOSE(rec, "Closed segment %s (size=%" PRIu64 ", keyframes=%u)", segment->path, size, segment->nindex);
+  }
+
+  free(segment->index);
+  free(segment);
+
+  recorder_apply_retention(rec);
+}
+
+static void recorder_write_batch(recorder_t *rec, recorder_batch_t *batch)
+{
+  recorder_segment_t *segment = batch->segment;
+
+  if (segment->fd < 0 && !segment->failed) {
+    segment->fd = open(segment->path, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if (segment->fd < 0) {
+      LOG_INFO(rec, "Cannot open %s: %s", segment->path, strerror(errno));
+      segment->failed = true;
+      rec->options->errors++;
+    } else if (fallocate(segment->fd, FALLOC_FL_KEEP_SIZE, 0, rec->options->segment_size * 1024LL * 1024LL) < 0) {
+      LOG_DEBUG(rec, "Cannot preallocate %s: %s", segment->path, strerror(errno));
+    }
+  }
+
+  for (size_t written = 0; !segment->failed && written < batch->size; ) {
+    ssize_t ret = pwrite(segment->fd, batch->data + written, batch->size - written, batch->offset + written);
+    if (ret < 0 && errno == EINTR) {
+      continue;
+    } else if (ret <= 0) {
+      LOG_INFO(rec, "Cannot write %s: %s", segment->path, strerror(errno));
+      segment->failed = true;
+      rec->options->errors++;
+      break;
+    }
+    written += ret;
+    rec->options->bytes += ret;
+  }
+
+  if (batch->close) {
+    recorder_close_file(rec, segment, batch->offset + batch->size);
+  }
+}
+
+static void *recorder_thread(void *opaque)
+{
+  recorder_t *rec = opaque;
+
+  while (true) {
+    pthread_mutex_lock(&rec->lock);
+    while (!rec->submitted) {
+      pthread_cond_wait(&rec->cond_wait, &rec->lock);
+    }
+    recorder_batch_t *batch = &rec->batches[rec->head];
+    pthread_mutex_unlock(&rec->lock);
+
+    recorder_write_batch(rec, batch);
+
+    pthread_mutex_lock(&rec->lock);
+    batch->size = 0;
+    batch->segment = NULL;
+    batch->close = false;
+    rec->head = (rec->head + 1) % RECORDER_BATCHES;
+    rec->submitted--;
+    pthread_mutex_unlock(&rec->lock);
+  }
+
+  return NULL;
+}
+
+// the batch being filled is the first one not submitted to the writer,
+// and only the capture side changes which one that is
+static recorder_batch_t *recorder_fill_batch(recorder_t *rec, unsigned *available)
+{
+  pthread_mutex_lock(&rec->lock);
+  unsigned submitted = rec->submitted;
+  recorder_batch_t *batch = &rec->batches[(rec->head + submitted) % RECORDER_BATCHES];
+  pthread_mutex_unlock(&rec->lock);
+
+  if (available) {
+    *available = RECORDER_BATCHES - submitted;
+  }
+  return submitted < RECORDER_BATCHES ? batch : NULL;
+}
+
+static void recorder_submit_batch(recorder_t *rec, recorder_batch_t *batch, bool close)
+{
+  batch->segment = rec->segment;
+  batch->offset = rec->segment->size - batch->size;
+  batch->close = close;
+
+  pthread_mutex_lock(&rec->lock);
+  rec->submitted++;
+  pthread_cond_signal(&rec->cond_wait);
+  pthread_mutex_unlock(&rec->lock);
+}
+
+// all writes of a frame have to fit, so a segment is never left with half of a fragment
+static bool recorder_reserve(recorder_t *rec, size_t size)
+{
+  unsigned available = 0;
+  recorder_batch_t *batch = recorder_fill_batch(rec, &available);
+
+  return batch && (uint64_t)available * RECORDER_BATCH_SIZE - batch->size > size;
+}
+
+static int recorder_write(void *opaque, const uint8_t *data, size_t size)
+{
+  recorder_t *rec = opaque;
+
+  while (size > 0) {
+    recorder_batch_t *batch = recorder_fill_batch(rec, NULL);
+    if (!batch) {
+      return -1;
+    }
+
+    size_t n = MIN(size, RECORDER_BATCH_SIZE - batch->size);
+    memcpy(batch->data + batch->size, data, n);
+    batch->size += n;
+    rec->segment->size += n;
+    if (!rec->muxer.wrote_header) {
+      rec->segment->header_size += n;
+    }
+    data += n;
+    size -= n;
+
+    if (batch->size == RECORDER_BATCH_SIZE) {
+      recorder_submit_batch(rec, batch, false);
+    }
+  }
+
+  return 0;
+}
+
+static void recorder_open_segment(recorder_t *rec, buffer_t *buf)
+{
+  recorder_segment_t *segment = calloc(1, sizeof(recorder_segment_t));
+  struct timeval now;
+  struct tm tm;
+
+  gettimeofday(&now, NULL);
+  localtime_r(&now.tv_sec, &tm);
+
+  int n = snprintf(segment->path, sizeof(segment->path), "%s/", rec->options->path);
+  n += strftime(segment->path + n, sizeof(segment->path) - n, "%Y%m%d-%H%M%S", &tm);
+  snprintf(segment->path + n, sizeof(segment->path) - n, ".%03u" RECORDER_SEGMENT_EXT,
+    (unsigned)(now.tv_usec / 1000));
+
+  segment->fd = -1;
+  segment->start_time_us = buf->captured_time_us;
+  rec->segment = segment;
+
+  // each segment starts with its own header
+  mp4_muxer_reset(&rec->muxer);
+
+  LOG_VERBOSE(rec, "Opened segment %s", segment->path);
+}
+
+static void recorder_close_segment(recorder_t *rec)
+{
+  recorder_batch_t *batch = recorder_fill_batch(rec, NULL);
+
+  // the reservation keeps one batch free to close the segment
+  if (batch) {
+    recorder_submit_batch(rec, batch, true);
+  }
+  rec->segment = NULL;
+}
+
+static bool recorder_segment_full(recorder_t *rec, buffer_t *buf)
+{
+  recorder_segment_t *segment = rec->segment;
+
+  return buf->captured_time_us - segment->start_time_us >= rec->options->segment_duration * 1000LL * 1000LL ||
+    segment->size >= rec->options->segment_size * 1024LL * 1024LL;
+}
+
+static void recorder_add_index(recorder_segment_t *segment, uint64_t time_us, uint64_t offset)
+{
+  if (segment->nindex >= segment->index_capacity) {
+    unsigned capacity = MAX(segment->index_capacity * 2, 64);
+    recorder_index_t *index = realloc(segment->index, capacity * sizeof(recorder_index_t));
+    if (!index) {
+      return;
+    }
+    segment->index = index;
+    segment->index_capacity = capacity;
+  }
+
+  segment->index[segment->nindex++] = (recorder_index_t){
+    .time_ms = (time_us - segment->start_time_us) / 1000,
+    .offset = offset
+  };
+}
+
+// the muxer writes the previous frame, so the index refers to that one
+static int recorder_write_frame(recorder_t *rec, buffer_t *buf, uint64_t time_us)
+{
+  uint64_t offset = rec->segment->size;
+  bool sample_keyframe = rec->muxer.has_sample && rec->muxer.sample_keyframe;
+  uint64_t sample_time_us = rec->muxer.sample_time_us;
+  int ret;
+
+  if (buf) {
+    ret = mp4_muxer_write_frame(&rec->muxer, &buf->h264, time_us, buf->flags.is_keyframe);
+  } else {
+    ret = mp4_muxer_flush(&rec->muxer, time_us);
+  }
+
+  if (ret > 0) {
+    rec->options->frames++;
+
+    // the header is written together with the first fragment
+    if (sample_keyframe) {
+      recorder_add_index(rec->segment, sample_time_us, MAX(offset, rec->segment->header_size));
+    }
+  }
+  return ret;
+}
+
+static bool recorder_needs_buffer(buffer_lock_t *buf_lock)
+{
+  return true;
+}
+
+static void recorder_capture(buffer_lock_t *buf_lock, buffer_t *buf)
+{
+  recorder_t *rec = &recorder;
+  bool keyframe = buf->flags.is_keyframe;
+  bool params_changed = rec->segment && keyframe &&
+    mp4_muxer_params_changed(&rec->muxer, &buf->h264, keyframe);
+
+  if (params_changed) {
+    LOG_INFO(rec, "The H264 parameters changed, starting a new segment.");
+  }
+
+  if (rec->segment && keyframe && (params_changed || recorder_segment_full(rec, buf))) {
+    if (recorder_reserve(rec, rec->muxer.sample_size + RECORDER_FRAME_OVERHEAD)) {
+      recorder_write_frame(rec, NULL, buf->captured_time_us);
+    }
+    recorder_close_segment(rec);
+  }
+
+  if (!keyframe && (!rec->segment || rec->wait_for_keyframe)) {
+    if (!rec->requested_key_frame) {
+      device_video_force_key(buf->buf_list->dev);
+      rec->requested_key_frame = true;
+    }
+    return;
+  }
+
+  // the writer did not keep up, skip the rest of the GOP
+  if (!recorder_reserve(rec, buf->used + rec->muxer.sample_size + 2 * RECORDER_FRAME_OVERHEAD)) {
+    LOG_DEBUG(rec, "Writer queue full, dropping frame.");
+    rec->options->dropped++;
+    rec->wait_for_keyframe = true;
+    rec->requested_key_frame = false;
+    return;
+  }
+
+  rec->wait_for_keyframe = false;
+  rec->requested_key_frame = false;
+
+  if (!rec->segment) {
+    recorder_open_segment(rec, buf);
+  }
+
+  rec->muxer.width = buf->buf_list->fmt.width;
+  rec->muxer.height = buf->buf_list->fmt.height;
+
+  if (recorder_write_frame(rec, buf, buf->captured_time_us) < 0) {
+    rec->options->dropped++;
+    rec->wait_for_keyframe = true;
+  }
+}
+
+int recorder_server(recorder_options_t *options)
+{
+  recorder_t *rec = &recorder;
+
+  if (!options->max_segments) {
+    LOG_ERROR(rec, "The --recorder-max_segments has to keep at least 1 segment.");
+  }
+
+  rec->options = options;
+  rec->muxer = (mp4_muxer_t){
+    .name = rec->name,
+    .opaque = rec,
+    .write_packet = recorder_write,
+  };
+
+  if (mkdir(options->path, 0755) < 0 && errno != EEXIST) {
+    LOG_ERROR(rec, "Cannot create %s: %s", options->path, strerror(errno));
+  }
+
+  for (int i = 0; i < RECORDER_BATCHES; i++) {
+    if (posix_memalign((void **)&rec->batches[i].data, RECORDER_BATCH_ALIGN, RECORDER_BATCH_SIZE) != 0) {
+      LOG_ERROR(rec, "Cannot allocate write batches.");
+    }
+  }
+
+  if (pthread_create(&rec->thread, NULL, recorder_thread, rec) != 0) {
+    LOG_ERROR(rec, "Cannot start writer thread.");
+  }
+
+  buffer_lock_register_check_streaming(&video_lock, recorder_needs_buffer);
+  buffer_lock_register_notify_buffer(&video_lock, "recorder", recorder_capture);
+
+  LOG_INFO(rec, "Recording to %s (segment=%us or %uMiB, keep=%u)",
+    options->path, options->segment_duration, options->segment_size, options->max_segments);
+
+  options->running = true;
+  return 0;
+
+error:
+  return -1;
+}
@@ -0,0 +1,24 @@
+#pragma once
+
+#include <stdio.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <sys/types.h>
+
+#define RECORDER_PATH_LENGTH 256
+
+typedef struct recorder_options_s {
+  bool running;
+  char path[RECORDER_PATH_LENGTH];
+  uint segment_duration; // seconds
+  uint segment_size; // MiB
+  uint max_segments;
+  int segments;
+  int frames;
+  int dropped;
+  int errors;
+  uint64_t bytes;
+} recorder_options_t;
+
+// continuous recording of fragmented MP4 segments
+int recorder_server(recorder_options_t *options);
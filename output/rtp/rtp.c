@@ -0,0 +1,221 @@
+#include "rtp.h"
+
+#include "util/opts/log.h"
+#include "util/http/http.h"
+#include "util/h264/h264.h"
+#include "util/rtp/rtp.h"
+#include "util/base64/base64.h"
+#include "device/buffer.h"
+#include "device/buffer_lock.h"
+#include "device/buffer_list.h"
+#include "output/output.h"
+
+#include <sys/socket.h>
+#include <arpa/inet.h>
+
+#define RTP_BATCH_PACKETS 32
+#define RTP_PAYLOAD_TYPE 96
+#define RTP_UDP_IP_OVERHEAD 28
+#define RTP_MIN_MTU 576
+#define RTP_DEFAULT_FRAME_INTERVAL_US (1000 * 1000 / 30)
+
+typedef struct rtp_sender_s {
+  const char *name;
+  rtp_options_t *options;
+  int fd;
+  struct sockaddr_in addr;
+  rtp_packetizer_t packetizer;
+  uint64_t last_time_us;
+
+  pthread_mutex_t lock;
+  h264_params_t params;
+} rtp_sender_t;
+
+static rtp_sender_t rtp_sender = {
+  .name = "RTP",
+  .fd = -1,
+  .lock = PTHREAD_MUTEX_INITIALIZER,
+};
+
+static void rtp_update_parameter_sets(rtp_sender_t *sender, buffer_t *buf)
+{
+  if (!buf->flags.is_keyframe) {
+    return;
+  }
+
+  h264_params_t params;
+  buffer_list_get_h264_params(buf->buf_list, &params);
+
+  pthread_mutex_lock(&sender->lock);
+  if (sender->params.version != params.version) {
+    sender->params = params;
+  }
+  pthread_mutex_unlock(&sender->lock);
+}
+
+static int rtp_send_frame(buffer_lock_t *buf_lock, buffer_t *buf, int frame, rtp_sender_t *sender)
+{
+  struct mmsghdr msgs[RTP_BATCH_PACKETS];
+  struct iovec iovs[RTP_BATCH_PACKETS][2];
+
+  rtp_update_parameter_sets(sender, buf);
+
+  int npackets = rtp_packetize_h264(&sender->packetizer, &buf->h264,
+    rtp_h264_timestamp(buf->captured_time_us));
+  if (npackets < 0) {
+    return -1;
+  }
+
+  // spread the frame over half of the frame interval to avoid bursts
+  uint64_t interval_us = buf->captured_time_us - sender->last_time_us;
+  if (!sender->last_time_us || interval_us > 1000 * 1000) {
+    interval_us = RTP_DEFAULT_FRAME_INTERVAL_US;
+  }
+  sender->last_time_us = buf->captured_time_us;
+
+  int nbatches = (npackets + RTP_BATCH_PACKETS - 1) / RTP_BATCH_PACKETS;
+  uint64_t pace_us = nbatches > 1 ? interval_us / 2 / nbatches : 0;
+
+  for (int i = 0; i < npackets; i += RTP_BATCH_PACKETS) {
+    int n = MIN(npackets - i, RTP_BATCH_PACKETS);
+
+    for (int j = 0; j < n; j++) {
+      rtp_packet_t *packet = &sender->packetizer.packets[i + j];
+
+      iovs[j][0].iov_base = packet->header;
+      iovs[j][0].iov_len = packet->header_size;
+      iovs[j][1].iov_base = (void*)packet->payload;
+      iovs[j][1].iov_len = packet->payload_size;
+
+      msgs[j] = (struct mmsghdr){
+        .msg_hdr = {
+          .msg_name = &sender->addr,
+          .msg_namelen = sizeof(sender->addr),
+          .msg_iov = iovs[j],
+          .msg_iovlen = 2,
+        },
+      };
+    }
+
+    int sent = sendmmsg(sender->fd, msgs, n, 0);
+    if (sent < 0) {
+      LOG_VERBOSE(sender, "Failed to send %d packets: %s", n, strerror(errno));
+      sent = 0;
+    }
+
+    sender->options->packets += sent;
+    sender->options->dropped += n - sent;
+
+    if (pace_us && i + n < npackets) {
+      usleep(pace_us);
+    }
+  }
+
+  sender->options->frames++;
+  return 1;
+}
+
+static void *rtp_server_thread(void *opaque)
+{
+  rtp_sender_t *sender = opaque;
+  bool replay_gop = true;
+
+  while (true) {
+    buffer_lock_write_loop2(&video_lock, 0, 0, replay_gop, (buffer_write_fn)rtp_send_frame, sender);
+
+    // the group already received the cached frames, and would see them twice
+    replay_gop = false;
+    usleep(100 * 1000);
+  }
+
+  return NULL;
+}
+
+int rtp_server(rtp_options_t *options)
+{
+  static pthread_t rtp_thread;
+  rtp_sender_t *sender = &rtp_sender;
+  unsigned char ttl = options->ttl;
+
+  sender->options = options;
+
+  if (options->mtu < RTP_MIN_MTU) {
+    LOG_ERROR(sender, "The RTP MTU %u is too small, at least %u is required.", options->mtu, RTP_MIN_MTU);
+  }
+
+  sender->addr.sin_family = AF_INET;
+  sender->addr.sin_port = htons(options->port);
+  if (inet_pton(AF_INET, options->group, &sender->addr.sin_addr) != 1) {
+    LOG_ERROR(sender, "Invalid RTP address: %s", options->group);
+  }
+
+  sender->fd = socket(AF_INET, SOCK_DGRAM | SOCK_CLOEXEC, 0);
+  if (sender->fd < 0) {
+    LOG_ERROR(sender, "Cannot open socket: %s", strerror(errno));
+  }
+
+  if (setsockopt(sender->fd, IPPROTO_IP, IP_MULTICAST_TTL, &ttl, sizeof(ttl)) < 0) {
+    LOG_ERROR(sender, "Cannot set multicast TTL: %s", strerror(errno));
+  }
+
+  sender->packetizer = (rtp_packetizer_t){
+    .name = sender->name,
+    .payload_type = RTP_PAYLOAD_TYPE,
+    .ssrc = (uint32_t)get_monotonic_time_us(NULL, NULL) ^ getpid(),
+    .max_payload = options->mtu - RTP_UDP_IP_OVERHEAD - RTP_HEADER_SIZE,
+  };
+
+  LOG_INFO(sender, "Sending RTP to %s:%u (ttl=%u, mtu=%u)", options->group, options->port, options->ttl, options->mtu);
+
+  pthread_create(&rtp_thread, NULL, rtp_server_thread, sender);
+  options->running = true;
+  return 0;
+
+error:
+  if (sender->fd >= 0) {
+    close(sender->fd);
+    sender->fd = -1;
+  }
+  return -1;
+}
+
+void http_rtp_sdp(http_worker_t *worker, FILE *stream)
+{
+  if (!http_output_first_camera(worker, stream)) {
+    return;
+  }
+
+  rtp_sender_t *sender = &rtp_sender;
+  char sps[BASE64_ENCODED_SIZE(sizeof(sender->params.sps))];
+  char pps[BASE64_ENCODED_SIZE(sizeof(sender->params.pps))];
+  unsigned profile_level_id = 0x42E01F;
+
+  if (!sender->options || !sender->options->running) {
+    http_404(stream, "RTP is not enabled.\n");
+    return;
+  }
+
+  pthread_mutex_lock(&sender->lock);
+  if (sender->params.sps_size >= 4) {
+    profile_level_id = sender->params.sps[1] << 16 | sender->params.sps[2] << 8 | sender->params.sps[3];
+  }
+  base64_encode(sender->params.sps, sender->params.sps_size, sps, sizeof(sps));
+  base64_encode(sender->params.pps, sender->params.pps_size, pps, sizeof(pps));
+  pthread_mutex_unlock(&sender->lock);
+
+  http_write_responsef(stream, "200 OK", "application/sdp",
+    "v=0\r\n"
+    "o=- 0 0 IN IP4 0.0.0.0\r\n"
+    "s=camera-streamer\r\n"
+    "c=IN IP4 %s/%u\r\n"
+    "t=0 0\r\n"
+    "m=video %u RTP/AVP %d\r\n"
+    "a=rtpmap:%d H264/%d\r\n"
+    "a=fmtp:%d packetization-mode=1;profile-level-id=%06X%s%s%s%s\r\n"
+    "a=recvonly\r\n",
+    sender->options->group, sender->options->ttl,
+    sender->options->port, RTP_PAYLOAD_TYPE,
+    RTP_PAYLOAD_TYPE, RTP_H264_CLOCK_RATE,
+    RTP_PAYLOAD_TYPE, profile_level_id,
+    sps[0] ? ";sprop-parameter-sets=" : "", sps, pps[0] ? "," : "", pps);
+}
@@ -0,0 +1,24 @@
+#pragma once
+
+#include <stdio.h>
+#include <stdbool.h>
+#include <sys/types.h>
+
+#define RTP_OPTIONS_LENGTH 64
+
+typedef struct http_worker_s http_worker_t;
+
+typedef struct rtp_options_s {
+  bool running;
+  char group[RTP_OPTIONS_LENGTH];
+  uint port;
+  uint ttl;
+  uint mtu;
+  int frames;
+  int packets;
+  int dropped;
+} rtp_options_t;
+
+// RTP multicast
+void http_rtp_sdp(http_worker_t *worker, FILE *stream);
+int rtp_server(rtp_options_t *options);
@@ -8,6 +8,7 @@ extern "C" {
 #include "util/opts/log.h"
 #include "util/opts/fourcc.h"
 #include "util/opts/control.h"
+#include "util/jpeg/jpeg.h"
 #include "output/output.h"
 #include "rtsp.h"
 
@@ -27,53 +28,87 @@ extern "C" {
 #include <BasicUsageEnvironment.hh>
 #include <RTSPServerSupportingHTTPStreaming.hh>
 #include <OnDemandServerMediaSubsession.hh>
-#include <H264VideoStreamFramer.hh>
+#include <H264VideoStreamDiscreteFramer.hh>
 #include <H264VideoRTPSink.hh>
+#include <JPEGVideoSource.hh>
+#include <JPEGVideoRTPSink.hh>
 
 static pthread_t rtsp_thread;
-static std::set<class DynamicH264Stream *> rtsp_streams;
+static TaskScheduler *rtsp_scheduler;
+static EventTriggerId rtsp_frame_trigger;
 static std::recursive_mutex rtsp_streams_lock;
 static rtsp_options_t *rtsp_options;
 
-static const char *stream_name = "stream.h264";
+class DynamicStream;
+
+// each session is served from a single source shared by all its clients
+typedef struct rtsp_session_s {
+  const char *name;
+  buffer_lock_t *buf_lock;
+  bool jpeg;
+  std::set<DynamicStream *> streams;
+} rtsp_session_t;
+
+static rtsp_session_t rtsp_sessions[] = {
+  { "stream.h264", &video_lock },
+  { "main.h264", &video_lock },
+  { "sub.h264", &video_sub_lock },
+  { "stream.mjpeg", &stream_lock, true },
+  { "cam1.h264", output_cameras[1].video.buf_lock },
+  { "cam2.h264", output_cameras[2].video.buf_lock },
+  { "cam3.h264", output_cameras[3].video.buf_lock },
+  {}
+};
 
-class DynamicH264Stream : public FramedSource
+class DynamicStream
 {
 public:
-  DynamicH264Stream(UsageEnvironment& env)
-    : FramedSource(env)
+  DynamicStream(rtsp_session_t *session)
+    : session(session)
   {
-    had_key_frame = false;
+    had_key_frame = session->jpeg;
     running = false;
     requested_key_frame = false;
     locked_buf = NULL;
-    locked_buf_offset = 0;
   }
 
-  void doGetNextFrame()
+  virtual ~DynamicStream()
+  {
+    stop();
+  }
+
+  virtual FramedSource *source() = 0;
+  virtual bool send_buffer() = 0;
+
+  void start()
   {
     if (!running) {
       std::unique_lock lk(rtsp_streams_lock);
-      rtsp_streams.insert(this);
-      running = True;
+      session->streams.insert(this);
+      running = true;
     }
 
-    if (send_buffer()) {
-      afterGetting(this);
-    }
+    deliver();
   }
 
-  void doStopGettingFrames()
+  void stop()
   {
     if (running) {
       std::unique_lock lk(rtsp_streams_lock);
-      rtsp_streams.erase(this);
+      session->streams.erase(this);
       running = false;
     }
 
     set_buffer(NULL);
   }
 
+  void deliver()
+  {
+    if (send_buffer()) {
+      FramedSource::afterGetting(source());
+    }
+  }
+
   void receive_buf(buffer_t *buf)
   {
     std::unique_lock lk(lock);
@@ -82,7 +117,7 @@ public:
       return;
     }
 
-    if (locked_buf || !isCurrentlyAwaitingData()) {
+    if (locked_buf || !source()->isCurrentlyAwaitingData()) {
       if (rtsp_options) {
         rtsp_options->dropped++;
       }
@@ -118,10 +153,48 @@ public:
     }
 
     locked_buf = buf;
-    locked_buf_offset = 0;
     buffer_use(buf);
+
+    if (buf) {
+      gettimeofday(&locked_time, NULL);
+    }
+  }
+
+  rtsp_session_t *session;
+  bool running;
+  bool had_key_frame;
+  bool requested_key_frame;
+
+  std::recursive_mutex lock;
+  buffer_t *locked_buf;
+  struct timeval locked_time;
+};
+
+class DynamicH264Stream : public FramedSource, public DynamicStream
+{
+public:
+  DynamicH264Stream(UsageEnvironment& env, rtsp_session_t *session)
+    : FramedSource(env), DynamicStream(session)
+  {
+    locked_nal = 0;
+  }
+
+  FramedSource *source()
+  {
+    return this;
+  }
+
+  void doGetNextFrame()
+  {
+    start();
+  }
+
+  void doStopGettingFrames()
+  {
+    stop();
   }
 
+  // delivers one NAL unit (without start code) of the indexed buffer per call
   bool send_buffer()
   {
     std::unique_lock lk(lock);
@@ -132,53 +205,173 @@ public:
     if (!isCurrentlyAwaitingData())
       return false;
 
-    if (locked_buf->used - locked_buf_offset > fMaxSize) {
-      fNumTruncatedBytes = locked_buf->used - fMaxSize - locked_buf_offset;
+    const h264_index_t *index = &locked_buf->h264;
+
+    while (locked_nal < index->nnals && index->nals[locked_nal].type == H264_NAL_AUD) {
+      locked_nal++;
+    }
+
+    if (locked_nal >= index->nnals) {
+      release_buffer();
+      return false;
+    }
+
+    const h264_nal_t *nal = &index->nals[locked_nal++];
+
+    if (nal->size > fMaxSize) {
+      fNumTruncatedBytes = nal->size - fMaxSize;
       fFrameSize = fMaxSize;
+      rtsp_options->truncated++;
     } else {
       fNumTruncatedBytes = 0;
-      fFrameSize = locked_buf->used - locked_buf_offset;
+      fFrameSize = nal->size;
+    }
+
+    memcpy(fTo, nal->data, fFrameSize);
+    fPresentationTime = locked_time;
+    fDurationInMicroseconds = 0;
+
+    if (locked_nal >= index->nnals) {
+      release_buffer();
     }
+    return true;
+  }
+
+  void release_buffer()
+  {
+    set_buffer(NULL);
+    locked_nal = 0;
+  }
+
+  unsigned locked_nal;
+};
+
+// RTP/JPEG (RFC 2435) carries only the scan, the headers are rebuilt by the receiver
+class DynamicJPEGStream : public JPEGVideoSource, public DynamicStream
+{
+public:
+  DynamicJPEGStream(UsageEnvironment& env, rtsp_session_t *session)
+    : JPEGVideoSource(env), DynamicStream(session)
+  {
+    memset(&frame, 0, sizeof(frame));
+  }
+
+  FramedSource *source()
+  {
+    return this;
+  }
 
-    memcpy(fTo, (char*)locked_buf->start + locked_buf_offset, fFrameSize);
-    locked_buf_offset += fFrameSize;
+  void doGetNextFrame()
+  {
+    start();
+  }
 
-    if (locked_buf->used == locked_buf_offset) {
+  void doStopGettingFrames()
+  {
+    stop();
+  }
+
+  bool send_buffer()
+  {
+    std::unique_lock lk(lock);
+
+    if (!locked_buf)
+      return false;
+
+    if (!isCurrentlyAwaitingData())
+      return false;
+
+    bool parsed = jpeg_parse_frame((const uint8_t *)locked_buf->start, locked_buf->used, &frame) >= 0;
+
+    // the RTP/JPEG header stores dimensions in 8 pixel blocks
+    if (!parsed || frame.width > 2040 || frame.height > 2040) {
+      LOG_DEBUG(locked_buf, "Cannot send JPEG frame over RTP (%ux%u).", frame.width, frame.height);
+      rtsp_options->dropped++;
       set_buffer(NULL);
-    } else if (rtsp_options->allow_truncated) {
+      return false;
+    }
+
+    if (frame.scan_size > fMaxSize) {
+      fNumTruncatedBytes = frame.scan_size - fMaxSize;
+      fFrameSize = fMaxSize;
       rtsp_options->truncated++;
-      set_buffer(NULL);
+    } else {
+      fNumTruncatedBytes = 0;
+      fFrameSize = frame.scan_size;
     }
+
+    memcpy(fTo, frame.scan, fFrameSize);
+    fPresentationTime = locked_time;
+    fDurationInMicroseconds = 0;
+    set_buffer(NULL);
     return true;
   }
 
-  Boolean running;
-  Boolean had_key_frame;
-  Boolean requested_key_frame;
+  u_int8_t type()
+  {
+    // types 64-127 make JPEGVideoRTPSink add the restart marker header
+    return frame.type | (frame.restart_interval ? 64 : 0);
+  }
 
-  std::recursive_mutex lock;
-  buffer_t *locked_buf;
-  unsigned locked_buf_offset;
+  u_int8_t qFactor()
+  {
+    return 255; // tables are sent in-band
+  }
+
+  u_int8_t width()
+  {
+    return (frame.width + 7) / 8;
+  }
+
+  u_int8_t height()
+  {
+    return (frame.height + 7) / 8;
+  }
+
+  u_int8_t const* quantizationTables(u_int8_t& precision, u_int16_t& length)
+  {
+    precision = 0;
+    length = frame.nqtables * JPEG_QTABLE_SIZE;
+    return frame.qtables;
+  }
+
+  u_int16_t restartInterval()
+  {
+    return frame.restart_interval;
+  }
+
+  jpeg_frame_t frame;
 };
 
-class DynamicH264VideoFileServerMediaSubsession : public OnDemandServerMediaSubsession
+class DynamicServerMediaSubsession : public OnDemandServerMediaSubsession
 {
 public:
-  DynamicH264VideoFileServerMediaSubsession(UsageEnvironment& env, Boolean reuseFirstSource)
-    : OnDemandServerMediaSubsession(env, reuseFirstSource)
+  DynamicServerMediaSubsession(UsageEnvironment& env, rtsp_session_t *session)
+    : OnDemandServerMediaSubsession(env, true), session(session)
   {
   }
 
   virtual FramedSource* createNewStreamSource(unsigned clientSessionId, unsigned& estBitrate)
   {
+    if (session->jpeg) {
+      estBitrate = 5000; // kbps, estimate
+      return new DynamicJPEGStream(envir(), session);
+    }
+
     estBitrate = 500; // kbps, estimate
-    return H264VideoStreamFramer::createNew(envir(), new DynamicH264Stream(envir()));
+    return H264VideoStreamDiscreteFramer::createNew(envir(), new DynamicH264Stream(envir(), session));
   }
 
   virtual RTPSink* createNewRTPSink(Groupsock* rtpGroupsock, unsigned char rtpPayloadTypeIfDynamic, FramedSource* /*inputSource*/)
   {
+    if (session->jpeg) {
+      return JPEGVideoRTPSink::createNew(envir(), rtpGroupsock);
+    }
+
     return H264VideoRTPSink::createNew(envir(), rtpGroupsock, rtpPayloadTypeIfDynamic);
   }
+
+  rtsp_session_t *session;
 };
 
 class DynamicRTSPServer: public RTSPServerSupportingHTTPStreaming
@@ -209,27 +402,55 @@ protected:
 protected: // redefined virtual functions
   virtual ServerMediaSession* lookupServerMediaSession(char const* streamName, Boolean isFirstLookupInSession)
   {
-    if (strcmp(streamName, stream_name) == 0) {
+    rtsp_session_t *session = NULL;
+
+    for (int i = 0; rtsp_sessions[i].name; i++) {
+      if (strcmp(streamName, rtsp_sessions[i].name) == 0) {
+        session = &rtsp_sessions[i];
+        break;
+      }
+    }
+
+    // the list is cleared under the lock before the camera gets closed
+    buffer_lock_t *buf_lock = session ? session->buf_lock : NULL;
+    unsigned sizeimage = 0;
+
+    if (buf_lock) {
+      pthread_mutex_lock(&buf_lock->lock);
+      if (buf_lock->buf_list) {
+        sizeimage = buf_lock->buf_list->fmt.sizeimage;
+
+        // joining a running source, make the next frame decodable (rate-limited)
+        if (isFirstLookupInSession && !session->jpeg && RTSPServer::lookupServerMediaSession(streamName)) {
+          device_video_force_key(buf_lock->buf_list->dev);
+        }
+      } else {
+        session = NULL;
+      }
+      pthread_mutex_unlock(&buf_lock->lock);
+    }
+
+    if (session) {
       LOG_INFO(NULL, "Requesting %s stream...", streamName);
     } else {
       LOG_INFO(NULL, "No stream available: '%s'", streamName);
       return NULL;
     }
 
+    // the session and its source are shared by all clients
     auto sms = RTSPServer::lookupServerMediaSession(streamName);
-
-    if (sms && isFirstLookupInSession) { 
-      // Remove the existing "ServerMediaSession" and create a new one, in case the underlying
-      // file has changed in some way:
-      removeServerMediaSession(sms); 
-      sms = NULL;
+    if (sms) {
+      return sms;
     }
 
-    sms = ServerMediaSession::createNew(envir(), streamName, streamName, "streamed by the LIVE555 Media Server");;
-    OutPacketBuffer::maxSize = 2000000; // allow for some possibly large H.264 frames
+    sms = ServerMediaSession::createNew(envir(), streamName, streamName, "streamed by the LIVE555 Media Server");
 
-    auto subsession = new DynamicH264VideoFileServerMediaSubsession(envir(), false);
-    sms->addSubsession(subsession);
+    // a single NAL or JPEG scan has to fit, it is never larger than the biggest encoded frame
+    if (sizeimage > OutPacketBuffer::maxSize) {
+      OutPacketBuffer::maxSize = sizeimage;
+    }
+
+    sms->addSubsession(new DynamicServerMediaSubsession(envir(), session));
     addServerMediaSession(sms);
     return sms;
   }
@@ -238,39 +459,66 @@ protected: // redefined virtual functions
 static void rtsp_frame_finish()
 {
   std::unique_lock lk(rtsp_streams_lock);
-  for (auto *stream : rtsp_streams) {
-    if (stream->send_buffer()) {
-      stream->afterGetting(stream);
+  int clients = 0;
+
+  for (int i = 0; rtsp_sessions[i].name; i++) {
+    for (auto *stream : rtsp_sessions[i].streams) {
+      stream->deliver();
     }
+    clients += rtsp_sessions[i].streams.size();
   }
+
   if (rtsp_options) {
-    rtsp_options->clients = rtsp_streams.size();
+    rtsp_options->clients = clients;
   }
 }
 
+static void rtsp_frame_event(void *clientData)
+{
+  rtsp_frame_finish();
+}
+
 static void *rtsp_server_thread(void *opaque)
 {
   UsageEnvironment* env = (UsageEnvironment*)opaque;
-  BasicTaskScheduler0* taskScheduler = (BasicTaskScheduler*)&env->taskScheduler();
 
-  while (true) {
-    rtsp_frame_finish();
-    taskScheduler->SingleStep(0);
-  }
+  // blocks in `select()` until a client request or `rtsp_frame_trigger`
+  env->taskScheduler().doEventLoop();
   return NULL;
 }
 
-static bool rtsp_h264_needs_buffer(buffer_lock_t *buf_lock)
+// encoders of sessions without clients stay paused
+static bool rtsp_needs_buffer(buffer_lock_t *buf_lock)
 {
   std::unique_lock lk(rtsp_streams_lock);
-  return rtsp_streams.size() > 0;
+
+  for (int i = 0; rtsp_sessions[i].name; i++) {
+    if (rtsp_sessions[i].buf_lock == buf_lock && !rtsp_sessions[i].streams.empty()) {
+      return true;
+    }
+  }
+  return false;
 }
 
-static void rtsp_h264_capture(buffer_lock_t *buf_lock, buffer_t *buf)
+static void rtsp_capture(buffer_lock_t *buf_lock, buffer_t *buf)
 {
   std::unique_lock lk(rtsp_streams_lock);
-  for (auto *stream : rtsp_streams) {
-    stream->receive_buf(buf);
+  bool received = false;
+
+  for (int i = 0; rtsp_sessions[i].name; i++) {
+    if (rtsp_sessions[i].buf_lock != buf_lock) {
+      continue;
+    }
+
+    for (auto *stream : rtsp_sessions[i].streams) {
+      stream->receive_buf(buf);
+      received = true;
+    }
+  }
+
+  // deliver on the live555 thread, `triggerEvent()` is safe to call from other threads
+  if (received) {
+    rtsp_scheduler->triggerEvent(rtsp_frame_trigger, NULL);
   }
 }
 
@@ -281,6 +529,8 @@ extern "C" int rtsp_server(rtsp_options_t *options)
   // Begin by setting up our usage environment:
   TaskScheduler* scheduler = BasicTaskScheduler::createNew();
   UsageEnvironment* env = BasicUsageEnvironment::createNew(*scheduler);
+  rtsp_scheduler = scheduler;
+  rtsp_frame_trigger = scheduler->createEventTrigger(rtsp_frame_event);
   UserAuthenticationDatabase* authDB = NULL;
 
 #ifdef ACCESS_CONTROL
@@ -306,8 +556,18 @@ extern "C" int rtsp_server(rtsp_options_t *options)
   //   LOG_INFO(NULL, "The RTSP-over-HTTP is not available.");
   // }
 
-  buffer_lock_register_check_streaming(&video_lock, rtsp_h264_needs_buffer);
-  buffer_lock_register_notify_buffer(&video_lock, rtsp_h264_capture);
+  for (int i = 0; rtsp_sessions[i].name; i++) {
+    bool registered = false;
+
+    for (int j = 0; j < i; j++) {
+      registered |= rtsp_sessions[j].buf_lock == rtsp_sessions[i].buf_lock;
+    }
+
+    if (!registered) {
+      buffer_lock_register_check_streaming(rtsp_sessions[i].buf_lock, rtsp_needs_buffer);
+      buffer_lock_register_notify_buffer(rtsp_sessions[i].buf_lock, "rtsp", rtsp_capture);
+    }
+  }
 
   pthread_create(&rtsp_thread, NULL, rtsp_server_thread, env);
   options->running = true;
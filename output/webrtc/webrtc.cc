@@ -10,7 +10,7 @@ extern "C" {
 #include "util/opts/fourcc.h"
 #include "util/opts/control.h"
 #include "util/opts/opts.h"
-#include "device/buffer.h"
+#include "util/rtp/rtp.h"
 };
 
 #include "util/opts/helpers.hh"
@@ -27,8 +27,8 @@ extern "C" {
 #include <set>
 #include <rtc/peerconnection.hpp>
 #include <rtc/rtcpsrreporter.hpp>
-#include <rtc/h264rtppacketizer.hpp>
-#include <rtc/h264packetizationhandler.hpp>
+#include <rtc/mediachainablehandler.hpp>
+#include <rtc/mediahandlerrootelement.hpp>
 #include <rtc/rtcpnackresponder.hpp>
 
 #include "third_party/magic_enum/include/magic_enum.hpp"
@@ -43,11 +43,22 @@ static std::mutex webrtc_clients_lock;
 static const auto webrtc_client_lock_timeout = 3 * 1000ms;
 static const auto webrtc_client_max_json_body = 10 * 1024;
 static const auto webrtc_client_video_payload_type = 102; // H264
+static const auto webrtc_client_max_rtp_payload = 1200; // leave room for SRTP and TURN
 static rtc::Configuration webrtc_configuration = {
   // .iceServers = { rtc::IceServer("stun:stun.l.google.com:19302") },
   .disableAutoNegotiation = true
 };
 
+// The frame is packetized once into serialized RTP packets shared by all clients,
+// each client only rewrites the RTP headers in place before sending.
+static rtp_packetizer_t webrtc_packetizer = {
+  .name = "WEBRTC",
+  .payload_type = webrtc_client_video_payload_type,
+  .max_payload = webrtc_client_max_rtp_payload
+};
+static std::vector<std::byte> webrtc_packets;
+static std::vector<size_t> webrtc_packet_offsets;
+
 struct ClientTrackData
 {
   std::shared_ptr<rtc::Track> track;
@@ -111,10 +122,10 @@ public:
     return video->wantsFrame();
   }
 
-  void pushFrame(buffer_t *buf)
+  bool acceptsFrame(buffer_t *buf)
   {
     if (!video || !video->track) {
-      return;
+      return false;
     }
 
     if (!had_key_frame) {
@@ -126,12 +137,24 @@ public:
         device_video_force_key(buf->buf_list->dev);
         requested_key_frame = true;
       }
-      return;
+      return false;
     }
 
-    rtc::binary data((std::byte*)buf->start, (std::byte*)buf->start + buf->used);
+    return true;
+  }
+
+  void pushPackets(std::vector<std::byte> &packets, const std::vector<size_t> &offsets)
+  {
     video->sendTime();
-    video->track->send(data);
+
+    auto rtpConfig = video->sender->rtpConfig;
+
+    for (size_t i = 0; i + 1 < offsets.size(); i++) {
+      auto packet = &packets[offsets[i]];
+      rtp_header_set((uint8_t*)packet, rtpConfig->payloadType,
+        rtpConfig->sequenceNumber++, rtpConfig->timestamp, rtpConfig->ssrc);
+      video->track->send(packet, offsets[i + 1] - offsets[i]);
+    }
   }
 
   void describePeerConnection(nlohmann::json &message)
@@ -199,14 +222,14 @@ static std::shared_ptr<ClientTrackData> webrtc_add_video(const std::shared_ptr<r
   video.setBitrate(1000);
   video.addSSRC(ssrc, cname, msid, cname);
   auto track = pc->addTrack(video);
-  auto rtpConfig = std::make_shared<rtc::RtpPacketizationConfig>(ssrc, cname, payloadType, rtc::H264RtpPacketizer::defaultClockRate);
-  auto packetizer = std::make_shared<rtc::H264RtpPacketizer>(rtc::H264RtpPacketizer::Separator::LongStartSequence, rtpConfig);
-  auto h264Handler = std::make_shared<rtc::H264PacketizationHandler>(packetizer);
+  auto rtpConfig = std::make_shared<rtc::RtpPacketizationConfig>(ssrc, cname, payloadType, RTP_H264_CLOCK_RATE);
+  // packets are already formed by webrtc_packetize_frame(), the root only passes them through
+  auto rtpHandler = std::make_shared<rtc::MediaChainableHandler>(std::make_shared<rtc::MediaHandlerRootElement>());
   auto srReporter = std::make_shared<rtc::RtcpSrReporter>(rtpConfig);
-  h264Handler->addToChain(srReporter);
+  rtpHandler->addToChain(srReporter);
   auto nackResponder = std::make_shared<rtc::RtcpNackResponder>();
-  h264Handler->addToChain(nackResponder);
-  track->setMediaHandler(h264Handler);
+  rtpHandler->addToChain(nackResponder);
+  track->setMediaHandler(rtpHandler);
   return std::shared_ptr<ClientTrackData>(new ClientTrackData{track, srReporter});
 }
 
@@ -321,12 +344,50 @@ static bool webrtc_h264_needs_buffer(buffer_lock_t *buf_lock)
   return false;
 }
 
+static bool webrtc_packetize_frame(buffer_t *buf)
+{
+  int npackets = rtp_packetize_h264(&webrtc_packetizer, &buf->h264, 0);
+  if (npackets < 0) {
+    LOG_ERROR(buf, "Failed to packetize frame.");
+    return false;
+  }
+
+  webrtc_packets.clear();
+  webrtc_packet_offsets.clear();
+
+  for (int i = 0; i < npackets; i++) {
+    const rtp_packet_t *packet = &webrtc_packetizer.packets[i];
+    auto header = (const std::byte*)packet->header;
+    auto payload = (const std::byte*)packet->payload;
+
+    webrtc_packet_offsets.push_back(webrtc_packets.size());
+    webrtc_packets.insert(webrtc_packets.end(), header, header + packet->header_size);
+    webrtc_packets.insert(webrtc_packets.end(), payload, payload + packet->payload_size);
+  }
+
+  webrtc_packet_offsets.push_back(webrtc_packets.size());
+  return true;
+
+error:
+  return false;
+}
+
 static void webrtc_h264_capture(buffer_lock_t *buf_lock, buffer_t *buf)
 {
+  bool packetized = false;
+
   std::unique_lock lk(webrtc_clients_lock);
   for (auto client : webrtc_clients) {
-    if (client->wantsFrame())
-      client->pushFrame(buf);
+    if (!client->wantsFrame() || !client->acceptsFrame(buf))
+      continue;
+
+    if (!packetized) {
+      if (!webrtc_packetize_frame(buf))
+        return;
+      packetized = true;
+    }
+
+    client->pushPackets(webrtc_packets, webrtc_packet_offsets);
   }
 }
 
@@ -473,6 +534,10 @@ static void http_webrtc_remote_candidate(http_worker_t *worker, FILE *stream, co
 
 extern "C" void http_webrtc_offer(http_worker_t *worker, FILE *stream)
 {
+  if (!http_output_first_camera(worker, stream)) {
+    return;
+  }
+
   auto message = http_parse_json_body(worker, stream, webrtc_client_max_json_body);
 
   if (!message.contains("type")) {
@@ -506,7 +571,7 @@ extern "C" int webrtc_server(webrtc_options_t *options)
   }
 
   buffer_lock_register_check_streaming(&video_lock, webrtc_h264_needs_buffer);
-  buffer_lock_register_notify_buffer(&video_lock, webrtc_h264_capture);
+  buffer_lock_register_notify_buffer(&video_lock, "webrtc", webrtc_h264_capture);
   options->running = true;
   return 0;
 }
@@ -0,0 +1,89 @@
+#include "util/opts/log.h"
+#include "util/opts/fourcc.h"
+#include "device/buffer.h"
+#include "device/buffer_list.h"
+#include "device/buffer_lock.h"
+#include "device/device.h"
+#include "device/memory/memory.h"
+
+// The memory allocated by the GOP cache stays within its size,
+// also after a large key frame is followed by small frames.
+
+#define TEST_FRAMES 300
+#define TEST_GOP 30
+#define TEST_GOP_SIZE (256 * 1024)
+
+log_options_t log_options = {
+};
+
+DEFINE_BUFFER_LOCK(test_lock, 0);
+
+static size_t test_gop_allocated(buffer_lock_t *buf_lock)
+{
+  size_t length = 0;
+
+  for (int i = 0; buf_lock->gop_list && i < buf_lock->gop_list->nbufs; i++) {
+    length += buf_lock->gop_list->bufs[i]->length;
+  }
+  return length;
+}
+
+int main(int argc, char *argv[])
+{
+  buffer_format_t fmt = {
+    .format = V4L2_PIX_FMT_H264,
+    .sizeimage = 128 * 1024,
+    .nbufs = 3,
+    .type = BUFFER_TYPE_VIDEO,
+  };
+  size_t max_allocated = 0;
+  int replayed = 0;
+
+  device_t *dev = device_memory_open("ENCODER", "memory");
+  buffer_list_t *list = dev ? device_open_buffer_list(dev, true, fmt, true) : NULL;
+  if (!list || buffer_list_set_stream(list, true) < 0) {
+    LOG_ERROR(NULL, "Cannot open the encoder buffers.");
+  }
+
+  test_lock.buf_list = list;
+  test_lock.gop_size = TEST_GOP_SIZE;
+
+  for (int i = 0; i < TEST_FRAMES; i++) {
+    buffer_t *buf = buffer_list_dequeue(list);
+    if (!buf) {
+      LOG_ERROR(NULL, "The encoder buffers are held.");
+    }
+
+    buf->flags.is_keyframe = i % TEST_GOP == 0;
+    buf->used = buf->flags.is_keyframe ? 96 * 1024 : 1024 + i * 100 % 8192;
+    memset(buf->start, i, buf->used);
+    buf->captured_time_us = get_monotonic_time_us(NULL, NULL);
+
+    buffer_lock_capture(&test_lock, buf);
+    buffer_consumed(buf, "test");
+
+    max_allocated = MAX(max_allocated, test_gop_allocated(&test_lock));
+
+    buffer_t *gop[BUFFER_LOCK_MAX_GOP_FRAMES];
+    int counter = 0;
+    int n = buffer_lock_get_gop(&test_lock, gop, &counter);
+    for (int j = 0; j < n; j++) {
+      buffer_consumed(gop[j], "test");
+    }
+    replayed = MAX(replayed, n);
+  }
+
+  printf("%s: GOP allocated=%zu/%d, replayed=%d\n", argv[0], max_allocated, TEST_GOP_SIZE, replayed);
+
+  if (max_allocated > TEST_GOP_SIZE) {
+    LOG_ERROR(NULL, "The GOP cache exceeds its size.");
+  }
+  if (replayed != TEST_GOP) {
+    LOG_ERROR(NULL, "The GOP cache does not hold the whole GOP.");
+  }
+
+  return 0;
+
+error:
+  return 1;
+}
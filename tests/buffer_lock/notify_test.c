@@ -0,0 +1,94 @@
+#include "util/opts/log.h"
+#include "util/opts/fourcc.h"
+#include "device/buffer.h"
+#include "device/buffer_list.h"
+#include "device/buffer_lock.h"
+#include "device/device.h"
+#include "device/memory/memory.h"
+
+#include <semaphore.h>
+
+// A blocked notify worker must not hold the encoder buffers,
+// the other workers keep receiving all frames.
+
+#define TEST_ENCODER_BUFFERS 3
+#define TEST_FRAMES 200
+#define TEST_GOP 30
+
+log_options_t log_options = {
+};
+
+DEFINE_BUFFER_LOCK(test_lock, 0);
+
+static sem_t blocked_sem;
+static int delivered;
+
+static void test_blocked_capture(buffer_lock_t *buf_lock, buffer_t *buf)
+{
+  sem_wait(&blocked_sem);
+}
+
+static void test_counter_capture(buffer_lock_t *buf_lock, buffer_t *buf)
+{
+  __atomic_add_fetch(&delivered, 1, __ATOMIC_RELAXED);
+}
+
+int main(int argc, char *argv[])
+{
+  buffer_format_t fmt = {
+    .format = V4L2_PIX_FMT_H264,
+    .sizeimage = 4096,
+    .nbufs = TEST_ENCODER_BUFFERS,
+    .type = BUFFER_TYPE_VIDEO,
+  };
+  int missing = 0;
+
+  sem_init(&blocked_sem, 0, 0);
+
+  device_t *dev = device_memory_open("ENCODER", "memory");
+  buffer_list_t *list = dev ? device_open_buffer_list(dev, true, fmt, true) : NULL;
+  if (!list || buffer_list_set_stream(list, true) < 0) {
+    LOG_ERROR(NULL, "Cannot open the encoder buffers.");
+  }
+
+  test_lock.buf_list = list;
+  buffer_lock_register_notify_buffer(&test_lock, "blocked", test_blocked_capture);
+  buffer_lock_register_notify_buffer(&test_lock, "counter", test_counter_capture);
+
+  for (int i = 0; i < TEST_FRAMES; i++) {
+    buffer_t *buf = buffer_list_dequeue(list);
+    if (!buf) {
+      missing++;
+      usleep(1000);
+      continue;
+    }
+
+    memset(buf->start, i, 1024);
+    buf->used = 1024;
+    buf->flags.is_keyframe = i % TEST_GOP == 0;
+    buf->captured_time_us = get_monotonic_time_us(NULL, NULL);
+
+    buffer_lock_capture(&test_lock, buf);
+    buffer_consumed(buf, "test");
+
+    // the counter worker keeps up with this rate
+    usleep(2000);
+  }
+
+  usleep(100 * 1000);
+
+  int n = __atomic_load_n(&delivered, __ATOMIC_RELAXED);
+  printf("%s: encoder buffers missing=%d, delivered=%d/%d\n", argv[0], missing, n, TEST_FRAMES);
+
+  if (missing > 0) {
+    LOG_ERROR(NULL, "The blocked worker held the encoder buffers.");
+  }
+  if (n != TEST_FRAMES) {
+    LOG_ERROR(NULL, "The other worker did not receive all frames.");
+  }
+
+  return 0;
+
+error:
+  return 1;
+}
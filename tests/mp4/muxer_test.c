@@ -0,0 +1,108 @@
+#include "util/opts/log.h"
+#include "util/mp4/muxer.h"
+#include "util/h264/h264.h"
+
+#include <string.h>
+
+// A key frame with new parameter sets restarts the stream with a new header.
+// Immediate muxers write every frame as it arrives, without a final flush.
+
+log_options_t log_options = {
+};
+
+typedef struct {
+  const char *name;
+  int headers;
+  int fragments;
+} test_output_t;
+
+static int test_write_packet(void *opaque, const uint8_t *data, size_t size)
+{
+  test_output_t *output = opaque;
+
+  if (size >= 8 && !memcmp(data + 4, "ftyp", 4)) {
+    output->headers++;
+  } else if (size >= 8 && !memcmp(data + 4, "moof", 4)) {
+    output->fragments++;
+  }
+  return 0;
+}
+
+static int test_write_frame(mp4_muxer_t *muxer, h264_index_t *index, uint8_t sps, bool keyframe, uint64_t time_us)
+{
+  uint8_t data[] = {
+    0, 0, 0, 1, 0x67, 0x42, 0xc0, sps,
+    0, 0, 0, 1, 0x68, 0xce, 0x3c, 0x80,
+    0, 0, 0, 1, keyframe ? 0x65 : 0x41, 0x88, 0x84, 0x00, 0x10,
+  };
+
+  if (h264_index_parse(index, data, sizeof(data)) < 0) {
+    return -1;
+  }
+
+  if (mp4_muxer_params_changed(muxer, index, keyframe)) {
+    mp4_muxer_flush(muxer, time_us);
+    mp4_muxer_reset(muxer);
+  }
+
+  return mp4_muxer_write_frame(muxer, index, time_us, keyframe);
+}
+
+static int test_write_stream(test_output_t *output, bool immediate)
+{
+  h264_index_t index = {0};
+  int ret = -1;
+
+  mp4_muxer_t muxer = {
+    .name = "TEST",
+    .width = 1920,
+    .height = 1080,
+    .opaque = output,
+    .write_packet = test_write_packet,
+    .immediate = immediate,
+  };
+
+  for (int i = 0; i < 20; i++) {
+    // the parameter sets change with the key frame of the second GOP only
+    uint8_t sps = i < 10 ? 0x1f : 0x28;
+    if (test_write_frame(&muxer, &index, sps, i % 5 == 0, i * 33333) < 0) {
+      LOG_ERROR(NULL, "Cannot write frame %d.", i);
+    }
+  }
+
+  if (!immediate) {
+    mp4_muxer_flush(&muxer, 0);
+  }
+
+  ret = 0;
+
+error:
+  mp4_muxer_close(&muxer);
+  h264_index_free(&index);
+  return ret;
+}
+
+int main(int argc, char *argv[])
+{
+  test_output_t output = { .name = "TEST" };
+  test_output_t immediate = { .name = "TEST" };
+
+  if (test_write_stream(&output, false) < 0 || test_write_stream(&immediate, true) < 0) {
+    return 1;
+  }
+
+  printf("%s: headers=%d, fragments=%d, immediate fragments=%d\n", argv[0],
+    output.headers, output.fragments, immediate.fragments);
+
+  if (output.headers != 2 || immediate.headers != 2) {
+    LOG_ERROR(NULL, "Expected a new header after the parameter sets changed.");
+  }
+  if (output.fragments != 20 || immediate.fragments != 20) {
+    LOG_ERROR(NULL, "Expected all frames to be written.");
+  }
+
+  return 0;
+
+error:
+  return 1;
+}
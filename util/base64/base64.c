@@ -0,0 +1,29 @@
+#include "base64.h"
+
+static const char base64_chars[] =
+  "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+
+size_t base64_encode(const uint8_t *data, size_t size, char *out, size_t out_size)
+{
+  size_t n = 0;
+
+  if (out_size < BASE64_ENCODED_SIZE(size)) {
+    return 0;
+  }
+
+  for (size_t i = 0; i < size; i += 3) {
+    uint32_t value = data[i] << 16;
+    if (i + 1 < size)
+      value |= data[i + 1] << 8;
+    if (i + 2 < size)
+      value |= data[i + 2];
+
+    out[n++] = base64_chars[(value >> 18) & 0x3F];
+    out[n++] = base64_chars[(value >> 12) & 0x3F];
+    out[n++] = i + 1 < size ? base64_chars[(value >> 6) & 0x3F] : '=';
+    out[n++] = i + 2 < size ? base64_chars[value & 0x3F] : '=';
+  }
+
+  out[n] = 0;
+  return n;
+}
@@ -0,0 +1,8 @@
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+
+#define BASE64_ENCODED_SIZE(size) (((size) + 2) / 3 * 4 + 1)
+
+size_t base64_encode(const uint8_t *data, size_t size, char *out, size_t out_size);
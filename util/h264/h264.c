@@ -0,0 +1,308 @@
+#include "h264.h"
+#include "util/opts/log.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+#define H264_MAX_SPS_SIZE 256
+
+const uint8_t *h264_find_start_code(const uint8_t *p, const uint8_t *end, int *start_code_len)
+{
+  // `memchr` is vectorized, and `0x01` is rare in the slice data
+  for (const uint8_t *q = p + 2; q < end; q++) {
+    q = memchr(q, 1, end - q);
+    if (!q) {
+      break;
+    }
+
+    if (q[-1] == 0 && q[-2] == 0) {
+      if (start_code_len) {
+        *start_code_len = 3;
+      }
+      return q - 2;
+    }
+  }
+
+  return NULL;
+}
+
+bool h264_next_nal(const uint8_t **p, const uint8_t *end, h264_nal_t *nal)
+{
+  const uint8_t *start = h264_find_start_code(*p, end, NULL);
+  if (!start) {
+    *p = end;
+    return false;
+  }
+
+  const uint8_t *data = start + 3;
+  const uint8_t *next = h264_find_start_code(data, end, NULL);
+  const uint8_t *data_end = next ? next : end;
+
+  // trailing zeros belong to the next (4-byte) start code
+  while (data_end > data && data_end[-1] == 0) {
+    data_end--;
+  }
+
+  *p = next ? next : end;
+
+  if (data_end <= data) {
+    return h264_next_nal(p, end, nal);
+  }
+
+  nal->data = data;
+  nal->size = data_end - data;
+  nal->type = H264_NAL_TYPE(data[0]);
+  return true;
+}
+
+typedef struct {
+  const uint8_t *data;
+  size_t size;
+  size_t bit;
+  bool error;
+} h264_bits_t;
+
+static unsigned h264_read_bit(h264_bits_t *bits)
+{
+  if (bits->bit >= bits->size * 8) {
+    bits->error = true;
+    return 0;
+  }
+
+  unsigned value = (bits->data[bits->bit / 8] >> (7 - bits->bit % 8)) & 1;
+  bits->bit++;
+  return value;
+}
+
+static unsigned h264_read_bits(h264_bits_t *bits, int n)
+{
+  unsigned value = 0;
+  while (n-- > 0) {
+    value = (value << 1) | h264_read_bit(bits);
+  }
+  return value;
+}
+
+static unsigned h264_read_ue(h264_bits_t *bits)
+{
+  int zeros = 0;
+  while (!h264_read_bit(bits) && !bits->error) {
+    if (++zeros > 31) {
+      bits->error = true;
+      return 0;
+    }
+  }
+  return (1u << zeros) - 1 + h264_read_bits(bits, zeros);
+}
+
+static int h264_read_se(h264_bits_t *bits)
+{
+  unsigned value = h264_read_ue(bits);
+  return (value & 1) ? (int)((value + 1) / 2) : -(int)(value / 2);
+}
+
+static void h264_skip_scaling_list(h264_bits_t *bits, int size)
+{
+  int last_scale = 8, next_scale = 8;
+
+  for (int i = 0; i < size && next_scale; i++) {
+    next_scale = (last_scale + h264_read_se(bits) + 256) % 256;
+    if (next_scale) {
+      last_scale = next_scale;
+    }
+  }
+}
+
+bool h264_parse_sps(const uint8_t *data, size_t size, h264_sps_t *sps)
+{
+  uint8_t rbsp[H264_MAX_SPS_SIZE];
+  size_t rbsp_size = 0;
+
+  // strip NAL header and emulation prevention bytes
+  for (size_t i = 1; i < size && rbsp_size < sizeof(rbsp); i++) {
+    if (i >= 3 && data[i] == 3 && data[i-1] == 0 && data[i-2] == 0) {
+      continue;
+    }
+    rbsp[rbsp_size++] = data[i];
+  }
+
+  h264_bits_t bits = { rbsp, rbsp_size };
+  unsigned chroma_format_idc = 1;
+
+  memset(sps, 0, sizeof(*sps));
+  sps->profile_idc = h264_read_bits(&bits, 8);
+  sps->constraint_flags = h264_read_bits(&bits, 8);
+  sps->level_idc = h264_read_bits(&bits, 8);
+  h264_read_ue(&bits); // seq_parameter_set_id
+
+  switch (sps->profile_idc) {
+  case 100: case 110: case 122: case 244: case 44:
+  case 83: case 86: case 118: case 128: case 138:
+  case 139: case 134: case 135:
+    chroma_format_idc = h264_read_ue(&bits);
+    if (chroma_format_idc == 3) {
+      h264_read_bit(&bits); // separate_colour_plane_flag
+    }
+    h264_read_ue(&bits); // bit_depth_luma_minus8
+    h264_read_ue(&bits); // bit_depth_chroma_minus8
+    h264_read_bit(&bits); // qpprime_y_zero_transform_bypass_flag
+    if (h264_read_bit(&bits)) { // seq_scaling_matrix_present_flag
+      for (int i = 0; i < (chroma_format_idc != 3 ? 8 : 12); i++) {
+        if (h264_read_bit(&bits)) {
+          h264_skip_scaling_list(&bits, i < 6 ? 16 : 64);
+        }
+      }
+    }
+    break;
+  }
+
+  h264_read_ue(&bits); // log2_max_frame_num_minus4
+
+  unsigned pic_order_cnt_type = h264_read_ue(&bits);
+  if (pic_order_cnt_type == 0) {
+    h264_read_ue(&bits); // log2_max_pic_order_cnt_lsb_minus4
+  } else if (pic_order_cnt_type == 1) {
+    h264_read_bit(&bits); // delta_pic_order_always_zero_flag
+    h264_read_se(&bits); // offset_for_non_ref_pic
+    h264_read_se(&bits); // offset_for_top_to_bottom_field
+    unsigned n = h264_read_ue(&bits);
+    for (unsigned i = 0; i < n && !bits.error; i++) {
+      h264_read_se(&bits); // offset_for_ref_frame
+    }
+  }
+
+  h264_read_ue(&bits); // max_num_ref_frames
+  h264_read_bit(&bits); // gaps_in_frame_num_value_allowed_flag
+
+  unsigned width_in_mbs = h264_read_ue(&bits) + 1;
+  unsigned height_in_map_units = h264_read_ue(&bits) + 1;
+  unsigned frame_mbs_only_flag = h264_read_bit(&bits);
+  if (!frame_mbs_only_flag) {
+    h264_read_bit(&bits); // mb_adaptive_frame_field_flag
+  }
+  h264_read_bit(&bits); // direct_8x8_inference_flag
+
+  unsigned crop_left = 0, crop_right = 0, crop_top = 0, crop_bottom = 0;
+  if (h264_read_bit(&bits)) { // frame_cropping_flag
+    crop_left = h264_read_ue(&bits);
+    crop_right = h264_read_ue(&bits);
+    crop_top = h264_read_ue(&bits);
+    crop_bottom = h264_read_ue(&bits);
+  }
+
+  if (bits.error) {
+    return false;
+  }
+
+  unsigned crop_unit_x = (chroma_format_idc == 1 || chroma_format_idc == 2) ? 2 : 1;
+  unsigned crop_unit_y = (chroma_format_idc == 1 ? 2 : 1) * (2 - frame_mbs_only_flag);
+
+  sps->width = width_in_mbs * 16 - (crop_left + crop_right) * crop_unit_x;
+  sps->height = height_in_map_units * 16 * (2 - frame_mbs_only_flag) - (crop_top + crop_bottom) * crop_unit_y;
+  return true;
+}
+
+static int h264_index_reserve(h264_index_t *index, unsigned nnals)
+{
+  if (nnals <= index->capacity) {
+    return 0;
+  }
+
+  unsigned capacity = MAX(nnals, MAX(index->capacity * 2, 8));
+  h264_nal_t *nals = reallocarray(index->nals, capacity, sizeof(h264_nal_t));
+  if (!nals) {
+    return -1;
+  }
+
+  index->nals = nals;
+  index->capacity = capacity;
+  return 0;
+}
+
+int h264_index_parse(h264_index_t *index, const uint8_t *data, size_t size)
+{
+  const uint8_t *ptr = data, *end = data + size;
+  h264_nal_t nal;
+
+  index->nnals = 0;
+  index->has_aud = index->has_idr = index->has_sps = index->has_pps = false;
+
+  while (h264_next_nal(&ptr, end, &nal)) {
+    if (h264_index_reserve(index, index->nnals + 1) < 0) {
+      return -1;
+    }
+
+    index->nals[index->nnals++] = nal;
+    index->has_aud |= nal.type == H264_NAL_AUD;
+    index->has_idr |= nal.type == H264_NAL_IDR;
+    index->has_sps |= nal.type == H264_NAL_SPS;
+    index->has_pps |= nal.type == H264_NAL_PPS;
+  }
+
+  return index->nnals;
+}
+
+int h264_index_copy(h264_index_t *dest, const h264_index_t *src, const uint8_t *src_data, const uint8_t *dest_data)
+{
+  if (h264_index_reserve(dest, src->nnals) < 0) {
+    return -1;
+  }
+
+  for (unsigned i = 0; i < src->nnals; i++) {
+    dest->nals[i] = src->nals[i];
+    dest->nals[i].data = dest_data + (src->nals[i].data - src_data);
+  }
+
+  dest->nnals = src->nnals;
+  dest->has_aud = src->has_aud;
+  dest->has_idr = src->has_idr;
+  dest->has_sps = src->has_sps;
+  dest->has_pps = src->has_pps;
+  return dest->nnals;
+}
+
+void h264_index_free(h264_index_t *index)
+{
+  free(index->nals);
+  index->nals = NULL;
+  index->nnals = 0;
+  index->capacity = 0;
+}
+
+static bool h264_params_store(uint8_t *dest, unsigned *dest_size, const h264_nal_t *nal)
+{
+  if (nal->size > H264_MAX_PARAMETER_SET) {
+    return false;
+  }
+  if (nal->size == *dest_size && !memcmp(dest, nal->data, nal->size)) {
+    return false;
+  }
+
+  memcpy(dest, nal->data, nal->size);
+  *dest_size = nal->size;
+  return true;
+}
+
+bool h264_params_update(h264_params_t *params, const h264_index_t *index)
+{
+  bool changed = false;
+
+  if (!index->has_sps && !index->has_pps) {
+    return false;
+  }
+
+  for (unsigned i = 0; i < index->nnals; i++) {
+    const h264_nal_t *nal = &index->nals[i];
+
+    if (nal->type == H264_NAL_SPS) {
+      changed |= h264_params_store(params->sps, &params->sps_size, nal);
+    } else if (nal->type == H264_NAL_PPS) {
+      changed |= h264_params_store(params->pps, &params->pps_size, nal);
+    }
+  }
+
+  if (changed) {
+    params->version++;
+  }
+  return changed;
+}
@@ -0,0 +1,55 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stddef.h>
+
+#define H264_NAL_SLICE 1
+#define H264_NAL_IDR 5
+#define H264_NAL_SEI 6
+#define H264_NAL_SPS 7
+#define H264_NAL_PPS 8
+#define H264_NAL_AUD 9
+
+#define H264_NAL_TYPE(byte) ((byte) & 0x1F)
+#define H264_MAX_PARAMETER_SET 256
+
+typedef struct h264_nal_s {
+  const uint8_t *data; // points after start code
+  size_t size;
+  unsigned type;
+} h264_nal_t;
+
+// NALs of an access unit, parsed once when the buffer is dequeued
+typedef struct h264_index_s {
+  h264_nal_t *nals; // point into the indexed data
+  unsigned nnals;
+  unsigned capacity;
+
+  bool has_aud, has_idr, has_sps, has_pps;
+} h264_index_t;
+
+// latest parameter sets seen on a stream
+typedef struct h264_params_s {
+  uint8_t sps[H264_MAX_PARAMETER_SET];
+  unsigned sps_size;
+  uint8_t pps[H264_MAX_PARAMETER_SET];
+  unsigned pps_size;
+  unsigned version; // incremented on change
+} h264_params_t;
+
+typedef struct h264_sps_s {
+  unsigned profile_idc;
+  unsigned constraint_flags;
+  unsigned level_idc;
+  unsigned width, height;
+} h264_sps_t;
+
+const uint8_t *h264_find_start_code(const uint8_t *p, const uint8_t *end, int *start_code_len);
+bool h264_next_nal(const uint8_t **p, const uint8_t *end, h264_nal_t *nal);
+bool h264_parse_sps(const uint8_t *data, size_t size, h264_sps_t *sps);
+
+int h264_index_parse(h264_index_t *index, const uint8_t *data, size_t size);
+int h264_index_copy(h264_index_t *dest, const h264_index_t *src, const uint8_t *src_data, const uint8_t *dest_data);
+void h264_index_free(h264_index_t *index);
+bool h264_params_update(h264_params_t *params, const h264_index_t *index);
@@ -14,10 +14,13 @@
 #include "http.h"
 #include "util/opts/log.h"
 
+#define CAMERA_PREFIX "/cam"
 #define HEADER_RANGE "Range:"
 #define HEADER_CONTENT_LENGTH "Content-Length:"
 #define HEADER_USER_AGENT "User-Agent:"
 #define HEADER_HOST "Host:"
+#define HEADER_UPGRADE "Upgrade:"
+#define HEADER_WEBSOCKET_KEY "Sec-WebSocket-Key:"
 
 static int http_listen(char *addr4, int port, int maxcons)
 {
@@ -118,6 +121,8 @@ static void http_process(http_worker_t *worker, FILE *stream)
   worker->range_header[0] = 0;
   worker->user_agent[0] = 0;
   worker->host[0] = 0;
+  worker->upgrade[0] = 0;
+  worker->websocket_key[0] = 0;
   worker->content_length = -1;
 
   // request_uri
@@ -141,6 +146,19 @@ static void http_process(http_worker_t *worker, FILE *stream)
     worker->request_params = "";
   }
 
+  // `/camN/...` is routed as `/...` for the N-th camera
+  worker->camera_index = 0;
+
+  if (!strncmp(worker->request_uri, CAMERA_PREFIX, strlen(CAMERA_PREFIX))) {
+    char *end = NULL;
+    unsigned camera_index = strtoul(worker->request_uri + strlen(CAMERA_PREFIX), &end, 10);
+
+    if (end != worker->request_uri + strlen(CAMERA_PREFIX) && *end == '/') {
+      worker->camera_index = camera_index;
+      worker->request_uri = end;
+    }
+  }
+
   // Consume headers
   for(int i = 0; i < 50; i++) {
     char line[BUFSIZE];
@@ -157,6 +175,10 @@ static void http_process(http_worker_t *worker, FILE *stream)
       strcpy(worker->user_agent, trim(line + strlen(HEADER_USER_AGENT)));
     } else if (strcasestr(line, HEADER_HOST) == line) {
       strcpy(worker->host, trim(line + strlen(HEADER_HOST)));
+    } else if (strcasestr(line, HEADER_UPGRADE) == line) {
+      strcpy(worker->upgrade, trim(line + strlen(HEADER_UPGRADE)));
+    } else if (strcasestr(line, HEADER_WEBSOCKET_KEY) == line) {
+      strcpy(worker->websocket_key, trim(line + strlen(HEADER_WEBSOCKET_KEY)));
     }
   }
 
@@ -15,6 +15,13 @@ typedef void *(*http_param_fn)(struct http_worker_s *worker, FILE *stream, const
 
 #define BUFSIZE 256
 
+// WebSocket (RFC 6455) opcodes
+#define HTTP_WEBSOCKET_TEXT 0x1
+#define HTTP_WEBSOCKET_BINARY 0x2
+#define HTTP_WEBSOCKET_CLOSE 0x8
+#define HTTP_WEBSOCKET_PING 0x9
+#define HTTP_WEBSOCKET_PONG 0xA
+
 typedef struct http_method_s {
   const char *method;
   const char *uri;
@@ -46,10 +53,13 @@ typedef struct http_worker_s {
   char range_header[BUFSIZE];
   char user_agent[BUFSIZE];
   char host[BUFSIZE];
+  char upgrade[BUFSIZE];
+  char websocket_key[BUFSIZE];
   char *request_method;
   char *request_uri;
   char *request_params;
   char *request_version;
+  unsigned camera_index; // from the `/camN/` prefix
 
   http_method_t *current_method;
 } http_worker_t;
@@ -64,3 +74,8 @@ void http_404(FILE *stream, const char *data);
 void http_500(FILE *stream, const char *data);
 void *http_enum_params(http_worker_t *worker, FILE *stream, http_param_fn fn, void *opaque);
 char *http_get_param(http_worker_t *worker, const char *key);
+
+bool http_websocket_upgrade(http_worker_t *worker, FILE *stream);
+int http_websocket_write(FILE *stream, unsigned opcode, const void *header, size_t header_size, const void *data, size_t size);
+int http_websocket_pending(FILE *stream);
+int http_websocket_read(FILE *stream);
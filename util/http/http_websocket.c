@@ -0,0 +1,256 @@
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <strings.h>
+#include <poll.h>
+#include <sys/ioctl.h>
+#include <sys/socket.h>
+#include <linux/sockios.h>
+
+#include "http.h"
+#include "util/base64/base64.h"
+#include "util/opts/log.h"
+
+#define WEBSOCKET_GUID "258EAFA5-E914-47DA-95CA-C5AB0DC85B11"
+#define SHA1_DIGEST_SIZE 20
+
+#define ROL32(x, n) (((x) << (n)) | ((x) >> (32 - (n))))
+
+static void sha1_block(uint32_t h[5], const uint8_t *block)
+{
+  uint32_t w[80];
+
+  for (int i = 0; i < 16; i++) {
+    w[i] = (block[i * 4] << 24) | (block[i * 4 + 1] << 16) | (block[i * 4 + 2] << 8) | block[i * 4 + 3];
+  }
+  for (int i = 16; i < 80; i++) {
+    w[i] = ROL32(w[i - 3] ^ w[i - 8] ^ w[i - 14] ^ w[i - 16], 1);
+  }
+
+  uint32_t a = h[0], b = h[1], c = h[2], d = h[3], e = h[4];
+
+  for (int i = 0; i < 80; i++) {
+    uint32_t f, k;
+
+    if (i < 20) {
+      f = (b & c) | (~b & d);
+      k = 0x5A827999;
+    } else if (i < 40) {
+      f = b ^ c ^ d;
+      k = 0x6ED9EBA1;
+    } else if (i < 60) {
+      f = (b & c) | (b & d) | (c & d);
+      k = 0x8F1BBCDC;
+    } else {
+      f = b ^ c ^ d;
+      k = 0xCA62C1D6;
+    }
+
+    uint32_t temp = ROL32(a, 5) + f + e + k + w[i];
+    e = d;
+    d = c;
+    c = ROL32(b, 30);
+    b = a;
+    a = temp;
+  }
+
+  h[0] += a;
+  h[1] += b;
+  h[2] += c;
+  h[3] += d;
+  h[4] += e;
+}
+
+// the handshake hashes less than 128 bytes, so at most two blocks are used
+static void sha1(const uint8_t *data, size_t size, uint8_t digest[SHA1_DIGEST_SIZE])
+{
+  uint32_t h[5] = { 0x67452301, 0xEFCDAB89, 0x98BADCFE, 0x10325476, 0xC3D2E1F0 };
+  uint8_t block[64];
+  size_t i;
+
+  for (i = 0; i + 64 <= size; i += 64) {
+    sha1_block(h, data + i);
+  }
+
+  size_t left = size - i;
+  memset(block, 0, sizeof(block));
+  memcpy(block, data + i, left);
+  block[left] = 0x80;
+
+  if (left >= 56) {
+    sha1_block(h, block);
+    memset(block, 0, sizeof(block));
+  }
+
+  uint64_t bits = (uint64_t)size * 8;
+  for (int j = 0; j < 8; j++) {
+    block[63 - j] = bits >> (j * 8);
+  }
+  sha1_block(h, block);
+
+  for (int j = 0; j < 5; j++) {
+    digest[j * 4] = h[j] >> 24;
+    digest[j * 4 + 1] = h[j] >> 16;
+    digest[j * 4 + 2] = h[j] >> 8;
+    digest[j * 4 + 3] = h[j];
+  }
+}
+
+bool http_websocket_upgrade(http_worker_t *worker, FILE *stream)
+{
+  char key[BUFSIZE + sizeof(WEBSOCKET_GUID)];
+  uint8_t digest[SHA1_DIGEST_SIZE];
+  char accept[BASE64_ENCODED_SIZE(SHA1_DIGEST_SIZE)];
+
+  if (strcasecmp(worker->upgrade, "websocket") || !worker->websocket_key[0]) {
+    http_400(stream, "");
+    fprintf(stream, "WebSocket upgrade required.\r\n");
+    return false;
+  }
+
+  snprintf(key, sizeof(key), "%s%s", worker->websocket_key, WEBSOCKET_GUID);
+  sha1((const uint8_t *)key, strlen(key), digest);
+  base64_encode(digest, sizeof(digest), accept, sizeof(accept));
+
+  fprintf(stream, "HTTP/1.1 101 Switching Protocols\r\n");
+  fprintf(stream, "Upgrade: websocket\r\n");
+  fprintf(stream, "Connection: Upgrade\r\n");
+  fprintf(stream, "Sec-WebSocket-Accept: %s\r\n", accept);
+  fprintf(stream, "\r\n");
+  fflush(stream);
+
+  LOG_DEBUG(worker, "Upgraded to WebSocket.");
+  return true;
+}
+
+// sends a single unfragmented, unmasked message made of `header` followed by `data`
+int http_websocket_write(FILE *stream, unsigned opcode, const void *header, size_t header_size, const void *data, size_t size)
+{
+  uint8_t frame[10];
+  size_t frame_size = 2;
+  uint64_t length = header_size + size;
+
+  frame[0] = 0x80 | (opcode & 0x0F); // FIN
+
+  if (length < 126) {
+    frame[1] = length;
+  } else if (length <= 0xFFFF) {
+    frame[1] = 126;
+    frame[2] = length >> 8;
+    frame[3] = length;
+    frame_size = 4;
+  } else {
+    frame[1] = 127;
+    for (int i = 0; i < 8; i++) {
+      frame[2 + i] = length >> (56 - i * 8);
+    }
+    frame_size = 10;
+  }
+
+  if (!fwrite(frame, frame_size, 1, stream)) {
+    return -1;
+  }
+  if (header_size && !fwrite(header, header_size, 1, stream)) {
+    return -1;
+  }
+  if (size && !fwrite(data, size, 1, stream)) {
+    return -1;
+  }
+  if (fflush(stream) < 0) {
+    return -1;
+  }
+
+  return 0;
+}
+
+// bytes written but not yet acknowledged by the client
+int http_websocket_pending(FILE *stream)
+{
+  int pending = 0;
+
+  if (ioctl(fileno(stream), SIOCOUTQ, &pending) < 0) {
+    return 0;
+  }
+
+  return pending;
+}
+
+// bounded by the SO_RCVTIMEO of the client socket
+static bool http_websocket_recv(int fd, void *data, size_t size)
+{
+  return !size || recv(fd, data, size, MSG_WAITALL) == (ssize_t)size;
+}
+
+// answers the Ping and Close frames sent by the client without waiting for them,
+// returns 1 once the client closed the connection, and -1 on errors
+int http_websocket_read(FILE *stream)
+{
+  int fd = fileno(stream);
+  struct pollfd pollfd = { .fd = fd, .events = POLLIN };
+
+  while (poll(&pollfd, 1, 0) > 0) {
+    uint8_t frame[8];
+    uint8_t mask[4] = { 0 };
+    uint8_t payload[125]; // the limit of control frames
+
+    if (!http_websocket_recv(fd, frame, 2)) {
+      return -1;
+    }
+
+    unsigned opcode = frame[0] & 0x0F;
+    bool masked = frame[1] & 0x80;
+    uint64_t length = frame[1] & 0x7F;
+
+    if (length == 126) {
+      if (!http_websocket_recv(fd, frame, 2)) {
+        return -1;
+      }
+      length = (frame[0] << 8) | frame[1];
+    } else if (length == 127) {
+      if (!http_websocket_recv(fd, frame, 8)) {
+        return -1;
+      }
+      length = 0;
+      for (int i = 0; i < 8; i++) {
+        length = (length << 8) | frame[i];
+      }
+    }
+
+    if (masked && !http_websocket_recv(fd, mask, sizeof(mask))) {
+      return -1;
+    }
+
+    // messages of the client are not used, only their payload is skipped
+    if (!(opcode & 0x08)) {
+      for (uint64_t left = length; left > 0; ) {
+        size_t size = left < sizeof(payload) ? left : sizeof(payload);
+        if (!http_websocket_recv(fd, payload, size)) {
+          return -1;
+        }
+        left -= size;
+      }
+      continue;
+    }
+
+    if (length > sizeof(payload) || !http_websocket_recv(fd, payload, length)) {
+      return -1;
+    }
+
+    for (uint64_t i = 0; i < length; i++) {
+      payload[i] ^= mask[i % 4];
+    }
+
+    if (opcode == HTTP_WEBSOCKET_CLOSE) {
+      // echoes the status code, as required before closing the connection
+      http_websocket_write(stream, HTTP_WEBSOCKET_CLOSE, NULL, 0, payload, length >= 2 ? 2 : 0);
+      LOG_DEBUG(NULL, "WebSocket closed by the client.");
+      return 1;
+    } else if (opcode == HTTP_WEBSOCKET_PING) {
+      if (http_websocket_write(stream, HTTP_WEBSOCKET_PONG, NULL, 0, payload, length) < 0) {
+        return -1;
+      }
+    }
+  }
+
+  return 0;
+}
@@ -0,0 +1,136 @@
+#include "jpeg.h"
+
+#include <string.h>
+
+#define JPEG_SOI 0xD8
+#define JPEG_EOI 0xD9
+#define JPEG_SOF0 0xC0
+#define JPEG_SOS 0xDA
+#define JPEG_DQT 0xDB
+#define JPEG_DRI 0xDD
+
+static int jpeg_parse_sof(const uint8_t *p, size_t size, jpeg_frame_t *frame)
+{
+  // precision, height, width, components, (id, sampling, qtable) * 3
+  if (size < 15 || p[0] != 8 || p[5] != 3) {
+    return -1;
+  }
+
+  frame->height = (p[1] << 8) | p[2];
+  frame->width = (p[3] << 8) | p[4];
+
+  // only the luma can be sub-sampled, chroma has to be 1x1
+  if (p[10] != 0x11 || p[13] != 0x11) {
+    return -1;
+  }
+
+  switch (p[7]) {
+  case 0x21:
+    frame->type = 0;
+    return 0;
+
+  case 0x22:
+    frame->type = 1;
+    return 0;
+
+  default:
+    return -1;
+  }
+}
+
+static int jpeg_parse_dqt(const uint8_t *p, size_t size, jpeg_frame_t *frame)
+{
+  while (size > 0) {
+    unsigned precision = p[0] >> 4;
+    unsigned id = p[0] & 0x0F;
+
+    // 16-bit tables are not used by the baseline encoders
+    if (precision != 0 || id >= JPEG_MAX_QTABLES || size < 1 + JPEG_QTABLE_SIZE) {
+      return -1;
+    }
+
+    memcpy(&frame->qtables[id * JPEG_QTABLE_SIZE], p + 1, JPEG_QTABLE_SIZE);
+    if (id >= frame->nqtables) {
+      frame->nqtables = id + 1;
+    }
+
+    p += 1 + JPEG_QTABLE_SIZE;
+    size -= 1 + JPEG_QTABLE_SIZE;
+  }
+
+  return 0;
+}
+
+int jpeg_parse_frame(const uint8_t *data, size_t size, jpeg_frame_t *frame)
+{
+  const uint8_t *p = data, *end = data + size;
+
+  memset(frame, 0, sizeof(*frame));
+
+  if (size < 4 || p[0] != 0xFF || p[1] != JPEG_SOI) {
+    return -1;
+  }
+  p += 2;
+
+  while (p + 4 <= end) {
+    if (p[0] != 0xFF) {
+      return -1;
+    }
+
+    unsigned marker = p[1];
+    size_t length = (p[2] << 8) | p[3];
+
+    if (length < 2 || p + 2 + length > end) {
+      return -1;
+    }
+
+    const uint8_t *segment = p + 4;
+    size_t segment_size = length - 2;
+    p += 2 + length;
+
+    switch (marker) {
+    case JPEG_SOF0:
+      if (jpeg_parse_sof(segment, segment_size, frame) < 0) {
+        return -1;
+      }
+      break;
+
+    case JPEG_DQT:
+      if (jpeg_parse_dqt(segment, segment_size, frame) < 0) {
+        return -1;
+      }
+      break;
+
+    case JPEG_DRI:
+      if (segment_size < 2) {
+        return -1;
+      }
+      frame->restart_interval = (segment[0] << 8) | segment[1];
+      break;
+
+    case JPEG_SOS:
+      if (!frame->width || !frame->nqtables) {
+        return -1;
+      }
+
+      // the scan runs until EOI, trailing padding is ignored
+      frame->scan = p;
+      frame->scan_size = end - p;
+      while (frame->scan_size >= 2 &&
+        (frame->scan[frame->scan_size - 2] != 0xFF || frame->scan[frame->scan_size - 1] != JPEG_EOI)) {
+        frame->scan_size--;
+      }
+      if (frame->scan_size < 2) {
+        return -1;
+      }
+      frame->scan_size -= 2;
+      return 0;
+
+    default:
+      // APPn, COM, DHT: the RTP/JPEG receiver uses the standard tables
+      break;
+    }
+  }
+
+  return -1;
+}
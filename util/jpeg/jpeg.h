@@ -0,0 +1,23 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stddef.h>
+
+#define JPEG_MAX_QTABLES 2
+#define JPEG_QTABLE_SIZE 64
+
+// baseline JPEG frame as required by RTP/JPEG (RFC 2435)
+typedef struct jpeg_frame_s {
+  unsigned width, height;
+  unsigned type; // 0 = 4:2:2, 1 = 4:2:0
+  unsigned restart_interval;
+
+  uint8_t qtables[JPEG_MAX_QTABLES * JPEG_QTABLE_SIZE];
+  unsigned nqtables;
+
+  const uint8_t *scan; // entropy-coded data, points into the parsed frame
+  size_t scan_size;
+} jpeg_frame_t;
+
+int jpeg_parse_frame(const uint8_t *data, size_t size, jpeg_frame_t *frame);
@@ -0,0 +1,580 @@
+#include "muxer.h"
+#include "util/h264/h264.h"
+#include "util/opts/log.h"
+
+#include <inttypes.h>
+
+#define MP4_DEFAULT_FRAME_DURATION (MP4_TIMESCALE / 30)
+
+#define MP4_SAMPLE_FLAGS_KEY 0x02000000
+#define MP4_SAMPLE_FLAGS_NON_KEY 0x01010000
+
+static bool mp4_box_reserve(mp4_muxer_t *muxer, size_t size)
+{
+  if (muxer->box_size + size <= muxer->box_capacity) {
+    return true;
+  }
+
+  size_t capacity = MAX(muxer->box_capacity * 2, muxer->box_size + size + 1024);
+  uint8_t *box = realloc(muxer->box, capacity);
+  if (!box) {
+    muxer->box_failed = true;
+    return false;
+  }
+
+  muxer->box = box;
+  muxer->box_capacity = capacity;
+  return true;
+}
+
+static void mp4_put_bytes(mp4_muxer_t *muxer, const void *data, size_t size)
+{
+  if (!mp4_box_reserve(muxer, size)) {
+    return;
+  }
+
+  memcpy(muxer->box + muxer->box_size, data, size);
+  muxer->box_size += size;
+}
+
+static void mp4_put_zeros(mp4_muxer_t *muxer, size_t size)
+{
+  if (!mp4_box_reserve(muxer, size)) {
+    return;
+  }
+
+  memset(muxer->box + muxer->box_size, 0, size);
+  muxer->box_size += size;
+}
+
+static void mp4_put8(mp4_muxer_t *muxer, uint8_t value)
+{
+  mp4_put_bytes(muxer, &value, 1);
+}
+
+static void mp4_put16(mp4_muxer_t *muxer, uint16_t value)
+{
+  uint8_t data[] = { value >> 8, value };
+  mp4_put_bytes(muxer, data, sizeof(data));
+}
+
+static void mp4_put32(mp4_muxer_t *muxer, uint32_t value)
+{
+  uint8_t data[] = { value >> 24, value >> 16, value >> 8, value };
+  mp4_put_bytes(muxer, data, sizeof(data));
+}
+
+static void mp4_put64(mp4_muxer_t *muxer, uint64_t value)
+{
+  mp4_put32(muxer, value >> 32);
+  mp4_put32(muxer, value);
+}
+
+static void mp4_patch32(mp4_muxer_t *muxer, size_t offset, uint32_t value)
+{
+  if (offset + 4 > muxer->box_size) {
+    return;
+  }
+
+  muxer->box[offset + 0] = value >> 24;
+  muxer->box[offset + 1] = value >> 16;
+  muxer->box[offset + 2] = value >> 8;
+  muxer->box[offset + 3] = value;
+}
+
+static size_t mp4_box_start(mp4_muxer_t *muxer, const char *type)
+{
+  size_t offset = muxer->box_size;
+  mp4_put32(muxer, 0);
+  mp4_put_bytes(muxer, type, 4);
+  return offset;
+}
+
+static size_t mp4_full_box_start(mp4_muxer_t *muxer, const char *type, uint8_t version, uint32_t flags)
+{
+  size_t offset = mp4_box_start(muxer, type);
+  mp4_put32(muxer, (version << 24) | (flags & 0xFFFFFF));
+  return offset;
+}
+
+static void mp4_box_end(mp4_muxer_t *muxer, size_t offset)
+{
+  mp4_patch32(muxer, offset, muxer->box_size - offset);
+}
+
+static void mp4_put_matrix(mp4_muxer_t *muxer)
+{
+  static const uint32_t matrix[9] = {
+    0x00010000, 0, 0,
+    0, 0x00010000, 0,
+    0, 0, 0x40000000
+  };
+
+  for (int i = 0; i < 9; i++) {
+    mp4_put32(muxer, matrix[i]);
+  }
+}
+
+static void mp4_put_ftyp(mp4_muxer_t *muxer)
+{
+  size_t ftyp = mp4_box_start(muxer, "ftyp");
+  mp4_put_bytes(muxer, "isom", 4);
+  mp4_put32(muxer, 0x200);
+  mp4_put_bytes(muxer, "isom", 4);
+  mp4_put_bytes(muxer, "iso5", 4);
+  mp4_put_bytes(muxer, "iso6", 4);
+  mp4_put_bytes(muxer, "avc1", 4);
+  mp4_put_bytes(muxer, "mp41", 4);
+  mp4_box_end(muxer, ftyp);
+}
+
+static void mp4_put_avc1(mp4_muxer_t *muxer, unsigned width, unsigned height)
+{
+  size_t avc1 = mp4_box_start(muxer, "avc1");
+  mp4_put_zeros(muxer, 6); // reserved
+  mp4_put16(muxer, 1); // data_reference_index
+  mp4_put_zeros(muxer, 16); // pre_defined + reserved
+  mp4_put16(muxer, width);
+  mp4_put16(muxer, height);
+  mp4_put32(muxer, 0x00480000); // 72 dpi
+  mp4_put32(muxer, 0x00480000); // 72 dpi
+  mp4_put32(muxer, 0); // reserved
+  mp4_put16(muxer, 1); // frame_count
+  mp4_put_zeros(muxer, 32); // compressorname
+  mp4_put16(muxer, 0x0018); // depth
+  mp4_put16(muxer, 0xFFFF); // pre_defined
+
+  size_t avcC = mp4_box_start(muxer, "avcC");
+  mp4_put8(muxer, 1); // configurationVersion
+  mp4_put8(muxer, muxer->sps[1]); // AVCProfileIndication
+  mp4_put8(muxer, muxer->sps[2]); // profile_compatibility
+  mp4_put8(muxer, muxer->sps[3]); // AVCLevelIndication
+  mp4_put8(muxer, 0xFF); // lengthSizeMinusOne = 3
+  mp4_put8(muxer, 0xE1); // numOfSequenceParameterSets = 1
+  mp4_put16(muxer, muxer->sps_size);
+  mp4_put_bytes(muxer, muxer->sps, muxer->sps_size);
+  mp4_put8(muxer, 1); // numOfPictureParameterSets
+  mp4_put16(muxer, muxer->pps_size);
+  mp4_put_bytes(muxer, muxer->pps, muxer->pps_size);
+  mp4_box_end(muxer, avcC);
+
+  mp4_box_end(muxer, avc1);
+}
+
+static void mp4_put_stbl(mp4_muxer_t *muxer, unsigned width, unsigned height)
+{
+  size_t stbl = mp4_box_start(muxer, "stbl");
+
+  size_t stsd = mp4_full_box_start(muxer, "stsd", 0, 0);
+  mp4_put32(muxer, 1); // entry_count
+  mp4_put_avc1(muxer, width, height);
+  mp4_box_end(muxer, stsd);
+
+  // samples are described by fragments
+  static const char *empty_tables[] = { "stts", "stsc", "stco" };
+  for (int i = 0; i < ARRAY_SIZE(empty_tables); i++) {
+    size_t table = mp4_full_box_start(muxer, empty_tables[i], 0, 0);
+    mp4_put32(muxer, 0); // entry_count
+    mp4_box_end(muxer, table);
+  }
+
+  size_t stsz = mp4_full_box_start(muxer, "stsz", 0, 0);
+  mp4_put32(muxer, 0); // sample_size
+  mp4_put32(muxer, 0); // sample_count
+  mp4_box_end(muxer, stsz);
+
+  mp4_box_end(muxer, stbl);
+}
+
+static void mp4_put_moov(mp4_muxer_t *muxer, unsigned width, unsigned height)
+{
+  size_t moov = mp4_box_start(muxer, "moov");
+
+  size_t mvhd = mp4_full_box_start(muxer, "mvhd", 0, 0);
+  mp4_put32(muxer, 0); // creation_time
+  mp4_put32(muxer, 0); // modification_time
+  mp4_put32(muxer, 1000); // timescale
+  mp4_put32(muxer, 0); // duration
+  mp4_put32(muxer, 0x00010000); // rate
+  mp4_put16(muxer, 0x0100); // volume
+  mp4_put_zeros(muxer, 10); // reserved
+  mp4_put_matrix(muxer);
+  mp4_put_zeros(muxer, 24); // pre_defined
+  mp4_put32(muxer, 2); // next_track_ID
+  mp4_box_end(muxer, mvhd);
+
+  size_t trak = mp4_box_start(muxer, "trak");
+
+  size_t tkhd = mp4_full_box_start(muxer, "tkhd", 0, 0x000003);
+  mp4_put32(muxer, 0); // creation_time
+  mp4_put32(muxer, 0); // modification_time
+  mp4_put32(muxer, 1); // track_ID
+  mp4_put32(muxer, 0); // reserved
+  mp4_put32(muxer, 0); // duration
+  mp4_put_zeros(muxer, 8); // reserved
+  mp4_put16(muxer, 0); // layer
+  mp4_put16(muxer, 0); // alternate_group
+  mp4_put16(muxer, 0); // volume
+  mp4_put16(muxer, 0); // reserved
+  mp4_put_matrix(muxer);
+  mp4_put32(muxer, width << 16);
+  mp4_put32(muxer, height << 16);
+  mp4_box_end(muxer, tkhd);
+
+  size_t mdia = mp4_box_start(muxer, "mdia");
+
+  size_t mdhd = mp4_full_box_start(muxer, "mdhd", 0, 0);
+  mp4_put32(muxer, 0); // creation_time
+  mp4_put32(muxer, 0); // modification_time
+  mp4_put32(muxer, MP4_TIMESCALE);
+  mp4_put32(muxer, 0); // duration
+  mp4_put16(muxer, 0x55C4); // language: und
+  mp4_put16(muxer, 0); // pre_defined
+  mp4_box_end(muxer, mdhd);
+
+  size_t hdlr = mp4_full_box_start(muxer, "hdlr", 0, 0);
+  mp4_put32(muxer, 0); // pre_defined
+  mp4_put_bytes(muxer, "vide", 4);
+  mp4_put_zeros(muxer, 12); // reserved
+  mp4_put_bytes(muxer, "VideoHandler", 13);
+  mp4_box_end(muxer, hdlr);
+
+  size_t minf = mp4_box_start(muxer, "minf");
+
+  size_t vmhd = mp4_full_box_start(muxer, "vmhd", 0, 0x000001);
+  mp4_put_zeros(muxer, 8); // graphicsmode + opcolor
+  mp4_box_end(muxer, vmhd);
+
+  size_t dinf = mp4_box_start(muxer, "dinf");
+  size_t dref = mp4_full_box_start(muxer, "dref", 0, 0);
+  mp4_put32(muxer, 1); // entry_count
+  size_t url = mp4_full_box_start(muxer, "url ", 0, 0x000001);
+  mp4_box_end(muxer, url);
+  mp4_box_end(muxer, dref);
+  mp4_box_end(muxer, dinf);
+
+  mp4_put_stbl(muxer, width, height);
+
+  mp4_box_end(muxer, minf);
+  mp4_box_end(muxer, mdia);
+  mp4_box_end(muxer, trak);
+
+  size_t mvex = mp4_box_start(muxer, "mvex");
+  size_t trex = mp4_full_box_start(muxer, "trex", 0, 0);
+  mp4_put32(muxer, 1); // track_ID
+  mp4_put32(muxer, 1); // default_sample_description_index
+  mp4_put32(muxer, 0); // default_sample_duration
+  mp4_put32(muxer, 0); // default_sample_size
+  mp4_put32(muxer, 0); // default_sample_flags
+  mp4_box_end(muxer, trex);
+  mp4_box_end(muxer, mvex);
+
+  mp4_box_end(muxer, moov);
+}
+
+static int mp4_muxer_write_header(mp4_muxer_t *muxer)
+{
+  h264_sps_t sps;
+  unsigned width = muxer->width, height = muxer->height;
+
+  if (h264_parse_sps(muxer->sps, muxer->sps_size, &sps)) {
+    width = sps.width;
+    height = sps.height;
+  } else {
+    LOG_INFO(muxer, "Cannot parse SPS. Using %ux%u.", width, height);
+  }
+
+  muxer->box_size = 0;
+  muxer->box_failed = false;
+  mp4_put_ftyp(muxer);
+  mp4_put_moov(muxer, width, height);
+
+  if (muxer->box_failed) {
+    LOG_INFO(muxer, "Cannot allocate the MP4 header.");
+    return -1;
+  }
+
+  LOG_DEBUG(muxer, "Writing MP4 header: %ux%u, profile=%u, level=%u, size=%zu",
+    width, height, muxer->sps[1], muxer->sps[3], muxer->box_size);
+
+  return muxer->write_packet(muxer->opaque, muxer->box, muxer->box_size);
+}
+
+static void mp4_muxer_store_parameter_set(mp4_muxer_t *muxer, uint8_t *dest, unsigned *dest_size, const h264_nal_t *nal)
+{
+  if (nal->size > MP4_MAX_PARAMETER_SET) {
+    return;
+  }
+
+  if (*dest_size == nal->size && !memcmp(dest, nal->data, nal->size)) {
+    return;
+  }
+
+  memcpy(dest, nal->data, nal->size);
+  *dest_size = nal->size;
+  muxer->params_version++;
+}
+
+static void mp4_muxer_store_parameter_sets(mp4_muxer_t *muxer, const h264_index_t *index)
+{
+  for (unsigned i = 0; i < index->nnals; i++) {
+    const h264_nal_t *nal = &index->nals[i];
+
+    if (nal->type == H264_NAL_SPS) {
+      mp4_muxer_store_parameter_set(muxer, muxer->sps, &muxer->sps_size, nal);
+    } else if (nal->type == H264_NAL_PPS) {
+      mp4_muxer_store_parameter_set(muxer, muxer->pps, &muxer->pps_size, nal);
+    }
+  }
+}
+
+static bool mp4_muxer_is_sample_nal(const h264_nal_t *nal)
+{
+  // parameter sets are provided by `avcC`
+  return nal->type != H264_NAL_AUD && nal->type != H264_NAL_SPS && nal->type != H264_NAL_PPS;
+}
+
+static bool mp4_muxer_store_sample(mp4_muxer_t *muxer, const h264_index_t *index, uint32_t sample_size)
+{
+  if (sample_size > muxer->sample_capacity) {
+    uint8_t *sample = realloc(muxer->sample, sample_size);
+    if (!sample) {
+      return false;
+    }
+    muxer->sample = sample;
+    muxer->sample_capacity = sample_size;
+  }
+
+  // Annex-B NALs are stored as length-prefixed
+  muxer->sample_size = 0;
+
+  for (unsigned i = 0; i < index->nnals; i++) {
+    const h264_nal_t *nal = &index->nals[i];
+    uint8_t *dest = muxer->sample + muxer->sample_size;
+
+    if (!mp4_muxer_is_sample_nal(nal)) {
+      continue;
+    }
+
+    dest[0] = nal->size >> 24;
+    dest[1] = nal->size >> 16;
+    dest[2] = nal->size >> 8;
+    dest[3] = nal->size;
+    memcpy(dest + 4, nal->data, nal->size);
+    muxer->sample_size += 4 + nal->size;
+  }
+
+  return true;
+}
+
+// writes `moof` and the `mdat` header, the sample data has to follow
+static int mp4_muxer_write_fragment(mp4_muxer_t *muxer, uint64_t decode_time, uint32_t duration, bool keyframe, size_t sample_size)
+{
+  muxer->box_size = 0;
+  muxer->box_failed = false;
+
+  size_t moof = mp4_box_start(muxer, "moof");
+
+  size_t mfhd = mp4_full_box_start(muxer, "mfhd", 0, 0);
+  mp4_put32(muxer, muxer->sequence + 1);
+  mp4_box_end(muxer, mfhd);
+
+  size_t traf = mp4_box_start(muxer, "traf");
+
+  size_t tfhd = mp4_full_box_start(muxer, "tfhd", 0, 0x020000); // default-base-is-moof
+  mp4_put32(muxer, 1); // track_ID
+  mp4_box_end(muxer, tfhd);
+
+  size_t tfdt = mp4_full_box_start(muxer, "tfdt", 1, 0);
+  mp4_put64(muxer, decode_time);
+  mp4_box_end(muxer, tfdt);
+
+  // data-offset, sample-duration, sample-size, sample-flags
+  size_t trun = mp4_full_box_start(muxer, "trun", 0, 0x000701);
+  mp4_put32(muxer, 1); // sample_count
+  size_t data_offset = muxer->box_size;
+  mp4_put32(muxer, 0);
+  mp4_put32(muxer, duration);
+  mp4_put32(muxer, sample_size);
+  mp4_put32(muxer, keyframe ? MP4_SAMPLE_FLAGS_KEY : MP4_SAMPLE_FLAGS_NON_KEY);
+  mp4_box_end(muxer, trun);
+
+  mp4_box_end(muxer, traf);
+  mp4_box_end(muxer, moof);
+
+  mp4_patch32(muxer, data_offset, muxer->box_size - moof + 8);
+
+  mp4_put32(muxer, 8 + sample_size);
+  mp4_put_bytes(muxer, "mdat", 4);
+
+  if (muxer->box_failed) {
+    LOG_INFO(muxer, "Cannot allocate the MP4 fragment, dropping frame.");
+    return 0;
+  }
+
+  if (muxer->write_packet(muxer->opaque, muxer->box, muxer->box_size) < 0) {
+    return -1;
+  }
+
+  muxer->sequence++;
+  muxer->frames++;
+
+  LOG_DEBUG(muxer, "Wrote MP4 fragment: seq=%u, keyframe=%d, size=%zu, decode_time=%" PRIu64 ", duration=%u",
+    muxer->sequence, keyframe, sample_size, decode_time, duration);
+  return 1;
+}
+
+int mp4_muxer_flush(mp4_muxer_t *muxer, uint64_t time_us)
+{
+  if (!muxer->has_sample) {
+    return 0;
+  }
+
+  muxer->has_sample = false;
+
+  uint64_t decode_time = (muxer->sample_time_us - muxer->start_time_us) * MP4_TIMESCALE / (1000 * 1000);
+  uint32_t duration = muxer->last_duration;
+  if (time_us > muxer->sample_time_us) {
+    // rounded the same way as the next decode time, so the fragments are continuous
+    duration = (time_us - muxer->start_time_us) * MP4_TIMESCALE / (1000 * 1000) - decode_time;
+  }
+  if (!duration) {
+    duration = MP4_DEFAULT_FRAME_DURATION;
+  }
+
+  muxer->last_duration = duration;
+
+  int ret = mp4_muxer_write_fragment(muxer, decode_time, duration, muxer->sample_keyframe, muxer->sample_size);
+  if (ret <= 0) {
+    return ret;
+  }
+  if (muxer->write_packet(muxer->opaque, muxer->sample, muxer->sample_size) < 0) {
+    return -1;
+  }
+  return 1;
+}
+
+// the NALs are written straight from the buffer, without copying the frame
+static int mp4_muxer_write_immediate(mp4_muxer_t *muxer, const h264_index_t *index, uint64_t time_us, bool keyframe, uint32_t sample_size)
+{
+  uint64_t decode_time = time_us > muxer->start_time_us ?
+    (time_us - muxer->start_time_us) * MP4_TIMESCALE / (1000 * 1000) : 0;
+
+  // `tfdt` follows the capture time, the duration only fills the gap until the next frame
+  if (decode_time > muxer->last_decode_time) {
+    muxer->last_duration = decode_time - muxer->last_decode_time;
+  } else {
+    decode_time = muxer->last_decode_time;
+  }
+  muxer->last_decode_time = decode_time;
+
+  uint32_t duration = muxer->last_duration ? muxer->last_duration : MP4_DEFAULT_FRAME_DURATION;
+
+  int ret = mp4_muxer_write_fragment(muxer, decode_time, duration, keyframe, sample_size);
+  if (ret <= 0) {
+    return ret;
+  }
+
+  for (unsigned i = 0; i < index->nnals; i++) {
+    const h264_nal_t *nal = &index->nals[i];
+    uint8_t length[4] = { nal->size >> 24, nal->size >> 16, nal->size >> 8, nal->size };
+
+    if (!mp4_muxer_is_sample_nal(nal)) {
+      continue;
+    }
+
+    if (muxer->write_packet(muxer->opaque, length, sizeof(length)) < 0 ||
+      muxer->write_packet(muxer->opaque, nal->data, nal->size) < 0) {
+      return -1;
+    }
+  }
+  return 1;
+}
+
+int mp4_muxer_write_frame(mp4_muxer_t *muxer, const h264_index_t *index, uint64_t time_us, bool keyframe)
+{
+  uint32_t sample_size = 0;
+
+  mp4_muxer_store_parameter_sets(muxer, index);
+
+  for (unsigned i = 0; i < index->nnals; i++) {
+    if (mp4_muxer_is_sample_nal(&index->nals[i])) {
+      sample_size += 4 + index->nals[i].size;
+    }
+  }
+
+  keyframe |= index->has_idr;
+
+  if (!muxer->wrote_header) {
+    if (!keyframe || !muxer->sps_size || !muxer->pps_size) {
+      return 0;
+    }
+
+    if (mp4_muxer_write_header(muxer) < 0) {
+      return -1;
+    }
+
+    muxer->wrote_header = true;
+    muxer->header_version = muxer->params_version;
+    muxer->has_sample = false;
+    muxer->start_time_us = time_us;
+    muxer->last_decode_time = 0;
+    muxer->last_duration = 0;
+  }
+
+  if (!sample_size) {
+    return 0;
+  }
+
+  if (muxer->immediate) {
+    return mp4_muxer_write_immediate(muxer, index, time_us, keyframe, sample_size);
+  }
+
+  if (muxer->has_sample && time_us < muxer->sample_time_us) {
+    time_us = muxer->sample_time_us;
+  }
+
+  int ret = mp4_muxer_flush(muxer, time_us);
+  if (ret < 0) {
+    return ret;
+  }
+
+  if (!mp4_muxer_store_sample(muxer, index, sample_size)) {
+    LOG_INFO(muxer, "Cannot allocate %u bytes for the MP4 sample, dropping frame.", sample_size);
+    return ret;
+  }
+
+  muxer->has_sample = true;
+  muxer->sample_keyframe = keyframe;
+  muxer->sample_time_us = time_us;
+  return ret;
+}
+
+bool mp4_muxer_params_changed(mp4_muxer_t *muxer, const h264_index_t *index, bool keyframe)
+{
+  mp4_muxer_store_parameter_sets(muxer, index);
+
+  return muxer->wrote_header && (keyframe || index->has_idr) &&
+    muxer->params_version != muxer->header_version;
+}
+
+void mp4_muxer_reset(mp4_muxer_t *muxer)
+{
+  muxer->wrote_header = false;
+  muxer->has_sample = false;
+  muxer->sequence = 0;
+}
+
+void mp4_muxer_close(mp4_muxer_t *muxer)
+{
+  free(muxer->sample);
+  muxer->sample = NULL;
+  muxer->sample_size = 0;
+  muxer->sample_capacity = 0;
+  muxer->has_sample = false;
+
+  free(muxer->box);
+  muxer->box = NULL;
+  muxer->box_size = 0;
+  muxer->box_capacity = 0;
+}
@@ -0,0 +1,61 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stddef.h>
+
+#include "util/h264/h264.h"
+
+#define MP4_MAX_PARAMETER_SET 256
+#define MP4_TIMESCALE 90000
+
+typedef int (*mp4_muxer_write_fn)(void *opaque, const uint8_t *data, size_t size);
+
+typedef struct mp4_muxer_s {
+  const char *name;
+  unsigned width, height; // used when SPS cannot be parsed
+  void *opaque;
+  mp4_muxer_write_fn write_packet;
+  // writes each frame right away lasting as long as the previous interval,
+  // instead of holding it back until the next frame gives its exact duration
+  bool immediate;
+
+  // private
+  uint8_t sps[MP4_MAX_PARAMETER_SET];
+  unsigned sps_size;
+  uint8_t pps[MP4_MAX_PARAMETER_SET];
+  unsigned pps_size;
+  unsigned params_version; // incremented when the SPS or PPS change
+  unsigned header_version; // of the parameter sets in the written header
+
+  bool wrote_header;
+  unsigned sequence;
+  unsigned frames;
+  uint64_t start_time_us;
+  uint64_t last_decode_time;
+  uint32_t last_duration;
+
+  // a sample is written once the next one gives its duration
+  bool has_sample;
+  bool sample_keyframe;
+  uint64_t sample_time_us;
+  uint8_t *sample;
+  size_t sample_size;
+  size_t sample_capacity;
+
+  uint8_t *box;
+  size_t box_size;
+  size_t box_capacity;
+  bool box_failed;
+} mp4_muxer_t;
+
+// returns 1 if the previous frame (or this one if `immediate`) was written as a fragment
+int mp4_muxer_write_frame(mp4_muxer_t *muxer, const h264_index_t *index, uint64_t time_us, bool keyframe);
+// writes the pending frame lasting until `time_us`, or as long as the previous one if 0
+int mp4_muxer_flush(mp4_muxer_t *muxer, uint64_t time_us);
+// whether the key frame carries parameter sets different from the written header,
+// the stream has to be restarted with `mp4_muxer_reset()`
+bool mp4_muxer_params_changed(mp4_muxer_t *muxer, const h264_index_t *index, bool keyframe);
+// the next key frame starts a new stream with its own header, the pending frame is dropped
+void mp4_muxer_reset(mp4_muxer_t *muxer);
+void mp4_muxer_close(mp4_muxer_t *muxer);
@@ -0,0 +1,214 @@
+#include "muxer.h"
+#include "util/h264/h264.h"
+#include "util/opts/log.h"
+
+#define MPEGTS_PID_PAT 0x0000
+#define MPEGTS_PID_PMT 0x1000
+#define MPEGTS_PID_VIDEO 0x0100
+#define MPEGTS_STREAM_TYPE_H264 0x1B
+#define MPEGTS_PSI_INTERVAL_US (500 * 1000)
+#define MPEGTS_PCR_DELAY_US (50 * 1000)
+#define MPEGTS_PAYLOAD_SIZE (MPEGTS_PACKET_SIZE - 4)
+
+static const uint8_t mpegts_aud[] = { 0x00, 0x00, 0x00, 0x01, 0x09, 0xF0 };
+
+static uint32_t mpegts_crc32(const uint8_t *data, size_t size)
+{
+  uint32_t crc = 0xFFFFFFFF;
+
+  while (size-- > 0) {
+    crc ^= (uint32_t)*data++ << 24;
+    for (int i = 0; i < 8; i++) {
+      crc = (crc & 0x80000000) ? (crc << 1) ^ 0x04C11DB7 : (crc << 1);
+    }
+  }
+
+  return crc;
+}
+
+static int mpegts_flush(mpegts_muxer_t *muxer)
+{
+  if (!muxer->batch_packets) {
+    return 0;
+  }
+
+  int ret = muxer->write_packet(muxer->opaque, muxer->batch, muxer->batch_packets * MPEGTS_PACKET_SIZE);
+  muxer->batch_packets = 0;
+  return ret;
+}
+
+static uint8_t *mpegts_packet(mpegts_muxer_t *muxer, unsigned pid, bool unit_start, bool adaptation, uint8_t *cc)
+{
+  if (muxer->batch_packets >= MPEGTS_BATCH_PACKETS && mpegts_flush(muxer) < 0) {
+    return NULL;
+  }
+
+  uint8_t *pkt = &muxer->batch[muxer->batch_packets++ * MPEGTS_PACKET_SIZE];
+  pkt[0] = 0x47;
+  pkt[1] = (unit_start ? 0x40 : 0) | ((pid >> 8) & 0x1F);
+  pkt[2] = pid & 0xFF;
+  pkt[3] = (adaptation ? 0x30 : 0x10) | (*cc & 0x0F);
+  *cc = (*cc + 1) & 0x0F;
+  return pkt;
+}
+
+static int mpegts_write_section(mpegts_muxer_t *muxer, unsigned pid, uint8_t *cc, uint8_t *section, size_t size)
+{
+  uint8_t *pkt = mpegts_packet(muxer, pid, true, false, cc);
+  if (!pkt) {
+    return -1;
+  }
+
+  uint32_t crc = mpegts_crc32(section, size - 4);
+  section[size - 4] = crc >> 24;
+  section[size - 3] = crc >> 16;
+  section[size - 2] = crc >> 8;
+  section[size - 1] = crc;
+
+  pkt[4] = 0; // pointer_field
+  memcpy(pkt + 5, section, size);
+  memset(pkt + 5 + size, 0xFF, MPEGTS_PACKET_SIZE - 5 - size);
+  return 0;
+}
+
+static int mpegts_write_psi(mpegts_muxer_t *muxer)
+{
+  uint8_t pat[] = {
+    0x00, // table_id
+    0xB0, 13, // section_length
+    0x00, 0x01, // transport_stream_id
+    0xC1, 0x00, 0x00, // version, section_number, last_section_number
+    0x00, 0x01, // program_number
+    0xE0 | (MPEGTS_PID_PMT >> 8), MPEGTS_PID_PMT & 0xFF,
+    0, 0, 0, 0 // CRC32
+  };
+
+  uint8_t pmt[] = {
+    0x02, // table_id
+    0xB0, 18, // section_length
+    0x00, 0x01, // program_number
+    0xC1, 0x00, 0x00, // version, section_number, last_section_number
+    0xE0 | (MPEGTS_PID_VIDEO >> 8), MPEGTS_PID_VIDEO & 0xFF, // PCR_PID
+    0xF0, 0x00, // program_info_length
+    MPEGTS_STREAM_TYPE_H264,
+    0xE0 | (MPEGTS_PID_VIDEO >> 8), MPEGTS_PID_VIDEO & 0xFF,
+    0xF0, 0x00, // ES_info_length
+    0, 0, 0, 0 // CRC32
+  };
+
+  if (mpegts_write_section(muxer, MPEGTS_PID_PAT, &muxer->cc_pat, pat, sizeof(pat)) < 0) {
+    return -1;
+  }
+  if (mpegts_write_section(muxer, MPEGTS_PID_PMT, &muxer->cc_pmt, pmt, sizeof(pmt)) < 0) {
+    return -1;
+  }
+  return 0;
+}
+
+static void mpegts_put_pcr(uint8_t *p, uint64_t time_us)
+{
+  uint64_t base = (time_us * 90 / 1000) & 0x1FFFFFFFFULL;
+  unsigned ext = (time_us * 27) % 300;
+
+  p[0] = base >> 25;
+  p[1] = base >> 17;
+  p[2] = base >> 9;
+  p[3] = base >> 1;
+  p[4] = ((base & 1) << 7) | 0x7E | (ext >> 8);
+  p[5] = ext;
+}
+
+static size_t mpegts_put_pes_header(uint8_t *p, uint64_t time_us)
+{
+  uint64_t pts = (time_us * 90 / 1000) & 0x1FFFFFFFFULL;
+
+  p[0] = 0x00;
+  p[1] = 0x00;
+  p[2] = 0x01;
+  p[3] = 0xE0; // video stream
+  p[4] = 0x00; // unbounded PES_packet_length
+  p[5] = 0x00;
+  p[6] = 0x80;
+  p[7] = 0x80; // PTS only
+  p[8] = 5; // PES_header_data_length
+  p[9] = 0x21 | ((pts >> 29) & 0x0E);
+  p[10] = pts >> 22;
+  p[11] = ((pts >> 14) & 0xFE) | 1;
+  p[12] = pts >> 7;
+  p[13] = ((pts << 1) & 0xFE) | 1;
+  return 14;
+}
+
+int mpegts_muxer_write_frame(mpegts_muxer_t *muxer, const uint8_t *data, size_t size, const h264_index_t *index, uint64_t time_us, bool keyframe)
+{
+  uint8_t header[32];
+  size_t header_size;
+
+  if (!muxer->wrote_psi && !keyframe) {
+    return 0;
+  }
+
+  if (keyframe || time_us - muxer->last_psi_us >= MPEGTS_PSI_INTERVAL_US) {
+    if (mpegts_write_psi(muxer) < 0) {
+      return -1;
+    }
+    muxer->last_psi_us = time_us;
+    muxer->wrote_psi = true;
+  }
+
+  header_size = mpegts_put_pes_header(header, time_us + MPEGTS_PCR_DELAY_US);
+
+  // each access unit has to start with AUD
+  if (!index->nnals || index->nals[0].type != H264_NAL_AUD) {
+    memcpy(header + header_size, mpegts_aud, sizeof(mpegts_aud));
+    header_size += sizeof(mpegts_aud);
+  }
+
+  for (bool first = true; header_size + size > 0; first = false) {
+    size_t remaining = header_size + size;
+    size_t adaptation = first ? 8 : 0; // length, flags and PCR
+    size_t space = MPEGTS_PAYLOAD_SIZE - adaptation;
+
+    if (remaining < space) {
+      adaptation += space - remaining;
+      space = remaining;
+    }
+
+    uint8_t *pkt = mpegts_packet(muxer, MPEGTS_PID_VIDEO, first, adaptation > 0, &muxer->cc_video);
+    if (!pkt) {
+      return -1;
+    }
+
+    uint8_t *payload = pkt + 4;
+
+    if (adaptation > 0) {
+      payload[0] = adaptation - 1;
+      if (adaptation > 1) {
+        payload[1] = 0;
+        memset(payload + 2, 0xFF, adaptation - 2);
+      }
+      if (first) {
+        payload[1] = 0x10 | (keyframe ? 0x40 : 0); // PCR, random_access_indicator
+        mpegts_put_pcr(payload + 2, time_us);
+      }
+      payload += adaptation;
+    }
+
+    size_t n = MIN(header_size, space);
+    memcpy(payload, header, n);
+    memmove(header, header + n, header_size - n);
+    header_size -= n;
+    payload += n;
+    space -= n;
+
+    memcpy(payload, data, space);
+    data += space;
+    size -= space;
+  }
+
+  if (mpegts_flush(muxer) < 0) {
+    return -1;
+  }
+
+  return 1;
+}
@@ -0,0 +1,28 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stddef.h>
+
+#include "util/h264/h264.h"
+
+#define MPEGTS_PACKET_SIZE 188
+#define MPEGTS_BATCH_PACKETS 32
+
+typedef int (*mpegts_muxer_write_fn)(void *opaque, const uint8_t *data, size_t size);
+
+typedef struct mpegts_muxer_s {
+  const char *name;
+  void *opaque;
+  mpegts_muxer_write_fn write_packet;
+
+  // private
+  uint8_t cc_pat, cc_pmt, cc_video;
+  uint64_t last_psi_us;
+  bool wrote_psi;
+
+  uint8_t batch[MPEGTS_BATCH_PACKETS * MPEGTS_PACKET_SIZE];
+  unsigned batch_packets;
+} mpegts_muxer_t;
+
+int mpegts_muxer_write_frame(mpegts_muxer_t *muxer, const uint8_t *data, size_t size, const h264_index_t *index, uint64_t time_us, bool keyframe);
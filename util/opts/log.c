@@ -3,6 +3,31 @@
 
 #include <string.h>
 #include <ctype.h>
+#include <stdarg.h>
+#include <semaphore.h>
+#include <signal.h>
+#include <sched.h>
+
+#define LOG_RING_SIZE 512 // power of two
+#define LOG_LINE_SIZE 512
+
+typedef struct log_entry_s {
+  unsigned seq;
+  char line[LOG_LINE_SIZE];
+} log_entry_t;
+
+unsigned log_generation = 1;
+
+static struct {
+  log_entry_t entries[LOG_RING_SIZE];
+  unsigned head;
+  unsigned tail;
+  unsigned dropped;
+  bool running;
+  sem_t ready;
+  pthread_mutex_t lock;
+  pthread_t thread;
+} log_ring;
 
 char *
 strstrn(const char *s, const char *find, size_t len)
@@ -42,6 +67,206 @@ bool filter_log(const char *filename)
   return false;
 }
 
+void log_file_resolve(log_file_t *file, const char *filename)
+{
+  unsigned generation = __atomic_load_n(&log_generation, __ATOMIC_ACQUIRE);
+
+  if (log_options.debug || filter_log(filename)) {
+    file->level = LOG_LEVEL_DEBUG;
+  } else if (log_options.verbose) {
+    file->level = LOG_LEVEL_VERBOSE;
+  } else {
+    file->level = LOG_LEVEL_INFO;
+  }
+
+  __atomic_store_n(&file->generation, generation, __ATOMIC_RELEASE);
+}
+
+// bounded multi-producer queue: a slot is free when `seq == pos`,
+// and holds a line when `seq == pos + 1`
+static bool log_ring_push(const char *line, int len)
+{
+  unsigned pos = __atomic_load_n(&log_ring.head, __ATOMIC_RELAXED);
+  log_entry_t *entry;
+
+  for (;;) {
+    entry = &log_ring.entries[pos & (LOG_RING_SIZE - 1)];
+    int diff = (int)(__atomic_load_n(&entry->seq, __ATOMIC_ACQUIRE) - pos);
+
+    if (diff == 0) {
+      if (__atomic_compare_exchange_n(&log_ring.head, &pos, pos + 1, true, __ATOMIC_RELAXED, __ATOMIC_RELAXED))
+        break;
+    } else if (diff < 0) {
+      return false;
+    } else {
+      pos = __atomic_load_n(&log_ring.head, __ATOMIC_RELAXED);
+    }
+  }
+
+  memcpy(entry->line, line, len + 1);
+  __atomic_store_n(&entry->seq, pos + 1, __ATOMIC_RELEASE);
+  sem_post(&log_ring.ready);
+  return true;
+}
+
+static void log_ring_write(const char *buf, int len)
+{
+  while (len > 0) {
+    int ret = write(STDERR_FILENO, buf, len);
+    if (ret < 0 && errno == EINTR)
+      continue;
+    if (ret <= 0)
+      break;
+    buf += ret;
+    len -= ret;
+  }
+}
+
+// writes all queued lines to stderr, the `wait` waits for the lines
+// being copied by other threads, so the caller's earlier lines are included
+static void log_ring_drain(bool wait)
+{
+  char buf[8192];
+  int used = 0;
+
+  unsigned dropped = __atomic_exchange_n(&log_ring.dropped, 0, __ATOMIC_RELAXED);
+  if (dropped) {
+    used += snprintf(buf, sizeof(buf), "util/opts/log.c: ?: Dropped %u log lines.\n", dropped);
+  }
+
+  unsigned head = __atomic_load_n(&log_ring.head, __ATOMIC_ACQUIRE);
+
+  for (;;) {
+    unsigned pos = __atomic_load_n(&log_ring.tail, __ATOMIC_RELAXED);
+    log_entry_t *entry = &log_ring.entries[pos & (LOG_RING_SIZE - 1)];
+
+    if (__atomic_load_n(&entry->seq, __ATOMIC_ACQUIRE) != pos + 1) {
+      if (!wait || (int)(head - pos) <= 0)
+        break;
+      sched_yield();
+      continue;
+    }
+
+    int len = strlen(entry->line);
+    if (used + len > sizeof(buf)) {
+      log_ring_write(buf, used);
+      used = 0;
+    }
+    memcpy(buf + used, entry->line, len);
+    used += len;
+
+    __atomic_store_n(&entry->seq, pos + LOG_RING_SIZE, __ATOMIC_RELEASE);
+    __atomic_store_n(&log_ring.tail, pos + 1, __ATOMIC_RELEASE);
+  }
+
+  log_ring_write(buf, used);
+}
+
+static void *log_ring_thread(void *opaque)
+{
+  for (;;) {
+    sem_wait(&log_ring.ready);
+
+    pthread_mutex_lock(&log_ring.lock);
+    log_ring_drain(false);
+    pthread_mutex_unlock(&log_ring.lock);
+  }
+
+  return NULL;
+}
+
+static void log_fatal_signal(int signo)
+{
+  // the crashed thread might hold the lock, so write what is queued
+  // without it, and let the default action terminate the process
+  log_ring_drain(false);
+  raise(signo);
+}
+
+void log_write(int level, const char *fmt, ...)
+{
+  char line[LOG_LINE_SIZE];
+  va_list args;
+
+  va_start(args, fmt);
+  int len = vsnprintf(line, sizeof(line), fmt, args);
+  va_end(args);
+
+  if (len < 0)
+    return;
+
+  bool running = __atomic_load_n(&log_ring.running, __ATOMIC_ACQUIRE);
+
+  // only the debug and verbose lines are queued, a full ring drops them
+  if (running && level > LOG_LEVEL_INFO && len < sizeof(line)) {
+    if (log_ring_push(line, len))
+      return;
+
+    __atomic_add_fetch(&log_ring.dropped, 1, __ATOMIC_RELAXED);
+    return;
+  }
+
+  // the info and error lines, and the too long lines, are written
+  // after the queued ones to keep the order
+  if (running) {
+    pthread_mutex_lock(&log_ring.lock);
+    log_ring_drain(true);
+  }
+
+  if (len < sizeof(line)) {
+    fwrite(line, len, 1, stderr);
+  } else {
+    va_start(args, fmt);
+    vfprintf(stderr, fmt, args);
+    va_end(args);
+  }
+
+  if (running) {
+    pthread_mutex_unlock(&log_ring.lock);
+  }
+}
+
+void log_flush()
+{
+  if (!__atomic_load_n(&log_ring.running, __ATOMIC_ACQUIRE))
+    return;
+
+  pthread_mutex_lock(&log_ring.lock);
+  log_ring_drain(true);
+  pthread_mutex_unlock(&log_ring.lock);
+}
+
+void log_start()
+{
+  // re-resolve the levels of all files with the parsed options
+  __atomic_add_fetch(&log_generation, 1, __ATOMIC_RELEASE);
+
+  if (log_options.sync || log_ring.running)
+    return;
+
+  for (int i = 0; i < LOG_RING_SIZE; i++) {
+    log_ring.entries[i].seq = i;
+  }
+  sem_init(&log_ring.ready, 0, 0);
+  pthread_mutex_init(&log_ring.lock, NULL);
+
+  if (pthread_create(&log_ring.thread, NULL, log_ring_thread, NULL) != 0) {
+    LOG_INFO(NULL, "Cannot start the logging thread, logging synchronously.");
+    return;
+  }
+  pthread_detach(log_ring.thread);
+
+  __atomic_store_n(&log_ring.running, true, __ATOMIC_RELEASE);
+  atexit(log_flush);
+
+  int fatal_signals[] = { SIGSEGV, SIGBUS, SIGFPE, SIGILL, SIGABRT, SIGTERM };
+  struct sigaction sa = { .sa_handler = log_fatal_signal, .sa_flags = SA_RESETHAND | SA_NODEFER };
+
+  for (int i = 0; i < ARRAY_SIZE(fatal_signals); i++) {
+    sigaction(fatal_signals[i], &sa, NULL);
+  }
+}
+
 int shrink_to_block(int size, int block)
 {
 	return size / block * block;
@@ -28,6 +28,7 @@ typedef struct log_options_s {
   bool verbose;
 	unsigned stats;
   char filter[256];
+  bool sync;
 } log_options_t;
 
 extern log_options_t log_options;
@@ -35,15 +36,42 @@ extern log_options_t log_options;
 #define MIN(a, b) ((a) < (b) ? (a) : (b))
 #define MAX(a, b) ((a) > (b) ? (a) : (b))
 
+#define LOG_LEVEL_INFO 0
+#define LOG_LEVEL_VERBOSE 1
+#define LOG_LEVEL_DEBUG 2
+
+typedef struct log_file_s {
+  unsigned generation;
+  int level;
+} log_file_t;
+
+extern unsigned log_generation;
+
 bool filter_log(const char *filename);
+void log_file_resolve(log_file_t *file, const char *filename);
+void log_write(int level, const char *fmt, ...) __attribute__((format(printf, 2, 3)));
+void log_start();
+void log_flush();
+
+// the level of each file is resolved once, and again only after `log_start()`
+static log_file_t log_this_file __attribute__((unused));
+
+static inline bool log_enabled(int level, const char *filename)
+{
+  if (__builtin_expect(__atomic_load_n(&log_this_file.generation, __ATOMIC_ACQUIRE) !=
+    __atomic_load_n(&log_generation, __ATOMIC_RELAXED), 0)) {
+    log_file_resolve(&log_this_file, filename);
+  }
+  return __builtin_expect(log_this_file.level >= level, 0);
+}
 
 // assumes that name is first item
 #define dev_name(dev) (dev ? *(const char**)dev : "?")
-#define LOG_ERROR(dev, _msg, ...)		do { fprintf(stderr, "%s: %s: " _msg "\n", __FILENAME__, dev_name(dev), ##__VA_ARGS__); goto error; } while(0)
-#define LOG_PERROR(dev, _msg, ...)		do { fprintf(stderr, "%s: %s: " _msg "\n", __FILENAME__, dev_name(dev), ##__VA_ARGS__); exit(-1); } while(0)
-#define LOG_INFO(dev, _msg, ...)		do { fprintf(stderr, "%s: %s: " _msg "\n", __FILENAME__, dev_name(dev), ##__VA_ARGS__); } while(0)
-#define LOG_VERBOSE(dev, _msg, ...)	do { if (log_options.debug || log_options.verbose || filter_log(__FILENAME__)) { fprintf(stderr, "%s: %s: " _msg "\n", __FILENAME__, dev_name(dev), ##__VA_ARGS__); } } while(0)
-#define LOG_DEBUG(dev, _msg, ...)		do { if (log_options.debug || filter_log(__FILENAME__)) { fprintf(stderr, "%s: %s: " _msg "\n", __FILENAME__, dev_name(dev), ##__VA_ARGS__); } } while(0)
+#define LOG_ERROR(dev, _msg, ...)		do { log_write(LOG_LEVEL_INFO, "%s: %s: " _msg "\n", __FILENAME__, dev_name(dev), ##__VA_ARGS__); goto error; } while(0)
+#define LOG_PERROR(dev, _msg, ...)		do { log_write(LOG_LEVEL_INFO, "%s: %s: " _msg "\n", __FILENAME__, dev_name(dev), ##__VA_ARGS__); exit(-1); } while(0)
+#define LOG_INFO(dev, _msg, ...)		do { log_write(LOG_LEVEL_INFO, "%s: %s: " _msg "\n", __FILENAME__, dev_name(dev), ##__VA_ARGS__); } while(0)
+#define LOG_VERBOSE(dev, _msg, ...)	do { if (log_enabled(LOG_LEVEL_VERBOSE, __FILENAME__)) { log_write(LOG_LEVEL_VERBOSE, "%s: %s: " _msg "\n", __FILENAME__, dev_name(dev), ##__VA_ARGS__); } } while(0)
+#define LOG_DEBUG(dev, _msg, ...)		do { if (log_enabled(LOG_LEVEL_DEBUG, __FILENAME__)) { log_write(LOG_LEVEL_DEBUG, "%s: %s: " _msg "\n", __FILENAME__, dev_name(dev), ##__VA_ARGS__); } } while(0)
 
 #define CLOCK_FROM_PARAMS -1
 
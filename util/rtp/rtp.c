@@ -0,0 +1,119 @@
+#include "rtp.h"
+#include "util/h264/h264.h"
+#include "util/opts/log.h"
+
+#define RTP_NAL_FU_A 28
+
+static rtp_packet_t *rtp_packetizer_next(rtp_packetizer_t *packetizer)
+{
+  if (packetizer->npackets >= packetizer->capacity) {
+    unsigned capacity = MAX(packetizer->capacity * 2, 64);
+    rtp_packet_t *packets = reallocarray(packetizer->packets, capacity, sizeof(rtp_packet_t));
+    if (!packets) {
+      return NULL;
+    }
+    packetizer->packets = packets;
+    packetizer->capacity = capacity;
+  }
+
+  rtp_packet_t *packet = &packetizer->packets[packetizer->npackets++];
+  packet->header_size = RTP_HEADER_SIZE;
+  return packet;
+}
+
+void rtp_header_set(uint8_t *h, uint8_t payload_type, uint16_t sequence, uint32_t timestamp, uint32_t ssrc)
+{
+  h[0] = 0x80; // version 2
+  h[1] = (h[1] & 0x80) | (payload_type & 0x7F); // keep marker
+  h[2] = sequence >> 8;
+  h[3] = sequence;
+  h[4] = timestamp >> 24;
+  h[5] = timestamp >> 16;
+  h[6] = timestamp >> 8;
+  h[7] = timestamp;
+  h[8] = ssrc >> 24;
+  h[9] = ssrc >> 16;
+  h[10] = ssrc >> 8;
+  h[11] = ssrc;
+}
+
+void rtp_packet_set_header(rtp_packet_t *packet, uint8_t payload_type, uint16_t sequence, uint32_t timestamp, uint32_t ssrc)
+{
+  rtp_header_set(packet->header, payload_type, sequence, timestamp, ssrc);
+}
+
+uint32_t rtp_h264_timestamp(uint64_t time_us)
+{
+  return (uint32_t)(time_us * (RTP_H264_CLOCK_RATE / 1000) / 1000);
+}
+
+int rtp_packetize_h264(rtp_packetizer_t *packetizer, const h264_index_t *index, uint32_t timestamp)
+{
+  unsigned max_payload = packetizer->max_payload ? packetizer->max_payload : RTP_DEFAULT_MAX_PAYLOAD;
+
+  packetizer->npackets = 0;
+
+  for (unsigned i = 0; i < index->nnals; i++) {
+    h264_nal_t nal = index->nals[i];
+
+    if (nal.type == H264_NAL_AUD) {
+      continue;
+    }
+
+    if (nal.size <= max_payload) {
+      rtp_packet_t *packet = rtp_packetizer_next(packetizer);
+      if (!packet) {
+        return -1;
+      }
+      packet->header[1] = 0;
+      packet->payload = nal.data;
+      packet->payload_size = nal.size;
+      continue;
+    }
+
+    // FU-A: NAL header is carried in FU indicator and header
+    uint8_t nal_header = nal.data[0];
+    const uint8_t *payload = nal.data + 1;
+    size_t remaining = nal.size - 1;
+    bool start = true;
+
+    while (remaining > 0) {
+      rtp_packet_t *packet = rtp_packetizer_next(packetizer);
+      if (!packet) {
+        return -1;
+      }
+
+      size_t n = MIN(remaining, max_payload - RTP_FU_HEADER_SIZE);
+      bool stop = n == remaining;
+
+      packet->header[1] = 0;
+      packet->header[RTP_HEADER_SIZE] = (nal_header & 0xE0) | RTP_NAL_FU_A;
+      packet->header[RTP_HEADER_SIZE + 1] = (start ? 0x80 : 0) | (stop ? 0x40 : 0) | H264_NAL_TYPE(nal_header);
+      packet->header_size = RTP_HEADER_SIZE + RTP_FU_HEADER_SIZE;
+      packet->payload = payload;
+      packet->payload_size = n;
+
+      payload += n;
+      remaining -= n;
+      start = false;
+    }
+  }
+
+  for (unsigned i = 0; i < packetizer->npackets; i++) {
+    rtp_packet_t *packet = &packetizer->packets[i];
+    if (i == packetizer->npackets - 1) {
+      packet->header[1] = 0x80; // marker on last packet of access unit
+    }
+    rtp_packet_set_header(packet, packetizer->payload_type, packetizer->sequence++, timestamp, packetizer->ssrc);
+  }
+
+  return packetizer->npackets;
+}
+
+void rtp_packetizer_close(rtp_packetizer_t *packetizer)
+{
+  free(packetizer->packets);
+  packetizer->packets = NULL;
+  packetizer->npackets = 0;
+  packetizer->capacity = 0;
+}
@@ -0,0 +1,42 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stddef.h>
+
+#include "util/h264/h264.h"
+
+#define RTP_HEADER_SIZE 12
+#define RTP_FU_HEADER_SIZE 2
+#define RTP_DEFAULT_MAX_PAYLOAD 1400
+#define RTP_H264_CLOCK_RATE 90000
+
+typedef struct rtp_packet_s {
+  uint8_t header[RTP_HEADER_SIZE + RTP_FU_HEADER_SIZE];
+  unsigned header_size;
+  const uint8_t *payload; // points into the frame
+  size_t payload_size;
+} rtp_packet_t;
+
+typedef struct rtp_packetizer_s {
+  const char *name;
+  uint8_t payload_type;
+  uint32_t ssrc;
+  unsigned max_payload;
+  uint16_t sequence;
+
+  // private
+  rtp_packet_t *packets;
+  unsigned npackets;
+  unsigned capacity;
+} rtp_packetizer_t;
+
+// Fragments indexed frame into RFC 6184 single NAL and FU-A packets.
+// Packets reference the frame data, so it has to outlive their use.
+int rtp_packetize_h264(rtp_packetizer_t *packetizer, const h264_index_t *index, uint32_t timestamp);
+void rtp_packetizer_close(rtp_packetizer_t *packetizer);
+
+// Rewrites serialized RTP header in place, the marker bit is kept.
+void rtp_header_set(uint8_t *header, uint8_t payload_type, uint16_t sequence, uint32_t timestamp, uint32_t ssrc);
+void rtp_packet_set_header(rtp_packet_t *packet, uint8_t payload_type, uint16_t sequence, uint32_t timestamp, uint32_t ssrc);
+uint32_t rtp_h264_timestamp(uint64_t time_us);
@@ -0,0 +1,103 @@
+#include "uevent.h"
+#include "util/opts/log.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <linux/netlink.h>
+
+#define UEVENT_BUFFER_SIZE 8192
+#define UEVENT_GROUP_KERNEL 1
+#define UEVENT_GROUP_UDEV 2
+
+// the header of the messages forwarded by udevd after processing the rules
+#define UEVENT_UDEV_PREFIX "libudev"
+#define UEVENT_UDEV_PROPERTIES_OFFSET 16
+
+int uevent_open()
+{
+  struct sockaddr_nl addr = {
+    .nl_family = AF_NETLINK,
+    .nl_groups = UEVENT_GROUP_KERNEL | UEVENT_GROUP_UDEV
+  };
+
+  int fd = socket(AF_NETLINK, SOCK_DGRAM | SOCK_CLOEXEC | SOCK_NONBLOCK, NETLINK_KOBJECT_UEVENT);
+  if (fd < 0) {
+    LOG_INFO(NULL, "Cannot open uevent socket: errno=%d", errno);
+    return -1;
+  }
+
+  if (bind(fd, (struct sockaddr *)&addr, sizeof(addr)) < 0) {
+    LOG_INFO(NULL, "Cannot bind uevent socket: errno=%d", errno);
+    close(fd);
+    return -1;
+  }
+
+  return fd;
+}
+
+void uevent_close(int fd)
+{
+  if (fd >= 0) {
+    close(fd);
+  }
+}
+
+static bool uevent_is_video_added(const char *buf, int len)
+{
+  const char *properties = buf;
+  bool added = false, video = false;
+
+  if (len > UEVENT_UDEV_PROPERTIES_OFFSET + 4 && !strcmp(buf, UEVENT_UDEV_PREFIX)) {
+    unsigned offset;
+    memcpy(&offset, buf + UEVENT_UDEV_PROPERTIES_OFFSET, sizeof(offset));
+    if (offset >= (unsigned)len) {
+      return false;
+    }
+    properties = buf + offset;
+  }
+
+  for (const char *key = properties; key < buf + len; key += strlen(key) + 1) {
+    if (!strcmp(key, "ACTION=add")) {
+      added = true;
+    } else if (!strcmp(key, "SUBSYSTEM=video4linux") || !strcmp(key, "SUBSYSTEM=media")) {
+      video = true;
+    }
+  }
+
+  return added && video;
+}
+
+bool uevent_wait_video_added(int fd, int timeout_ms)
+{
+  char buf[UEVENT_BUFFER_SIZE];
+  uint64_t deadline_us = get_monotonic_time_us(NULL, NULL) + timeout_ms * 1000LL;
+
+  while (true) {
+    uint64_t now_us = get_monotonic_time_us(NULL, NULL);
+    if (now_us >= deadline_us) {
+      return false;
+    }
+
+    struct pollfd pollfd = { .fd = fd, .events = POLLIN };
+    int ret = poll(&pollfd, 1, (deadline_us - now_us + 999) / 1000);
+    if (ret < 0 && errno != EINTR) {
+      return false;
+    } else if (ret <= 0) {
+      continue;
+    }
+
+    // the messages are NUL separated strings, ensure the last one is terminated
+    int len = recv(fd, buf, sizeof(buf) - 1, 0);
+    if (len <= 0) {
+      continue;
+    }
+    buf[len] = 0;
+
+    if (uevent_is_video_added(buf, len)) {
+      return true;
+    }
+  }
+}
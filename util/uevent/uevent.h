@@ -0,0 +1,9 @@
+#pragma once
+
+#include <stdbool.h>
+
+int uevent_open();
+void uevent_close(int fd);
+
+// returns true when a video device was added before the timeout
+bool uevent_wait_video_added(int fd, int timeout_ms);